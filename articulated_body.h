@@ -0,0 +1,577 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include <Eigen/Dense>
+#include <klein/klein.hpp>
+#include "batched_maps.h"
+#include "projection_kernels.h"
+#include "rigid_body.h"
+#include "thread_pool.h"
+
+
+/*
+Forward dynamics of a tree of rigid bodies connected by one degree of freedom
+joints, following the screw theory treatment of Hadfield H., Lasenby J., Screw
+Theory in Geometric Algebra for Constrained Rigid Body Dynamics AACA (2021).
+Every joint is a line in the frame of its child body, the body moves relative
+to its parent by exp(q axis/2) for revolute joints and 1 + q axis/2 for
+prismatic ones. Working in the reduced joint coordinates the constraints hold
+exactly and the articulated body algorithm solves for the joint accelerations
+in three sweeps over the tree, so the cost is linear in the number of bodies.
+The base is either fixed or a free body whose motor is stepped through the
+Cayley chart kinematics, exactly as in rigid_body.h.
+
+The sweeps use spatial vectors in body coordinates ordered (angular, linear).
+A body frame velocity bivector omega, with M' = M omega/2, has angular part
+-(e23, e31, e12) and linear part -(e01, e02, e03) at the body origin.
+*/
+
+
+using spatial_vector = Eigen::Matrix<double, 6, 1>;
+using spatial_matrix = Eigen::Matrix<double, 6, 6>;
+
+
+/// One degree of freedom joint types
+enum class joint_type {
+    // Rotation about the joint axis, a unit line through the joint
+    revolute,
+    // Translation along the joint axis, a unit ideal line
+    prismatic
+};
+
+
+/// Mass properties of a body in its own coordinates
+struct body_inertia {
+    double mass = 1.0;
+    Eigen::Vector3d centre_of_mass = Eigen::Vector3d::Zero();
+    // Rotational inertia about the centre of mass
+    Eigen::Matrix3d rotational = Eigen::Matrix3d::Identity();
+};
+
+
+/// Configuration of an articulated body
+struct articulated_body_options {
+    // A floating base is a free body moving under the forces of the tree,
+    // otherwise the base stays where it is put
+    bool floating_base = false;
+    Eigen::Vector3d gravity = Eigen::Vector3d(0.0, 0.0, -9.81);
+    // Norm of the euclidean part of the base chart coordinates past which
+    // they are folded into the base reference motor
+    double rechart_threshold = 0.5;
+    // Threads for the sweeps over the subtrees hanging off the base, which
+    // are independent of each other
+    std::size_t num_threads = 1;
+};
+
+
+Eigen::Matrix3d cross_matrix(const Eigen::Vector3d& x){
+    Eigen::Matrix3d m;
+    m << 0.0, -x.z(), x.y(),
+         x.z(), 0.0, -x.x(),
+         -x.y(), x.x(), 0.0;
+    return m;
+}
+
+
+spatial_matrix motion_cross_matrix(const spatial_vector& v){
+    /*
+    v x for motion vectors, the derivative of a motion vector carried by a
+    frame moving with velocity v
+    */
+    spatial_matrix m = spatial_matrix::Zero();
+    m.topLeftCorner<3, 3>() = cross_matrix(v.head<3>());
+    m.bottomLeftCorner<3, 3>() = cross_matrix(v.tail<3>());
+    m.bottomRightCorner<3, 3>() = cross_matrix(v.head<3>());
+    return m;
+}
+
+
+spatial_matrix force_cross_matrix(const spatial_vector& v){
+    /*
+    v x* for force vectors, the dual of motion_cross_matrix
+    */
+    return -motion_cross_matrix(v).transpose();
+}
+
+
+spatial_matrix spatial_inertia(const body_inertia& inertia){
+    /*
+    The 6x6 inertia of a body about its origin
+    */
+    const Eigen::Matrix3d c = cross_matrix(inertia.centre_of_mass);
+    spatial_matrix m;
+    m.topLeftCorner<3, 3>() = inertia.rotational + inertia.mass*c*c.transpose();
+    m.topRightCorner<3, 3>() = inertia.mass*c;
+    m.bottomLeftCorner<3, 3>() = inertia.mass*c.transpose();
+    m.bottomRightCorner<3, 3>() = inertia.mass*Eigen::Matrix3d::Identity();
+    return m;
+}
+
+
+spatial_vector line_to_spatial(kln::line const& l){
+    /*
+    Spatial motion vector of a body frame velocity bivector
+    */
+    spatial_vector v;
+    v << -l.e23(), -l.e31(), -l.e12(), -l.e01(), -l.e02(), -l.e03();
+    return v;
+}
+
+
+kln::line spatial_to_line(const spatial_vector& v){
+    /*
+    Body frame velocity bivector of a spatial motion vector
+    */
+    return kln::line{static_cast<float>(-v(3)), static_cast<float>(-v(4)), static_cast<float>(-v(5)),
+                     static_cast<float>(-v(0)), static_cast<float>(-v(1)), static_cast<float>(-v(2))};
+}
+
+
+void motor_rigid_transform(const double motor[8], Eigen::Matrix3d& rotation, Eigen::Vector3d& translation){
+    /*
+    The rotation and translation of M p ~M for a unit motor
+    */
+    double matrix[12];
+    motor_to_mat3x4(motor, matrix);
+    rotation << matrix[0], matrix[1], matrix[2],
+                matrix[4], matrix[5], matrix[6],
+                matrix[8], matrix[9], matrix[10];
+    translation << matrix[3], matrix[7], matrix[11];
+}
+
+
+spatial_matrix motion_transform(const Eigen::Matrix3d& rotation, const Eigen::Vector3d& translation){
+    /*
+    Takes motion vectors from parent to child coordinates, for a child placed
+    in its parent by p_parent = rotation*p_child + translation
+    */
+    const Eigen::Matrix3d E = rotation.transpose();
+    spatial_matrix X = spatial_matrix::Zero();
+    X.topLeftCorner<3, 3>() = E;
+    X.bottomLeftCorner<3, 3>() = -E*cross_matrix(translation);
+    X.bottomRightCorner<3, 3>() = E;
+    return X;
+}
+
+
+class articulated_body {
+    /*
+    A base with a tree of bodies hanging off it. Bodies are added parents
+    first and hold their joint coordinate, rate and the workspace of the
+    articulated body algorithm. The subtrees rooted at the children of the
+    base share nothing but the base, so the sweeps over them can run in
+    parallel.
+    */
+public:
+    explicit articulated_body(const articulated_body_options& options=articulated_body_options())
+        : options_(options)
+    {
+        if (options_.num_threads > 1){
+            pool_ = std::make_unique<work_stealing_pool>(options_.num_threads);
+        }
+    }
+
+    std::size_t size() const noexcept { return bodies_.size(); }
+
+    void set_base(kln::motor const& pose, const body_inertia& inertia=body_inertia(),
+                  kln::line const& velocity=kln::line{0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f}){
+        /*
+        Places the base, for a floating base also setting its inertia and its
+        body frame velocity bivector
+        */
+        const double coefficients[8] = {pose.scalar(), pose.e23(), pose.e31(), pose.e12(),
+                                        pose.e01(), pose.e02(), pose.e03(), pose.e0123()};
+        for (int k=0; k<8; k++){
+            base_reference_[k] = {coefficients[k]};
+        }
+        normalize_motor(base_reference_);
+        for (int k=0; k<6; k++){
+            base_phi_[k] = {0.0};
+        }
+        base_inertia_ = spatial_inertia(inertia);
+        base_mass_ = inertia.mass;
+        base_centre_of_mass_ = inertia.centre_of_mass;
+        base_velocity_ = options_.floating_base ? line_to_spatial(velocity) : spatial_vector::Zero();
+    }
+
+    int add_body(int parent, joint_type type, kln::motor const& offset, kln::line const& axis,
+                 const body_inertia& inertia){
+        /*
+        Attaches a body to parent, or to the base for -1, placed at offset in
+        its parent's frame at zero joint coordinate. The axis is given in the
+        body's frame and is normalised. Returns the index of the new body, or
+        -1 when the parent does not exist yet.
+        */
+        if (parent < -1 || parent >= static_cast<int>(bodies_.size())){
+            return -1;
+        }
+        body b;
+        b.parent = parent;
+        b.type = type;
+        const double coefficients[8] = {offset.scalar(), offset.e23(), offset.e31(), offset.e12(),
+                                        offset.e01(), offset.e02(), offset.e03(), offset.e0123()};
+        W normalised[8];
+        for (int k=0; k<8; k++){
+            normalised[k] = {coefficients[k]};
+        }
+        normalize_motor(normalised);
+        for (int k=0; k<8; k++){
+            b.offset[k] = normalised[k].v;
+        }
+        double line[6] = {axis.e01(), axis.e02(), axis.e03(), axis.e23(), axis.e31(), axis.e12()};
+        const double* direction = (type == joint_type::revolute) ? line + 3 : line;
+        double norm = std::sqrt(direction[0]*direction[0] + direction[1]*direction[1] + direction[2]*direction[2]);
+        for (int k=0; k<6; k++){
+            b.axis_line[k] = line[k]/norm;
+        }
+        b.axis << -b.axis_line[3], -b.axis_line[4], -b.axis_line[5], -b.axis_line[0], -b.axis_line[1], -b.axis_line[2];
+        b.inertia = spatial_inertia(inertia);
+        b.mass = inertia.mass;
+        b.centre_of_mass = inertia.centre_of_mass;
+        bodies_.push_back(b);
+        q_.push_back(0.0);
+        qd_.push_back(0.0);
+        qdd_.push_back(0.0);
+        subtrees_dirty_ = true;
+        return static_cast<int>(bodies_.size()) - 1;
+    }
+
+    std::vector<double>& positions() noexcept { return q_; }
+    const std::vector<double>& positions() const noexcept { return q_; }
+    std::vector<double>& velocities() noexcept { return qd_; }
+    const std::vector<double>& velocities() const noexcept { return qd_; }
+    const std::vector<double>& accelerations() const noexcept { return qdd_; }
+
+    kln::line base_velocity() const { return spatial_to_line(base_velocity_); }
+    kln::line base_acceleration() const { return spatial_to_line(base_acceleration_); }
+
+    kln::motor base_motor() const {
+        double motor[8];
+        current_base_motor(motor);
+        return to_klein(motor);
+    }
+
+    kln::motor motor(std::size_t i) const {
+        /*
+        World motor of body i as of the last call to forward_dynamics
+        */
+        return to_klein(bodies_[i].world);
+    }
+
+    void forward_dynamics(const double* tau=nullptr){
+        /*
+        Solves for the joint accelerations, and the base acceleration of a
+        floating base, under gravity and the joint forces tau, null for none.
+        Three sweeps of the articulated body algorithm: velocities base to
+        leaves and then articulated inertias leaves to base over each
+        subtree, the base, then accelerations base to leaves.
+        */
+        update_subtrees();
+        double base[8];
+        current_base_motor(base);
+        Eigen::Matrix3d base_rotation;
+        Eigen::Vector3d base_translation;
+        motor_rigid_transform(base, base_rotation, base_translation);
+        for (int k=0; k<8; k++){
+            base_world_[k] = base[k];
+        }
+        base_gravity_ << 0.0, 0.0, 0.0, base_rotation.transpose()*options_.gravity;
+
+        auto inward = [&](std::size_t t, std::size_t){
+            velocity_sweep(subtrees_[t], tau);
+            inertia_sweep(subtrees_[t]);
+        };
+        run_subtrees(inward);
+
+        if (options_.floating_base){
+            spatial_matrix IA = base_inertia_;
+            spatial_vector pA = force_cross_matrix(base_velocity_)*base_inertia_*base_velocity_
+                                - base_inertia_*base_gravity_;
+            for (const std::vector<int>& subtree : subtrees_){
+                IA += bodies_[subtree.front()].parent_inertia;
+                pA += bodies_[subtree.front()].parent_bias;
+            }
+            base_acceleration_ = -IA.ldlt().solve(pA);
+        }
+        else{
+            base_acceleration_.setZero();
+        }
+
+        auto outward = [&](std::size_t t, std::size_t){
+            acceleration_sweep(subtrees_[t]);
+        };
+        run_subtrees(outward);
+    }
+
+    void step(double dt, const double* tau=nullptr){
+        /*
+        Advances the system by dt with semi implicit Euler on the joint
+        coordinates and the base velocity. The base motor takes a fourth order
+        Runge-Kutta step of the Cayley chart kinematics at its new velocity.
+        */
+        forward_dynamics(tau);
+        for (std::size_t i=0; i<bodies_.size(); i++){
+            qd_[i] += dt*qdd_[i];
+            q_[i] += dt*qd_[i];
+        }
+        if (options_.floating_base){
+            base_velocity_ += dt*base_acceleration_;
+            const spatial_vector& v = base_velocity_;
+            W omega[6] = {{-v(3)}, {-v(4)}, {-v(5)}, {-v(0)}, {-v(1)}, {-v(2)}};
+            chart_rk4_kernel<cayley_chart<se3>>(W{-1.0}, W{dt}, base_phi_, omega);
+            double ww = base_phi_[3].v*base_phi_[3].v + base_phi_[4].v*base_phi_[4].v + base_phi_[5].v*base_phi_[5].v;
+            if (ww > options_.rechart_threshold*options_.rechart_threshold){
+                fold_chart_kernel<cayley_chart<se3>>(velocity_frame::body, base_reference_, base_phi_);
+            }
+        }
+    }
+
+    double energy() const {
+        /*
+        Kinetic plus gravitational potential energy at the current state.
+        Only the placements and velocities are needed, so this runs the
+        velocity sweep alone into its own buffers, leaving the accelerations
+        and the workspace of forward_dynamics untouched.
+        */
+        double base[8];
+        current_base_motor(base);
+        Eigen::Matrix3d rotation;
+        Eigen::Vector3d translation;
+        double energy = 0.0;
+        if (options_.floating_base){
+            motor_rigid_transform(base, rotation, translation);
+            energy += 0.5*base_velocity_.dot(base_inertia_*base_velocity_);
+            energy -= base_mass_*options_.gravity.dot(rotation*base_centre_of_mass_ + translation);
+        }
+        std::vector<double> world(8*bodies_.size());
+        std::vector<spatial_vector> velocity(bodies_.size());
+        spatial_matrix transform;
+        for (std::size_t i=0; i<bodies_.size(); i++){
+            const body& b = bodies_[i];
+            const bool on_base = (b.parent < 0);
+            place_body(i, on_base ? base : &world[8*b.parent], on_base ? base_velocity_ : velocity[b.parent],
+                       &world[8*i], transform, velocity[i]);
+            energy += 0.5*velocity[i].dot(b.inertia*velocity[i]);
+            motor_rigid_transform(&world[8*i], rotation, translation);
+            energy -= b.mass*options_.gravity.dot(rotation*b.centre_of_mass + translation);
+        }
+        return energy;
+    }
+
+private:
+    using W = scalar_batch<double>;
+
+    struct body {
+        int parent = -1;
+        joint_type type = joint_type::revolute;
+        double offset[8] = {1.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+        double axis_line[6] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+        spatial_vector axis = spatial_vector::Zero();
+        spatial_matrix inertia = spatial_matrix::Identity();
+        double mass = 1.0;
+        Eigen::Vector3d centre_of_mass = Eigen::Vector3d::Zero();
+
+        // Articulated body algorithm workspace
+        double world[8] = {1.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+        spatial_matrix transform = spatial_matrix::Identity();
+        spatial_vector velocity = spatial_vector::Zero();
+        spatial_vector bias_acceleration = spatial_vector::Zero();
+        spatial_matrix articulated_inertia = spatial_matrix::Zero();
+        spatial_vector bias_force = spatial_vector::Zero();
+        spatial_vector U = spatial_vector::Zero();
+        double D = 1.0;
+        double u = 0.0;
+        spatial_vector acceleration = spatial_vector::Zero();
+        // Contribution of the subtree rooted here to its parent
+        spatial_matrix parent_inertia = spatial_matrix::Zero();
+        spatial_vector parent_bias = spatial_vector::Zero();
+    };
+
+    static kln::motor to_klein(const double motor[8]){
+        return kln::motor{static_cast<float>(motor[0]), static_cast<float>(motor[1]), static_cast<float>(motor[2]),
+                          static_cast<float>(motor[3]), static_cast<float>(motor[4]), static_cast<float>(motor[5]),
+                          static_cast<float>(motor[6]), static_cast<float>(motor[7])};
+    }
+
+    void current_base_motor(double motor[8]) const {
+        W reference[8];
+        W phi[6];
+        for (int k=0; k<8; k++){
+            reference[k] = base_reference_[k];
+        }
+        for (int k=0; k<6; k++){
+            phi[k] = base_phi_[k];
+        }
+        fold_chart_kernel<cayley_chart<se3>>(velocity_frame::body, reference, phi);
+        for (int k=0; k<8; k++){
+            motor[k] = reference[k].v;
+        }
+    }
+
+    void joint_motor(const body& b, double q, double motor[8]) const {
+        /*
+        Motion of a body relative to its parent frame at joint coordinate q,
+        the offset followed by the joint's own motion along its axis
+        */
+        double joint[8];
+        if (b.type == joint_type::revolute){
+            double c = std::cos(0.5*q);
+            double s = std::sin(0.5*q);
+            joint[0] = c;
+            joint[1] = s*b.axis_line[3];
+            joint[2] = s*b.axis_line[4];
+            joint[3] = s*b.axis_line[5];
+            joint[4] = s*b.axis_line[0];
+            joint[5] = s*b.axis_line[1];
+            joint[6] = s*b.axis_line[2];
+            joint[7] = 0.0;
+        }
+        else{
+            joint[0] = 1.0;
+            joint[1] = 0.0;
+            joint[2] = 0.0;
+            joint[3] = 0.0;
+            joint[4] = 0.5*q*b.axis_line[0];
+            joint[5] = 0.5*q*b.axis_line[1];
+            joint[6] = 0.5*q*b.axis_line[2];
+            joint[7] = 0.0;
+        }
+        motor_product(b.offset, joint, motor);
+    }
+
+    void update_subtrees(){
+        /*
+        Groups the bodies into the subtrees hanging off the base, each in
+        parent before child order
+        */
+        if (!subtrees_dirty_){
+            return;
+        }
+        subtrees_.clear();
+        std::vector<int> root(bodies_.size());
+        std::vector<int> subtree_of_root(bodies_.size(), -1);
+        for (std::size_t i=0; i<bodies_.size(); i++){
+            int parent = bodies_[i].parent;
+            root[i] = (parent < 0) ? static_cast<int>(i) : root[parent];
+            if (parent < 0){
+                subtree_of_root[i] = static_cast<int>(subtrees_.size());
+                subtrees_.emplace_back();
+            }
+            subtrees_[subtree_of_root[root[i]]].push_back(static_cast<int>(i));
+        }
+        subtrees_dirty_ = false;
+    }
+
+    template <typename F>
+    void run_subtrees(F&& sweep){
+        if (pool_ && subtrees_.size() > 1){
+            pool_->parallel_for(subtrees_.size(), sweep);
+        }
+        else{
+            for (std::size_t t=0; t<subtrees_.size(); t++){
+                sweep(t, 0);
+            }
+        }
+    }
+
+    void place_body(std::size_t i, const double parent_world[8], const spatial_vector& parent_velocity,
+                    double world[8], spatial_matrix& transform, spatial_vector& velocity) const {
+        /*
+        World motor, transform from the parent and spatial velocity of body
+        i, given the world motor and velocity of its parent
+        */
+        const body& b = bodies_[i];
+        double relative[8];
+        joint_motor(b, q_[i], relative);
+        motor_product(parent_world, relative, world);
+        Eigen::Matrix3d rotation;
+        Eigen::Vector3d translation;
+        motor_rigid_transform(relative, rotation, translation);
+        transform = motion_transform(rotation, translation);
+        velocity = transform*parent_velocity + b.axis*qd_[i];
+    }
+
+    void velocity_sweep(const std::vector<int>& subtree, const double* tau){
+        /*
+        Base to leaves, the placement, velocity and velocity product terms of
+        every body
+        */
+        for (int i : subtree){
+            body& b = bodies_[i];
+            const bool on_base = (b.parent < 0);
+            const double* parent_world = on_base ? base_world_ : bodies_[b.parent].world;
+            const spatial_vector& parent_velocity = on_base ? base_velocity_ : bodies_[b.parent].velocity;
+            place_body(i, parent_world, parent_velocity, b.world, b.transform, b.velocity);
+
+            Eigen::Matrix3d world_rotation;
+            Eigen::Vector3d world_translation;
+            motor_rigid_transform(b.world, world_rotation, world_translation);
+            spatial_vector gravity;
+            gravity << 0.0, 0.0, 0.0, world_rotation.transpose()*options_.gravity;
+
+            const spatial_vector joint_velocity = b.axis*qd_[i];
+            b.bias_acceleration = motion_cross_matrix(b.velocity)*joint_velocity;
+            b.articulated_inertia = b.inertia;
+            b.bias_force = force_cross_matrix(b.velocity)*b.inertia*b.velocity - b.inertia*gravity;
+            b.u = (tau != nullptr) ? tau[i] : 0.0;
+        }
+    }
+
+    void inertia_sweep(const std::vector<int>& subtree){
+        /*
+        Leaves to base, the articulated inertia and bias force of every body,
+        passing what each subtree contributes on to its parent
+        */
+        for (auto it=subtree.rbegin(); it!=subtree.rend(); ++it){
+            body& b = bodies_[*it];
+            b.U = b.articulated_inertia*b.axis;
+            b.D = b.axis.dot(b.U);
+            b.u -= b.axis.dot(b.bias_force);
+            const spatial_matrix Ia = b.articulated_inertia - b.U*b.U.transpose()/b.D;
+            const spatial_vector pa = b.bias_force + Ia*b.bias_acceleration + b.U*(b.u/b.D);
+            b.parent_inertia = b.transform.transpose()*Ia*b.transform;
+            b.parent_bias = b.transform.transpose()*pa;
+            if (b.parent >= 0){
+                bodies_[b.parent].articulated_inertia += b.parent_inertia;
+                bodies_[b.parent].bias_force += b.parent_bias;
+            }
+        }
+    }
+
+    void acceleration_sweep(const std::vector<int>& subtree){
+        /*
+        Base to leaves, the joint and spatial accelerations of every body
+        */
+        for (int i : subtree){
+            body& b = bodies_[i];
+            const spatial_vector& parent_acceleration = (b.parent < 0) ? base_acceleration_
+                                                                       : bodies_[b.parent].acceleration;
+            b.acceleration = b.transform*parent_acceleration + b.bias_acceleration;
+            qdd_[i] = (b.u - b.U.dot(b.acceleration))/b.D;
+            b.acceleration += b.axis*qdd_[i];
+        }
+    }
+
+    articulated_body_options options_;
+    std::unique_ptr<work_stealing_pool> pool_;
+    std::vector<body> bodies_;
+    std::vector<double> q_;
+    std::vector<double> qd_;
+    std::vector<double> qdd_;
+    std::vector<std::vector<int>> subtrees_;
+    bool subtrees_dirty_ = true;
+
+    // The base sits at base_reference_*cayley(base_phi_)
+    W base_reference_[8] = {{1.0}, {0.0}, {0.0}, {0.0}, {0.0}, {0.0}, {0.0}, {0.0}};
+    W base_phi_[6] = {{0.0}, {0.0}, {0.0}, {0.0}, {0.0}, {0.0}};
+    double base_world_[8] = {1.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+    spatial_matrix base_inertia_ = spatial_matrix::Identity();
+    double base_mass_ = 1.0;
+    Eigen::Vector3d base_centre_of_mass_ = Eigen::Vector3d::Zero();
+    spatial_vector base_velocity_ = spatial_vector::Zero();
+    spatial_vector base_acceleration_ = spatial_vector::Zero();
+    spatial_vector base_gravity_ = spatial_vector::Zero();
+};
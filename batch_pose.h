@@ -0,0 +1,84 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include <klein/klein.hpp>
+#include "point_cloud.h"
+#include "camera_ops.h"
+#include "thread_pool.h"
+
+
+/// One independent camera to solve for
+struct pose_problem {
+    kln::line initial_biv;
+    point_cloud_view points;
+    point_cloud_view camera_points;
+};
+
+
+/// Per problem results and aggregate throughput of a batch
+struct batch_pose_report {
+    std::vector<pose_solver_result> results;
+    std::size_t num_usable = 0;
+    double seconds = 0.0;
+    double problems_per_second = 0.0;
+};
+
+
+class batch_pose_solver {
+    /*
+    Solves many independent pose problems concurrently. Problems are spread
+    over a work stealing pool and every worker thread keeps its own
+    pose_solver_workspace, so ceres problems, cost functions and solver state
+    are reused across the whole batch and across calls. Each individual solve
+    runs single threaded, the parallelism is across problems.
+    */
+public:
+    explicit batch_pose_solver(const pose_solver_options& options=pose_solver_options(),
+                               std::size_t num_threads=std::thread::hardware_concurrency())
+        : options_(options), pool_(num_threads)
+    {
+        options_.num_threads = 1;
+        for (std::size_t i=0; i<pool_.size(); i++){
+            workspaces_.push_back(std::make_unique<pose_solver_workspace>());
+        }
+    }
+
+    std::size_t num_threads() const noexcept { return pool_.size(); }
+
+    void solve(const std::vector<pose_problem>& problems, batch_pose_report& report){
+        /*
+        Solves every problem, writing the results into report in the same order.
+        Passing the same report back in reuses its result storage.
+        */
+        report.results.resize(problems.size());
+        auto start = std::chrono::steady_clock::now();
+
+        pool_.parallel_for(problems.size(), [&](std::size_t index, std::size_t worker){
+            const pose_problem& problem = problems[index];
+            report.results[index] = workspaces_[worker]->solve(problem.initial_biv, problem.points, 
+                                                               problem.camera_points, options_);
+        });
+
+        auto stop = std::chrono::steady_clock::now();
+        report.seconds = std::chrono::duration<double>(stop - start).count();
+        report.problems_per_second = (report.seconds > 0.0) ? problems.size()/report.seconds : 0.0;
+        report.num_usable = 0;
+        for (const pose_solver_result& result : report.results){
+            report.num_usable += result.usable ? 1 : 0;
+        }
+    }
+
+    batch_pose_report solve(const std::vector<pose_problem>& problems){
+        batch_pose_report report;
+        solve(problems, report);
+        return report;
+    }
+
+private:
+    pose_solver_options options_;
+    work_stealing_pool pool_;
+    std::vector<std::unique_ptr<pose_solver_workspace>> workspaces_;
+};
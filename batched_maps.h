@@ -0,0 +1,634 @@
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+#include <klein/klein.hpp>
+#include "point_cloud.h"
+#include "simd_batch.h"
+
+
+/*
+Batched outer exponential, Cayley map, their inverses and the explicit motor
+inverse over structure-of-arrays bivectors and motors. Each map is evaluated
+from its closed form rather than composed from full geometric products, and
+written once against the SIMD batch types. The 8-wide AVX2 path is picked at
+runtime when the build itself only targets SSE. The same maps run over double
+arrays, and on single bivectors or motors in any scalar type through
+apply_map_scalar, which chart_motor and chart_bivector in chart_policy.h
+build on, so refinement can stay in double or ceres::Jet rather than round
+tripping through float.
+
+Bivectors are stored as {e01, e02, e03, e23, e31, e12} and motors as
+{scalar, e23, e31, e12, e01, e02, e03, e0123}. Writing a bivector as u + w,
+with u the ideal and w the euclidean part, and a motor as a + b + e + h e0123,
+with b the euclidean and e the ideal bivector part.
+*/
+
+
+/// Chart taking bivectors to motors
+enum class motor_chart {
+    outer_exp,
+    cayley
+};
+
+
+template <typename T>
+void motor_product(const T a[8], const T b[8], T out[8]){
+    /*
+    Geometric product of two motors given by their coefficients
+    */
+    T r[8];
+    r[0] = a[0]*b[0] - a[1]*b[1] - a[2]*b[2] - a[3]*b[3];
+    r[1] = a[0]*b[1] + a[1]*b[0] - a[2]*b[3] + a[3]*b[2];
+    r[2] = a[0]*b[2] + a[1]*b[3] + a[2]*b[0] - a[3]*b[1];
+    r[3] = a[0]*b[3] - a[1]*b[2] + a[2]*b[1] + a[3]*b[0];
+    r[4] = a[0]*b[4] - a[1]*b[7] - a[2]*b[6] + a[3]*b[5] + a[4]*b[0] - a[5]*b[3] + a[6]*b[2] - a[7]*b[1];
+    r[5] = a[0]*b[5] + a[1]*b[6] - a[2]*b[7] - a[3]*b[4] + a[4]*b[3] + a[5]*b[0] - a[6]*b[1] - a[7]*b[2];
+    r[6] = a[0]*b[6] - a[1]*b[5] + a[2]*b[4] - a[3]*b[7] - a[4]*b[2] + a[5]*b[1] + a[6]*b[0] - a[7]*b[3];
+    r[7] = a[0]*b[7] + a[1]*b[4] + a[2]*b[5] + a[3]*b[6] + a[4]*b[1] + a[5]*b[2] + a[6]*b[3] + a[7]*b[0];
+    for (int i=0; i<8; i++){
+        out[i] = r[i];
+    }
+}
+
+
+template <typename T>
+void motor_reverse(const T a[8], T out[8]){
+    /*
+    Reverse of a motor, negating the six bivector coefficients
+    */
+    out[0] = a[0];
+    for (int i=1; i<7; i++){
+        out[i] = -a[i];
+    }
+    out[7] = a[7];
+}
+
+
+template <typename V>
+void normalize_motor(V motor[8]){
+    /*
+    Scales the motor so that R~R = 1, which also restores the relation
+    between its ideal and pseudoscalar parts after rounding. With
+    R~R = s + 2t e0123 the inverse square root is (1 - t/s e0123)/sqrt(s)
+    */
+    const V s = motor[0]*motor[0] + motor[1]*motor[1] + motor[2]*motor[2] + motor[3]*motor[3];
+    const V t = motor[0]*motor[7] - motor[1]*motor[4] - motor[2]*motor[5] - motor[3]*motor[6];
+    const V alpha = V::broadcast(1.0f)/sqrt(s);
+    const V beta = -(alpha*t/s);
+    motor[7] = alpha*motor[7] + beta*motor[0];
+    for (int i=0; i<3; i++){
+        motor[4 + i] = alpha*motor[4 + i] - beta*motor[1 + i];
+    }
+    for (int i=0; i<4; i++){
+        motor[i] = alpha*motor[i];
+    }
+}
+
+
+/// Read only view over a contiguous structure-of-arrays set of bivectors
+struct line_array_view {
+    const float* e01 = nullptr;
+    const float* e02 = nullptr;
+    const float* e03 = nullptr;
+    const float* e23 = nullptr;
+    const float* e31 = nullptr;
+    const float* e12 = nullptr;
+    std::size_t count = 0;
+
+    std::size_t size() const noexcept { return count; }
+    bool empty() const noexcept { return count == 0; }
+
+    kln::line operator[](std::size_t i) const noexcept {
+        return kln::line{e01[i], e02[i], e03[i], e23[i], e31[i], e12[i]};
+    }
+
+    line_array_view subview(std::size_t offset, std::size_t n) const noexcept {
+        return {e01 + offset, e02 + offset, e03 + offset, e23 + offset, e31 + offset, e12 + offset, n};
+    }
+};
+
+
+/// Mutable view over a contiguous structure-of-arrays set of bivectors
+struct line_array_span {
+    float* e01 = nullptr;
+    float* e02 = nullptr;
+    float* e03 = nullptr;
+    float* e23 = nullptr;
+    float* e31 = nullptr;
+    float* e12 = nullptr;
+    std::size_t count = 0;
+
+    std::size_t size() const noexcept { return count; }
+    bool empty() const noexcept { return count == 0; }
+
+    kln::line operator[](std::size_t i) const noexcept {
+        return kln::line{e01[i], e02[i], e03[i], e23[i], e31[i], e12[i]};
+    }
+
+    void set(std::size_t i, kln::line const& l) noexcept {
+        e01[i] = l.e01();
+        e02[i] = l.e02();
+        e03[i] = l.e03();
+        e23[i] = l.e23();
+        e31[i] = l.e31();
+        e12[i] = l.e12();
+    }
+
+    line_array_span subspan(std::size_t offset, std::size_t n) const noexcept {
+        return {e01 + offset, e02 + offset, e03 + offset, e23 + offset, e31 + offset, e12 + offset, n};
+    }
+
+    operator line_array_view() const noexcept {
+        return {e01, e02, e03, e23, e31, e12, count};
+    }
+};
+
+
+/// Owning structure-of-arrays bivector container, each coefficient is stored in its own aligned array
+struct line_array {
+    aligned_float_vector e01;
+    aligned_float_vector e02;
+    aligned_float_vector e03;
+    aligned_float_vector e23;
+    aligned_float_vector e31;
+    aligned_float_vector e12;
+
+    line_array() = default;
+
+    explicit line_array(std::size_t n)
+    {
+        resize(n);
+    }
+
+    std::size_t size() const noexcept { return e01.size(); }
+    bool empty() const noexcept { return e01.empty(); }
+
+    void reserve(std::size_t n){
+        e01.reserve(n);
+        e02.reserve(n);
+        e03.reserve(n);
+        e23.reserve(n);
+        e31.reserve(n);
+        e12.reserve(n);
+    }
+
+    void resize(std::size_t n){
+        e01.resize(n, 0.0f);
+        e02.resize(n, 0.0f);
+        e03.resize(n, 0.0f);
+        e23.resize(n, 0.0f);
+        e31.resize(n, 0.0f);
+        e12.resize(n, 0.0f);
+    }
+
+    void clear() noexcept {
+        e01.clear();
+        e02.clear();
+        e03.clear();
+        e23.clear();
+        e31.clear();
+        e12.clear();
+    }
+
+    void push_back(kln::line const& l){
+        e01.push_back(l.e01());
+        e02.push_back(l.e02());
+        e03.push_back(l.e03());
+        e23.push_back(l.e23());
+        e31.push_back(l.e31());
+        e12.push_back(l.e12());
+    }
+
+    kln::line operator[](std::size_t i) const noexcept {
+        return kln::line{e01[i], e02[i], e03[i], e23[i], e31[i], e12[i]};
+    }
+
+    void set(std::size_t i, kln::line const& l) noexcept {
+        span().set(i, l);
+    }
+
+    line_array_view view() const noexcept {
+        return {e01.data(), e02.data(), e03.data(), e23.data(), e31.data(), e12.data(), size()};
+    }
+
+    line_array_span span() noexcept {
+        return {e01.data(), e02.data(), e03.data(), e23.data(), e31.data(), e12.data(), size()};
+    }
+
+    operator line_array_view() const noexcept {
+        return view();
+    }
+};
+
+
+/// Read only view over a contiguous structure-of-arrays set of motors
+struct motor_array_view {
+    const float* scalar = nullptr;
+    const float* e23 = nullptr;
+    const float* e31 = nullptr;
+    const float* e12 = nullptr;
+    const float* e01 = nullptr;
+    const float* e02 = nullptr;
+    const float* e03 = nullptr;
+    const float* e0123 = nullptr;
+    std::size_t count = 0;
+
+    std::size_t size() const noexcept { return count; }
+    bool empty() const noexcept { return count == 0; }
+
+    kln::motor operator[](std::size_t i) const noexcept {
+        return kln::motor{scalar[i], e23[i], e31[i], e12[i], e01[i], e02[i], e03[i], e0123[i]};
+    }
+
+    motor_array_view subview(std::size_t offset, std::size_t n) const noexcept {
+        return {scalar + offset, e23 + offset, e31 + offset, e12 + offset,
+                e01 + offset, e02 + offset, e03 + offset, e0123 + offset, n};
+    }
+};
+
+
+/// Mutable view over a contiguous structure-of-arrays set of motors
+struct motor_array_span {
+    float* scalar = nullptr;
+    float* e23 = nullptr;
+    float* e31 = nullptr;
+    float* e12 = nullptr;
+    float* e01 = nullptr;
+    float* e02 = nullptr;
+    float* e03 = nullptr;
+    float* e0123 = nullptr;
+    std::size_t count = 0;
+
+    std::size_t size() const noexcept { return count; }
+    bool empty() const noexcept { return count == 0; }
+
+    kln::motor operator[](std::size_t i) const noexcept {
+        return kln::motor{scalar[i], e23[i], e31[i], e12[i], e01[i], e02[i], e03[i], e0123[i]};
+    }
+
+    void set(std::size_t i, kln::motor const& R) noexcept {
+        scalar[i] = R.scalar();
+        e23[i] = R.e23();
+        e31[i] = R.e31();
+        e12[i] = R.e12();
+        e01[i] = R.e01();
+        e02[i] = R.e02();
+        e03[i] = R.e03();
+        e0123[i] = R.e0123();
+    }
+
+    motor_array_span subspan(std::size_t offset, std::size_t n) const noexcept {
+        return {scalar + offset, e23 + offset, e31 + offset, e12 + offset,
+                e01 + offset, e02 + offset, e03 + offset, e0123 + offset, n};
+    }
+
+    operator motor_array_view() const noexcept {
+        return {scalar, e23, e31, e12, e01, e02, e03, e0123, count};
+    }
+};
+
+
+/// Owning structure-of-arrays motor container, each coefficient is stored in its own aligned array
+struct motor_array {
+    aligned_float_vector scalar;
+    aligned_float_vector e23;
+    aligned_float_vector e31;
+    aligned_float_vector e12;
+    aligned_float_vector e01;
+    aligned_float_vector e02;
+    aligned_float_vector e03;
+    aligned_float_vector e0123;
+
+    motor_array() = default;
+
+    explicit motor_array(std::size_t n)
+    {
+        resize(n);
+    }
+
+    std::size_t size() const noexcept { return scalar.size(); }
+    bool empty() const noexcept { return scalar.empty(); }
+
+    void reserve(std::size_t n){
+        scalar.reserve(n);
+        e23.reserve(n);
+        e31.reserve(n);
+        e12.reserve(n);
+        e01.reserve(n);
+        e02.reserve(n);
+        e03.reserve(n);
+        e0123.reserve(n);
+    }
+
+    void resize(std::size_t n){
+        scalar.resize(n, 1.0f);
+        e23.resize(n, 0.0f);
+        e31.resize(n, 0.0f);
+        e12.resize(n, 0.0f);
+        e01.resize(n, 0.0f);
+        e02.resize(n, 0.0f);
+        e03.resize(n, 0.0f);
+        e0123.resize(n, 0.0f);
+    }
+
+    void clear() noexcept {
+        scalar.clear();
+        e23.clear();
+        e31.clear();
+        e12.clear();
+        e01.clear();
+        e02.clear();
+        e03.clear();
+        e0123.clear();
+    }
+
+    void push_back(kln::motor const& R){
+        scalar.push_back(R.scalar());
+        e23.push_back(R.e23());
+        e31.push_back(R.e31());
+        e12.push_back(R.e12());
+        e01.push_back(R.e01());
+        e02.push_back(R.e02());
+        e03.push_back(R.e03());
+        e0123.push_back(R.e0123());
+    }
+
+    kln::motor operator[](std::size_t i) const noexcept {
+        return kln::motor{scalar[i], e23[i], e31[i], e12[i], e01[i], e02[i], e03[i], e0123[i]};
+    }
+
+    void set(std::size_t i, kln::motor const& R) noexcept {
+        span().set(i, R);
+    }
+
+    motor_array_view view() const noexcept {
+        return {scalar.data(), e23.data(), e31.data(), e12.data(),
+                e01.data(), e02.data(), e03.data(), e0123.data(), size()};
+    }
+
+    motor_array_span span() noexcept {
+        return {scalar.data(), e23.data(), e31.data(), e12.data(),
+                e01.data(), e02.data(), e03.data(), e0123.data(), size()};
+    }
+
+    operator motor_array_view() const noexcept {
+        return view();
+    }
+};
+
+
+struct outer_exp_map {
+    /*
+    outer_exp(u + w) = (1 + u + w + (u.w)e0123)/sqrt(1 + w.w)
+    */
+    static constexpr int num_inputs = 6;
+    static constexpr int num_outputs = 8;
+
+    template <typename V>
+    static void apply(const V phi[6], V motor[8]){
+        const V one = V::broadcast(1.0f);
+        const V* u = phi;
+        const V* w = phi + 3;
+        V s = one/sqrt(one + w[0]*w[0] + w[1]*w[1] + w[2]*w[2]);
+        motor[0] = s;
+        motor[1] = s*w[0];
+        motor[2] = s*w[1];
+        motor[3] = s*w[2];
+        motor[4] = s*u[0];
+        motor[5] = s*u[1];
+        motor[6] = s*u[2];
+        motor[7] = s*(u[0]*w[0] + u[1]*w[1] + u[2]*w[2]);
+    }
+};
+
+
+struct outer_log_map {
+    /*
+    outer_log(a + b + e + h e0123) = (e + b)/a
+    */
+    static constexpr int num_inputs = 8;
+    static constexpr int num_outputs = 6;
+
+    template <typename V>
+    static void apply(const V motor[8], V phi[6]){
+        V inv = V::broadcast(1.0f)/motor[0];
+        phi[0] = motor[4]*inv;
+        phi[1] = motor[5]*inv;
+        phi[2] = motor[6]*inv;
+        phi[3] = motor[1]*inv;
+        phi[4] = motor[2]*inv;
+        phi[5] = motor[3]*inv;
+    }
+};
+
+
+struct cayley_map {
+    /*
+    With d = 1 + w.w and q = u.w the simplified map expands to
+    ((2 - d) + 2(u + w) - 4q w/d + 4q/d e0123)/d
+    */
+    static constexpr int num_inputs = 6;
+    static constexpr int num_outputs = 8;
+
+    template <typename V>
+    static void apply(const V phi[6], V motor[8]){
+        const V one = V::broadcast(1.0f);
+        const V two = V::broadcast(2.0f);
+        const V* u = phi;
+        const V* w = phi + 3;
+        V inv = one/(one + w[0]*w[0] + w[1]*w[1] + w[2]*w[2]);
+        V two_inv = two*inv;
+        V q4 = two_inv*two_inv*(u[0]*w[0] + u[1]*w[1] + u[2]*w[2]);
+        motor[0] = two_inv - one;
+        motor[1] = two_inv*w[0];
+        motor[2] = two_inv*w[1];
+        motor[3] = two_inv*w[2];
+        motor[4] = two_inv*u[0] - q4*w[0];
+        motor[5] = two_inv*u[1] - q4*w[1];
+        motor[6] = two_inv*u[2] - q4*w[2];
+        motor[7] = q4;
+    }
+};
+
+
+struct cayley_inverse_map {
+    /*
+    -(1 - R)(1 + R)^-1 with the inverse of 1 + R taken explicitly. With
+    s = (1 + a)^2 + b.b and t = 2((1 + a)h - b.e) it reduces to
+    w = 2b/s and u = 2e/s + 2t b/s^2, matching cayley(kln::motor)
+    */
+    static constexpr int num_inputs = 8;
+    static constexpr int num_outputs = 6;
+
+    template <typename V>
+    static void apply(const V motor[8], V phi[6]){
+        const V one = V::broadcast(1.0f);
+        const V two = V::broadcast(2.0f);
+        const V* b = motor + 1;
+        const V* e = motor + 4;
+        V a1 = one + motor[0];
+        V inv = one/(a1*a1 + b[0]*b[0] + b[1]*b[1] + b[2]*b[2]);
+        V two_inv = two*inv;
+        V t = two_inv*inv*(a1*motor[7] - b[0]*e[0] - b[1]*e[1] - b[2]*e[2]);
+        phi[0] = two_inv*e[0] + two*t*b[0];
+        phi[1] = two_inv*e[1] + two*t*b[1];
+        phi[2] = two_inv*e[2] + two*t*b[2];
+        phi[3] = two_inv*b[0];
+        phi[4] = two_inv*b[1];
+        phi[5] = two_inv*b[2];
+    }
+};
+
+
+struct motor_inverse_map {
+    /*
+    ~X(X~X)^-1 with X~X = s + t e0123, s = a^2 + b.b and t = 2(ah - b.e),
+    which reduces to (a - b - e - (t/s)b + (h - (t/s)a)e0123)/s
+    */
+    static constexpr int num_inputs = 8;
+    static constexpr int num_outputs = 8;
+
+    template <typename V>
+    static void apply(const V motor[8], V inverse[8]){
+        const V one = V::broadcast(1.0f);
+        const V two = V::broadcast(2.0f);
+        const V a = motor[0];
+        const V* b = motor + 1;
+        const V* e = motor + 4;
+        const V h = motor[7];
+        V inv = one/(a*a + b[0]*b[0] + b[1]*b[1] + b[2]*b[2]);
+        V r = two*inv*(a*h - b[0]*e[0] - b[1]*e[1] - b[2]*e[2]);
+        V neg_inv = -inv;
+        inverse[0] = a*inv;
+        inverse[1] = neg_inv*b[0];
+        inverse[2] = neg_inv*b[1];
+        inverse[3] = neg_inv*b[2];
+        inverse[4] = neg_inv*(e[0] + r*b[0]);
+        inverse[5] = neg_inv*(e[1] + r*b[1]);
+        inverse[6] = neg_inv*(e[2] + r*b[2]);
+        inverse[7] = inv*(h - r*a);
+    }
+};
+
+
+template <typename V, typename Map, typename S>
+std::size_t apply_map_batches(const S* const input[], S* const output[],
+                              std::size_t begin, std::size_t n){
+    /*
+    Applies the map to whole batches of V::width elements from begin,
+    returning the index of the first element left over
+    */
+    std::size_t i = begin;
+    for (; i + V::width <= n; i += V::width){
+        V x[Map::num_inputs];
+        V y[Map::num_outputs];
+        for (int k=0; k<Map::num_inputs; k++){
+            x[k] = V::load(input[k] + i);
+        }
+        Map::apply(x, y);
+        for (int k=0; k<Map::num_outputs; k++){
+            y[k].store(output[k] + i);
+        }
+    }
+    return i;
+}
+
+
+#if defined(SIMD_BATCH_RUNTIME_AVX2)
+template <typename Map>
+SIMD_BATCH_AVX2_DRIVER std::size_t apply_map_batches_avx2(const float* const input[], float* const output[],
+                                                          std::size_t n){
+    return apply_map_batches<avx2_float_batch, Map>(input, output, 0, n);
+}
+#endif
+
+
+template <typename Map, typename S>
+void apply_map(const S* const input[], S* const output[], std::size_t n){
+    /*
+    Applies the map element wise over n elements, on the widest batch the
+    cpu supports for S and one at a time over the tail
+    */
+    std::size_t i = 0;
+#if defined(SIMD_BATCH_RUNTIME_AVX2)
+    if constexpr (std::is_same_v<S, float>){
+        if (cpu_supports_avx2()){
+            i = apply_map_batches_avx2<Map>(input, output, n);
+        }
+    }
+#endif
+    i = apply_map_batches<typename simd_batch<S>::type, Map>(input, output, i, n);
+    apply_map_batches<scalar_batch<S>, Map>(input, output, i, n);
+}
+
+
+template <typename Map, typename T>
+void apply_map_scalar(const T input[], T output[]){
+    /*
+    Applies the map to a single element given by its coefficients in any
+    scalar type, double or ceres::Jet among them
+    */
+    scalar_batch<T> x[Map::num_inputs];
+    scalar_batch<T> y[Map::num_outputs];
+    for (int k=0; k<Map::num_inputs; k++){
+        x[k] = {input[k]};
+    }
+    Map::apply(x, y);
+    for (int k=0; k<Map::num_outputs; k++){
+        output[k] = y[k].v;
+    }
+}
+
+
+void outer_exp(line_array_view phi, motor_array_span R){
+    /*
+    Outer exponential of every bivector in phi, R must hold at least as many motors
+    */
+    const float* input[6] = {phi.e01, phi.e02, phi.e03, phi.e23, phi.e31, phi.e12};
+    float* output[8] = {R.scalar, R.e23, R.e31, R.e12, R.e01, R.e02, R.e03, R.e0123};
+    apply_map<outer_exp_map>(input, output, phi.size());
+}
+
+
+void outer_log(motor_array_view R, line_array_span phi){
+    /*
+    Bivector of every motor in R in the outer exponential chart, phi must
+    hold at least as many bivectors
+    */
+    const float* input[8] = {R.scalar, R.e23, R.e31, R.e12, R.e01, R.e02, R.e03, R.e0123};
+    float* output[6] = {phi.e01, phi.e02, phi.e03, phi.e23, phi.e31, phi.e12};
+    apply_map<outer_log_map>(input, output, R.size());
+}
+
+
+void cayley(line_array_view phi, motor_array_span R){
+    /*
+    Simplified cayley map of every bivector in phi, R must hold at least as many motors
+    */
+    const float* input[6] = {phi.e01, phi.e02, phi.e03, phi.e23, phi.e31, phi.e12};
+    float* output[8] = {R.scalar, R.e23, R.e31, R.e12, R.e01, R.e02, R.e03, R.e0123};
+    apply_map<cayley_map>(input, output, phi.size());
+}
+
+
+void cayley(motor_array_view R, line_array_span phi){
+    /*
+    Inverse cayley map of every motor in R, phi must hold at least as many bivectors
+    */
+    const float* input[8] = {R.scalar, R.e23, R.e31, R.e12, R.e01, R.e02, R.e03, R.e0123};
+    float* output[6] = {phi.e01, phi.e02, phi.e03, phi.e23, phi.e31, phi.e12};
+    apply_map<cayley_inverse_map>(input, output, R.size());
+}
+
+
+void explicit_motor_inverse(motor_array_view X, motor_array_span inverse){
+    /*
+    Inverse of every motor in X, inverse must hold at least as many motors
+    and may alias X
+    */
+    const float* input[8] = {X.scalar, X.e23, X.e31, X.e12, X.e01, X.e02, X.e03, X.e0123};
+    float* output[8] = {inverse.scalar, inverse.e23, inverse.e31, inverse.e12,
+                        inverse.e01, inverse.e02, inverse.e03, inverse.e0123};
+    apply_map<motor_inverse_map>(input, output, X.size());
+}
@@ -0,0 +1,51 @@
+#include <random>
+#include <benchmark/benchmark.h>
+#include <klein/klein.hpp>
+#include "articulated_body.h"
+
+
+/*
+Steps chains of bodies hanging off a floating base. The time per body should
+stay flat as the bodies are added, and the chains are independent subtrees so
+they spread over the threads in state.range(2)
+*/
+
+
+void make_chains(articulated_body& system, std::size_t num_chains, std::size_t chain_length){
+    std::default_random_engine generator(11);
+    std::normal_distribution<float> distribution(0.0f, 0.2f);
+    system.set_base(kln::motor{1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f}, body_inertia());
+    body_inertia link;
+    link.centre_of_mass = Eigen::Vector3d(0.0, 0.0, -0.5);
+    for (std::size_t c=0; c < num_chains; c++){
+        int parent = -1;
+        for (std::size_t i=0; i < chain_length; i++){
+            // Each link hangs about a unit below its parent
+            kln::motor offset{1.0f, 0.0f, 0.0f, 0.0f, distribution(generator), distribution(generator), 0.5f, 0.0f};
+            kln::line axis{0.0f, 0.0f, 0.0f, 1.0f, distribution(generator), 0.0f};
+            parent = system.add_body(parent, joint_type::revolute, offset, axis, link);
+            system.velocities()[parent] = distribution(generator);
+        }
+    }
+}
+
+
+void BM_articulated_step(benchmark::State& state){
+    articulated_body_options options;
+    options.floating_base = true;
+    options.num_threads = state.range(2);
+    articulated_body system(options);
+    make_chains(system, state.range(0), state.range(1));
+    for (auto _ : state){
+        system.step(1e-3);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations()*system.size());
+}
+
+
+BENCHMARK(BM_articulated_step)
+    ->ArgsProduct({{4, 16}, {8, 64, 512}, {1, 4}})
+    ->ArgNames({"chains", "length", "threads"})->UseRealTime();
+
+BENCHMARK_MAIN();
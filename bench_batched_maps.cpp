@@ -0,0 +1,167 @@
+#include <random>
+#include <benchmark/benchmark.h>
+#include <klein/klein.hpp>
+#include "batched_maps.h"
+#include "cayley.h"
+#include "outer_exp.h"
+
+
+/*
+Compares the batched closed form maps over structure-of-arrays bivectors and
+motors against mapping one klein bivector or motor at a time
+*/
+
+
+line_array make_bivectors(std::size_t n){
+    std::default_random_engine generator(5);
+    std::normal_distribution<float> distribution(0.0f, 0.5f);
+    line_array lines;
+    lines.reserve(n);
+    for (std::size_t i=0; i < n; i++){
+        lines.push_back(kln::line{distribution(generator), distribution(generator), distribution(generator),
+                                  distribution(generator), distribution(generator), distribution(generator)});
+    }
+    return lines;
+}
+
+
+motor_array make_motors(std::size_t n){
+    line_array lines = make_bivectors(n);
+    motor_array motors(n);
+    outer_exp(lines, motors.span());
+    return motors;
+}
+
+
+void BM_outer_exp_single(benchmark::State& state){
+    line_array lines = make_bivectors(state.range(0));
+    motor_array motors(lines.size());
+    for (auto _ : state){
+        for (std::size_t i=0; i < lines.size(); i++){
+            motors.set(i, outer_exp(lines[i]));
+        }
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations()*state.range(0));
+}
+
+
+void BM_outer_exp_batched(benchmark::State& state){
+    line_array lines = make_bivectors(state.range(0));
+    motor_array motors(lines.size());
+    for (auto _ : state){
+        outer_exp(lines, motors.span());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations()*state.range(0));
+}
+
+
+void BM_outer_log_single(benchmark::State& state){
+    motor_array motors = make_motors(state.range(0));
+    line_array lines(motors.size());
+    for (auto _ : state){
+        for (std::size_t i=0; i < motors.size(); i++){
+            lines.set(i, outer_log(motors[i]));
+        }
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations()*state.range(0));
+}
+
+
+void BM_outer_log_batched(benchmark::State& state){
+    motor_array motors = make_motors(state.range(0));
+    line_array lines(motors.size());
+    for (auto _ : state){
+        outer_log(motors, lines.span());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations()*state.range(0));
+}
+
+
+void BM_cayley_single(benchmark::State& state){
+    line_array lines = make_bivectors(state.range(0));
+    motor_array motors(lines.size());
+    for (auto _ : state){
+        for (std::size_t i=0; i < lines.size(); i++){
+            motors.set(i, cayley(lines[i]));
+        }
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations()*state.range(0));
+}
+
+
+void BM_cayley_batched(benchmark::State& state){
+    line_array lines = make_bivectors(state.range(0));
+    motor_array motors(lines.size());
+    for (auto _ : state){
+        cayley(lines.view(), motors.span());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations()*state.range(0));
+}
+
+
+void BM_cayley_inverse_single(benchmark::State& state){
+    motor_array motors = make_motors(state.range(0));
+    line_array lines(motors.size());
+    for (auto _ : state){
+        for (std::size_t i=0; i < motors.size(); i++){
+            lines.set(i, cayley(motors[i]));
+        }
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations()*state.range(0));
+}
+
+
+void BM_cayley_inverse_batched(benchmark::State& state){
+    motor_array motors = make_motors(state.range(0));
+    line_array lines(motors.size());
+    for (auto _ : state){
+        cayley(motors.view(), lines.span());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations()*state.range(0));
+}
+
+
+void BM_motor_inverse_single(benchmark::State& state){
+    motor_array motors = make_motors(state.range(0));
+    motor_array inverses(motors.size());
+    for (auto _ : state){
+        for (std::size_t i=0; i < motors.size(); i++){
+            inverses.set(i, explicit_motor_inverse(motors[i]));
+        }
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations()*state.range(0));
+}
+
+
+void BM_motor_inverse_batched(benchmark::State& state){
+    motor_array motors = make_motors(state.range(0));
+    motor_array inverses(motors.size());
+    for (auto _ : state){
+        explicit_motor_inverse(motors, inverses.span());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations()*state.range(0));
+}
+
+
+BENCHMARK(BM_outer_exp_single)->Arg(1 << 16)->ArgName("motors");
+BENCHMARK(BM_outer_exp_batched)->Arg(1 << 16)->ArgName("motors");
+BENCHMARK(BM_outer_log_single)->Arg(1 << 16)->ArgName("motors");
+BENCHMARK(BM_outer_log_batched)->Arg(1 << 16)->ArgName("motors");
+BENCHMARK(BM_cayley_single)->Arg(1 << 16)->ArgName("motors");
+BENCHMARK(BM_cayley_batched)->Arg(1 << 16)->ArgName("motors");
+BENCHMARK(BM_cayley_inverse_single)->Arg(1 << 16)->ArgName("motors");
+BENCHMARK(BM_cayley_inverse_batched)->Arg(1 << 16)->ArgName("motors");
+BENCHMARK(BM_motor_inverse_single)->Arg(1 << 16)->ArgName("motors");
+BENCHMARK(BM_motor_inverse_batched)->Arg(1 << 16)->ArgName("motors");
+
+BENCHMARK_MAIN();
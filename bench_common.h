@@ -0,0 +1,28 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <klein/klein.hpp>
+
+
+/*
+Helpers shared by the benchmarks that compare integrated or interpolated
+motors against a kln::exp reference
+*/
+
+
+double motor_distance(kln::motor const& a, kln::motor const& b){
+    /*
+    Largest coefficient difference between two motors, taken up to sign as
+    motors are only defined up to sign
+    */
+    const float x[8] = {a.scalar(), a.e23(), a.e31(), a.e12(), a.e01(), a.e02(), a.e03(), a.e0123()};
+    const float y[8] = {b.scalar(), b.e23(), b.e31(), b.e12(), b.e01(), b.e02(), b.e03(), b.e0123()};
+    double plus = 0.0;
+    double minus = 0.0;
+    for (int i=0; i<8; i++){
+        plus = std::max(plus, std::abs(double(x[i]) - y[i]));
+        minus = std::max(minus, std::abs(double(x[i]) + y[i]));
+    }
+    return std::min(plus, minus);
+}
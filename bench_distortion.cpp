@@ -0,0 +1,142 @@
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include "distortion.h"
+
+
+/*
+Compares the Drap-Lefevre closed form inverse of radial distortion against
+fixed point iteration, reporting throughput along with the largest error
+of the recovered points as the counter max_error
+*/
+
+
+brown_conrady bench_coefficients(){
+    brown_conrady coefficients;
+    coefficients.k1 = -0.28;
+    coefficients.k2 = 0.07;
+    coefficients.k3 = -0.005;
+    coefficients.p1 = 1e-3;
+    coefficients.p2 = -5e-4;
+    return coefficients;
+}
+
+
+template <typename S>
+void make_distorted_points(std::size_t npoints, const brown_conrady& coefficients, bool tangential,
+                        std::vector<S>& x, std::vector<S>& y, std::vector<S>& x_dist, std::vector<S>& y_dist){
+    std::default_random_engine generator(11);
+    std::uniform_real_distribution<double> coordinate_distribution(-0.6, 0.6);
+    x.resize(npoints);
+    y.resize(npoints);
+    x_dist.resize(npoints);
+    y_dist.resize(npoints);
+    for (std::size_t i=0; i < npoints; i++){
+        x[i] = static_cast<S>(coordinate_distribution(generator));
+        y[i] = static_cast<S>(coordinate_distribution(generator));
+    }
+    if (tangential){
+        apply_distortion(x.data(), y.data(), x_dist.data(), y_dist.data(), npoints, coefficients);
+    }
+    else{
+        apply_radial_distortion(x.data(), y.data(), x_dist.data(), y_dist.data(), npoints, coefficients);
+    }
+}
+
+
+template <typename S>
+double max_error(const std::vector<S>& x, const std::vector<S>& y,
+                const std::vector<S>& x_est, const std::vector<S>& y_est){
+    double error = 0.0;
+    for (std::size_t i=0; i < x.size(); i++){
+        error = std::max(error, std::hypot(double(x[i]) - x_est[i], double(y[i]) - y_est[i]));
+    }
+    return error;
+}
+
+
+template <typename S>
+void BM_radial_drap_lefevre(benchmark::State& state){
+    const brown_conrady coefficients = bench_coefficients();
+    std::vector<S> x, y, x_dist, y_dist;
+    make_distorted_points(state.range(0), coefficients, false, x, y, x_dist, y_dist);
+    std::vector<S> x_est(x.size()), y_est(y.size());
+    for (auto _ : state){
+        remove_radial_distortion(x_dist.data(), y_dist.data(), x_est.data(), y_est.data(), x.size(), coefficients);
+        benchmark::ClobberMemory();
+    }
+    state.counters["max_error"] = max_error(x, y, x_est, y_est);
+    state.SetItemsProcessed(state.iterations()*state.range(0));
+}
+
+
+template <typename S>
+void BM_radial_iterative(benchmark::State& state){
+    const brown_conrady coefficients = bench_coefficients();
+    std::vector<S> x, y, x_dist, y_dist;
+    make_distorted_points(state.range(0), coefficients, false, x, y, x_dist, y_dist);
+    std::vector<S> x_est(x.size()), y_est(y.size());
+    const unsigned int iterations = static_cast<unsigned int>(state.range(1));
+    for (auto _ : state){
+        remove_radial_distortion_iterative(x_dist.data(), y_dist.data(), x_est.data(), y_est.data(),
+                                        x.size(), coefficients, iterations);
+        benchmark::ClobberMemory();
+    }
+    state.counters["max_error"] = max_error(x, y, x_est, y_est);
+    state.SetItemsProcessed(state.iterations()*state.range(0));
+}
+
+
+template <typename S>
+void BM_brown_conrady_inverse(benchmark::State& state){
+    const brown_conrady coefficients = bench_coefficients();
+    std::vector<S> x, y, x_dist, y_dist;
+    make_distorted_points(state.range(0), coefficients, true, x, y, x_dist, y_dist);
+    std::vector<S> x_est(x.size()), y_est(y.size());
+    const unsigned int iterations = static_cast<unsigned int>(state.range(1));
+    for (auto _ : state){
+        remove_distortion(x_dist.data(), y_dist.data(), x_est.data(), y_est.data(),
+                        x.size(), coefficients, iterations);
+        benchmark::ClobberMemory();
+    }
+    state.counters["max_error"] = max_error(x, y, x_est, y_est);
+    state.SetItemsProcessed(state.iterations()*state.range(0));
+}
+
+
+template <typename S>
+void BM_brown_conrady_forward(benchmark::State& state){
+    const brown_conrady coefficients = bench_coefficients();
+    std::vector<S> x, y, x_dist, y_dist;
+    make_distorted_points(state.range(0), coefficients, true, x, y, x_dist, y_dist);
+    for (auto _ : state){
+        apply_distortion(x.data(), y.data(), x_dist.data(), y_dist.data(), x.size(), coefficients);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations()*state.range(0));
+}
+
+
+BENCHMARK_TEMPLATE(BM_radial_drap_lefevre, float)->Arg(1 << 16)->ArgName("points");
+BENCHMARK_TEMPLATE(BM_radial_drap_lefevre, double)->Arg(1 << 16)->ArgName("points");
+
+BENCHMARK_TEMPLATE(BM_radial_iterative, float)
+    ->ArgsProduct({{1 << 16}, {1, 2, 3, 5, 10}})
+    ->ArgNames({"points", "iterations"});
+BENCHMARK_TEMPLATE(BM_radial_iterative, double)
+    ->ArgsProduct({{1 << 16}, {1, 2, 3, 5, 10}})
+    ->ArgNames({"points", "iterations"});
+
+BENCHMARK_TEMPLATE(BM_brown_conrady_inverse, float)
+    ->ArgsProduct({{1 << 16}, {0, 1, 2, 3, 5}})
+    ->ArgNames({"points", "iterations"});
+BENCHMARK_TEMPLATE(BM_brown_conrady_inverse, double)
+    ->ArgsProduct({{1 << 16}, {0, 1, 2, 3, 5}})
+    ->ArgNames({"points", "iterations"});
+
+BENCHMARK_TEMPLATE(BM_brown_conrady_forward, float)->Arg(1 << 16)->ArgName("points");
+BENCHMARK_TEMPLATE(BM_brown_conrady_forward, double)->Arg(1 << 16)->ArgName("points");
+
+BENCHMARK_MAIN();
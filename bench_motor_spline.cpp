@@ -0,0 +1,202 @@
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include <klein/klein.hpp>
+#include "bench_common.h"
+#include "motor_spline.h"
+#include "outer_exp.h"
+
+
+/*
+Compares the chart splines against interpolating the same keyframes with
+kln::exp, slerp for the linear spline and the cumulative B-spline of
+kln::exp of kln::log for the cubic one, with the logarithms precomputed per
+segment in both. Each benchmark samples a trajectory of num_keyframes motors
+at state.range(0) sorted times. The counter max_deviation is the largest
+coefficient distance of a sample from its kln::exp counterpart, taken in the
+frame of the latter, and acceleration the root mean square second difference
+of the sampled coefficients, a measure of how smooth the trajectory is.
+*/
+
+
+constexpr std::size_t num_keyframes = 1024;
+constexpr float keyframe_interval = 0.1f;
+
+
+motor_array make_keyframes(){
+    std::default_random_engine generator(11);
+    std::normal_distribution<float> distribution(0.0f, 0.2f);
+    motor_array keyframes;
+    kln::motor R{1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+    for (std::size_t k=0; k < num_keyframes; k++){
+        keyframes.push_back(R);
+        R = R*outer_exp(kln::line{distribution(generator), distribution(generator), distribution(generator),
+                                  distribution(generator), distribution(generator), distribution(generator)});
+        R.normalize();
+    }
+    return keyframes;
+}
+
+
+std::vector<float> keyframe_times(){
+    std::vector<float> times(num_keyframes);
+    for (std::size_t k=0; k < num_keyframes; k++){
+        times[k] = k*keyframe_interval;
+    }
+    return times;
+}
+
+
+std::vector<float> sample_times(std::size_t n, float begin, float end){
+    std::vector<float> times(n);
+    for (std::size_t i=0; i < n; i++){
+        times[i] = begin + (end - begin)*i/(n - 1);
+    }
+    return times;
+}
+
+
+std::vector<kln::line> klein_logs(const motor_array& keyframes){
+    // Logarithm of the motion over each segment, in the same half of the
+    // double cover as the chart splines use
+    std::vector<kln::line> logs(keyframes.size() - 1);
+    for (std::size_t k=0; k + 1 < keyframes.size(); k++){
+        kln::motor relative = ~keyframes[k]*keyframes[k + 1];
+        if (relative.scalar() < 0.0f){
+            relative = -1.0f*relative;
+        }
+        logs[k] = kln::log(relative);
+    }
+    return logs;
+}
+
+
+void klein_slerp(const motor_array& keyframes, const std::vector<kln::line>& logs,
+                 const std::vector<float>& times, motor_array& R){
+    for (std::size_t i=0; i < times.size(); i++){
+        float x = std::clamp(times[i]/keyframe_interval, 0.0f, float(num_keyframes - 1));
+        std::size_t k = std::min(static_cast<std::size_t>(x), num_keyframes - 2);
+        R.set(i, keyframes[k]*kln::exp((x - k)*logs[k]));
+    }
+}
+
+
+void klein_cubic(const motor_array& keyframes, const std::vector<kln::line>& logs,
+                 const std::vector<float>& times, motor_array& R){
+    for (std::size_t i=0; i < times.size(); i++){
+        float x = std::clamp(times[i]/keyframe_interval, 1.0f, float(num_keyframes - 2));
+        std::size_t k = std::min(static_cast<std::size_t>(x), num_keyframes - 3);
+        float u = x - k;
+        float b1 = (5.0f + 3.0f*u - 3.0f*u*u + u*u*u)/6.0f;
+        float b2 = (1.0f + 3.0f*u + 3.0f*u*u - 2.0f*u*u*u)/6.0f;
+        float b3 = u*u*u/6.0f;
+        R.set(i, keyframes[k - 1]*kln::exp(b1*logs[k - 1])*kln::exp(b2*logs[k])*kln::exp(b3*logs[k + 1]));
+    }
+}
+
+
+double max_deviation(const motor_array& R, const motor_array& reference){
+    // Measured in the frame of the reference sample, so that it does not
+    // grow with the distance of the trajectory from the origin
+    const kln::motor identity{1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+    double deviation = 0.0;
+    for (std::size_t i=0; i < R.size(); i++){
+        deviation = std::max(deviation, motor_distance(~reference[i]*R[i], identity));
+    }
+    return deviation;
+}
+
+
+double acceleration(const motor_array& R, float dt){
+    const aligned_float_vector* coefficients[8] = {&R.scalar, &R.e23, &R.e31, &R.e12,
+                                                  &R.e01, &R.e02, &R.e03, &R.e0123};
+    double sum = 0.0;
+    for (std::size_t i=1; i + 1 < R.size(); i++){
+        double norm2 = 0.0;
+        for (const aligned_float_vector* c : coefficients){
+            double a = ((*c)[i + 1] - 2.0*(*c)[i] + (*c)[i - 1])/(double(dt)*dt);
+            norm2 += a*a;
+        }
+        sum += norm2;
+    }
+    return std::sqrt(sum/(R.size() - 2));
+}
+
+
+void BM_klein_slerp(benchmark::State& state){
+    const motor_array keyframes = make_keyframes();
+    const std::vector<kln::line> logs = klein_logs(keyframes);
+    const std::vector<float> times = sample_times(state.range(0), 0.0f, (num_keyframes - 1)*keyframe_interval);
+    motor_array R(times.size());
+    for (auto _ : state){
+        klein_slerp(keyframes, logs, times, R);
+        benchmark::ClobberMemory();
+    }
+    state.counters["acceleration"] = acceleration(R, times[1] - times[0]);
+    state.SetItemsProcessed(state.iterations()*state.range(0));
+}
+
+
+template <motor_chart Chart>
+void BM_linear_spline(benchmark::State& state){
+    const motor_array keyframes = make_keyframes();
+    const std::vector<float> times = sample_times(state.range(0), 0.0f, (num_keyframes - 1)*keyframe_interval);
+    linear_motor_spline spline(keyframe_times(), keyframes, Chart);
+    motor_array R(times.size());
+    for (auto _ : state){
+        spline.evaluate(times.data(), times.size(), R.span());
+        benchmark::ClobberMemory();
+    }
+    motor_array reference(times.size());
+    klein_slerp(keyframes, klein_logs(keyframes), times, reference);
+    state.counters["max_deviation"] = max_deviation(R, reference);
+    state.counters["acceleration"] = acceleration(R, times[1] - times[0]);
+    state.SetItemsProcessed(state.iterations()*state.range(0));
+}
+
+
+void BM_klein_cubic(benchmark::State& state){
+    const motor_array keyframes = make_keyframes();
+    const std::vector<kln::line> logs = klein_logs(keyframes);
+    const std::vector<float> times = sample_times(state.range(0), keyframe_interval,
+                                                  (num_keyframes - 2)*keyframe_interval);
+    motor_array R(times.size());
+    for (auto _ : state){
+        klein_cubic(keyframes, logs, times, R);
+        benchmark::ClobberMemory();
+    }
+    state.counters["acceleration"] = acceleration(R, times[1] - times[0]);
+    state.SetItemsProcessed(state.iterations()*state.range(0));
+}
+
+
+template <motor_chart Chart>
+void BM_cubic_spline(benchmark::State& state){
+    const motor_array keyframes = make_keyframes();
+    const std::vector<float> times = sample_times(state.range(0), keyframe_interval,
+                                                  (num_keyframes - 2)*keyframe_interval);
+    cubic_motor_spline spline(0.0f, keyframe_interval, keyframes, Chart);
+    motor_array R(times.size());
+    for (auto _ : state){
+        spline.evaluate(times.data(), times.size(), R.span());
+        benchmark::ClobberMemory();
+    }
+    motor_array reference(times.size());
+    klein_cubic(keyframes, klein_logs(keyframes), times, reference);
+    state.counters["max_deviation"] = max_deviation(R, reference);
+    state.counters["acceleration"] = acceleration(R, times[1] - times[0]);
+    state.SetItemsProcessed(state.iterations()*state.range(0));
+}
+
+
+BENCHMARK(BM_klein_slerp)->RangeMultiplier(10)->Range(1000, 1000000)->ArgName("samples");
+BENCHMARK_TEMPLATE(BM_linear_spline, motor_chart::cayley)->RangeMultiplier(10)->Range(1000, 1000000)->ArgName("samples");
+BENCHMARK_TEMPLATE(BM_linear_spline, motor_chart::outer_exp)->RangeMultiplier(10)->Range(1000, 1000000)->ArgName("samples");
+
+BENCHMARK(BM_klein_cubic)->RangeMultiplier(10)->Range(1000, 1000000)->ArgName("samples");
+BENCHMARK_TEMPLATE(BM_cubic_spline, motor_chart::cayley)->RangeMultiplier(10)->Range(1000, 1000000)->ArgName("samples");
+BENCHMARK_TEMPLATE(BM_cubic_spline, motor_chart::outer_exp)->RangeMultiplier(10)->Range(1000, 1000000)->ArgName("samples");
+
+BENCHMARK_MAIN();
@@ -0,0 +1,392 @@
+#include <random>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include "klein/klein.hpp"
+#include "cayley.h"
+#include "outer_exp.h"
+#include "camera_model.h"
+#include "camera_ops.h"
+#include "point_cloud.h"
+#include "projection_kernels.h"
+#include "pose_refinement.h"
+#include "pose_tracker.h"
+
+
+/*
+Single object maps, mixed grade products, kinematic equations, projection,
+full pose solves through ceres and the fixed size solver, and warm started
+tracking of a frame.
+Each map benchmark cycles over a fixed pool of random inputs so the compiler
+can not hoist the work out of the loop; items processed counts one map per
+input. Run through the run_benchmarks target to collect JSON for regression
+tracking.
+*/
+
+
+constexpr std::size_t pool_size = 1024;
+
+
+std::vector<kln::line> make_lines(float scale){
+    std::default_random_engine generator(13);
+    std::normal_distribution<float> distribution(0.0f, scale);
+    std::vector<kln::line> lines(pool_size);
+    for (kln::line& l : lines){
+        l = kln::line{distribution(generator), distribution(generator), distribution(generator),
+                      distribution(generator), distribution(generator), distribution(generator)};
+    }
+    return lines;
+}
+
+
+std::vector<kln::branch> make_branches(float scale){
+    std::default_random_engine generator(17);
+    std::normal_distribution<float> distribution(0.0f, scale);
+    std::vector<kln::branch> branches(pool_size);
+    for (kln::branch& b : branches){
+        b = kln::branch{distribution(generator), distribution(generator), distribution(generator)};
+    }
+    return branches;
+}
+
+
+std::vector<kln::motor> make_motors(){
+    std::vector<kln::line> lines = make_lines(0.5f);
+    std::vector<kln::motor> motors(pool_size);
+    for (std::size_t i=0; i < pool_size; i++){
+        motors[i] = outer_exp(lines[i]);
+    }
+    return motors;
+}
+
+
+template <typename Input, typename F>
+void run_map(benchmark::State& state, const std::vector<Input>& inputs, F map){
+    for (auto _ : state){
+        for (const Input& input : inputs){
+            auto output = map(input);
+            benchmark::DoNotOptimize(output);
+        }
+    }
+    state.SetItemsProcessed(state.iterations()*inputs.size());
+}
+
+
+void BM_klein_exp(benchmark::State& state){
+    run_map(state, make_lines(0.5f), [](kln::line const& l){ return kln::exp(l); });
+}
+
+void BM_klein_log(benchmark::State& state){
+    run_map(state, make_motors(), [](kln::motor const& R){ return kln::log(R); });
+}
+
+void BM_outer_exp_line(benchmark::State& state){
+    run_map(state, make_lines(0.5f), [](kln::line const& l){ return outer_exp(l); });
+}
+
+void BM_outer_exp_branch(benchmark::State& state){
+    run_map(state, make_branches(0.5f), [](kln::branch const& b){ return outer_exp(b); });
+}
+
+void BM_outer_log_motor(benchmark::State& state){
+    run_map(state, make_motors(), [](kln::motor const& R){ return outer_log(R); });
+}
+
+void BM_cayley_line(benchmark::State& state){
+    run_map(state, make_lines(0.5f), [](kln::line const& l){ return cayley(l); });
+}
+
+void BM_cayley_branch(benchmark::State& state){
+    run_map(state, make_branches(0.5f), [](kln::branch const& b){ return cayley(b); });
+}
+
+void BM_cayley_explicit(benchmark::State& state){
+    run_map(state, make_lines(0.5f), [](kln::line const& l){ return cayley_explicit(l); });
+}
+
+void BM_cayley_motor(benchmark::State& state){
+    run_map(state, make_motors(), [](kln::motor const& R){ return cayley(R); });
+}
+
+void BM_explicit_motor_inverse(benchmark::State& state){
+    run_map(state, make_motors(), [](kln::motor const& R){ return explicit_motor_inverse(R); });
+}
+
+
+template <typename A, typename B, typename F>
+void run_product(benchmark::State& state, const std::vector<A>& a, const std::vector<B>& b, F product){
+    for (auto _ : state){
+        for (std::size_t i=0; i < a.size(); i++){
+            auto output = product(a[i], b[i]);
+            benchmark::DoNotOptimize(output);
+        }
+    }
+    state.SetItemsProcessed(state.iterations()*a.size());
+}
+
+
+void BM_line_times_line(benchmark::State& state){
+    run_map(state, make_lines(0.5f), [](kln::line const& l){ return l*l; });
+}
+
+void BM_line_times_motor(benchmark::State& state){
+    run_product(state, make_lines(1.0f), make_motors(),
+                [](kln::line const& l, kln::motor const& R){ return l*R; });
+}
+
+void BM_line_as_motor_times_motor(benchmark::State& state){
+    run_product(state, make_lines(1.0f), make_motors(),
+                [](kln::line const& l, kln::motor const& R){ return as_motor(l)*R; });
+}
+
+void BM_branch_times_rotor(benchmark::State& state){
+    std::vector<kln::rotor> rotors;
+    for (kln::branch const& b : make_branches(0.5f)){
+        rotors.push_back(outer_exp(b));
+    }
+    run_product(state, make_branches(1.0f), rotors,
+                [](kln::branch const& b, kln::rotor const& R){ return b*R; });
+}
+
+
+template <typename Input, typename F>
+void run_kinematic(benchmark::State& state, const std::vector<Input>& phi, const std::vector<Input>& omega, F kinematic){
+    for (auto _ : state){
+        for (std::size_t i=0; i < phi.size(); i++){
+            auto phi_dot = kinematic(phi[i], omega[i]);
+            benchmark::DoNotOptimize(phi_dot);
+        }
+    }
+    state.SetItemsProcessed(state.iterations()*phi.size());
+}
+
+
+void BM_cayley_kinematic_line(benchmark::State& state){
+    run_kinematic(state, make_lines(0.5f), make_lines(1.0f),
+                  [](kln::line const& p, kln::line const& o){ return cayley_kinematic(p, o); });
+}
+
+void BM_cayley_kinematic_branch(benchmark::State& state){
+    run_kinematic(state, make_branches(0.5f), make_branches(1.0f),
+                  [](kln::branch const& p, kln::branch const& o){ return cayley_kinematic(p, o); });
+}
+
+void BM_outer_exp_kinematic_line(benchmark::State& state){
+    run_kinematic(state, make_lines(0.5f), make_lines(1.0f),
+                  [](kln::line const& p, kln::line const& o){ return outer_exp_kinematic(p, o); });
+}
+
+void BM_outer_exp_kinematic_branch(benchmark::State& state){
+    run_kinematic(state, make_branches(0.5f), make_branches(1.0f),
+                  [](kln::branch const& p, kln::branch const& o){ return outer_exp_kinematic(p, o); });
+}
+
+
+void make_pose_problem(std::size_t npoints, point_cloud& points, point_cloud& camera_points, kln::motor& R){
+    std::default_random_engine generator(7);
+    std::normal_distribution<float> coordinate_distribution(0.0, 1.0);
+    points.clear();
+    for (std::size_t i=0; i < npoints; i++){
+        points.push_back(coordinate_distribution(generator),
+                        coordinate_distribution(generator),
+                        coordinate_distribution(generator) + 6.0f);
+    }
+    R = outer_exp(kln::line{0.1f, -0.2f, 0.05f, 0.05f, -0.1f, 0.2f});
+    project_to_camera(R, points, camera_points);
+}
+
+
+camera_model make_camera_model(){
+    camera_model model;
+    model.intrinsics.fx = 800.0;
+    model.intrinsics.fy = 800.0;
+    model.intrinsics.cx = 640.0;
+    model.intrinsics.cy = 360.0;
+    model.distortion.k1 = -0.2;
+    model.distortion.k2 = 0.05;
+    model.distortion.p1 = 1e-3;
+    return model;
+}
+
+
+void BM_project_points(benchmark::State& state){
+    point_cloud points, camera_points;
+    kln::motor R;
+    make_pose_problem(state.range(0), points, camera_points, R);
+    aligned_float_vector u(points.size()), v(points.size());
+    for (auto _ : state){
+        project_points(R, points, u.data(), v.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations()*state.range(0));
+}
+
+
+void BM_count_projection_inliers(benchmark::State& state){
+    point_cloud points, camera_points;
+    kln::motor R;
+    make_pose_problem(state.range(0), points, camera_points, R);
+    float matrix[12];
+    motor_to_mat3x4(~R, matrix);
+    for (auto _ : state){
+        benchmark::DoNotOptimize(count_projection_inliers(matrix, points, camera_points, 1e-4f));
+    }
+    state.SetItemsProcessed(state.iterations()*state.range(0));
+}
+
+
+void BM_project_to_pixels(benchmark::State& state){
+    point_cloud points, camera_points;
+    kln::motor R;
+    make_pose_problem(state.range(0), points, camera_points, R);
+    const camera_model model = make_camera_model();
+    aligned_float_vector u(points.size()), v(points.size());
+    for (auto _ : state){
+        project_to_pixels(R, model, points, u.data(), v.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations()*state.range(0));
+}
+
+
+void BM_reprojection_error(benchmark::State& state){
+    point_cloud points, camera_points;
+    kln::motor R;
+    make_pose_problem(state.range(0), points, camera_points, R);
+    for (auto _ : state){
+        benchmark::DoNotOptimize(reprojection_error(R, points, camera_points));
+    }
+    state.SetItemsProcessed(state.iterations()*state.range(0));
+}
+
+
+void BM_find_camera(benchmark::State& state, motor_chart chart, pose_parameterization parameterization){
+    point_cloud points, camera_points;
+    kln::motor R;
+    make_pose_problem(state.range(0), points, camera_points, R);
+    const kln::line initial_biv{0.12f, -0.15f, 0.0f, 0.07f, -0.12f, 0.25f};
+    pose_solver_options options;
+    options.chart = chart;
+    options.parameterization = parameterization;
+    pose_solver_workspace workspace;
+    pose_solver_result result;
+    for (auto _ : state){
+        result = workspace.solve(initial_biv, points, camera_points, options);
+        benchmark::DoNotOptimize(result);
+    }
+    state.counters["iterations"] = result.num_iterations;
+    state.counters["final_cost"] = result.final_cost;
+    state.SetItemsProcessed(state.iterations()*state.range(0));
+}
+
+
+template <typename Chart>
+void BM_find_camera_policy(benchmark::State& state){
+    // The same solve with the chart fixed at compile time, which also covers
+    // the exponential chart
+    point_cloud points, camera_points;
+    kln::motor R;
+    make_pose_problem(state.range(0), points, camera_points, R);
+    const kln::line initial_biv{0.12f, -0.15f, 0.0f, 0.07f, -0.12f, 0.25f};
+    pose_solver_result result;
+    for (auto _ : state){
+        result = find_camera<Chart>(initial_biv, points, camera_points);
+        benchmark::DoNotOptimize(result);
+    }
+    state.counters["iterations"] = result.num_iterations;
+    state.counters["final_cost"] = result.final_cost;
+    state.SetItemsProcessed(state.iterations()*state.range(0));
+}
+
+
+void BM_refine_pose(benchmark::State& state, motor_chart chart, pose_step_strategy strategy){
+    // The fixed size solver from the same start as BM_find_camera
+    point_cloud points, camera_points;
+    kln::motor R;
+    make_pose_problem(state.range(0), points, camera_points, R);
+    const kln::line initial_biv{0.12f, -0.15f, 0.0f, 0.07f, -0.12f, 0.25f};
+    pose_refinement_options options;
+    options.chart = chart;
+    options.strategy = strategy;
+    const kln::motor initial = chart_motor(chart, initial_biv);
+    pose_refinement_result result;
+    for (auto _ : state){
+        result = refine_pose(initial, points, camera_points, options);
+        benchmark::DoNotOptimize(result);
+    }
+    state.counters["iterations"] = result.num_iterations;
+    state.counters["final_cost"] = result.final_cost;
+    state.SetItemsProcessed(state.iterations()*state.range(0));
+}
+
+
+void BM_pose_tracker(benchmark::State& state){
+    // One frame of a camera moving at constant velocity, the tracker refines
+    // from its prediction with the problem kept from the previous frame
+    point_cloud points, camera_points;
+    kln::motor R;
+    make_pose_problem(state.range(0), points, camera_points, R);
+    const kln::line omega{0.2f, -0.1f, 0.3f, 0.3f, -0.2f, 0.4f};
+    const float dt = 1.0f/30.0f;
+    const kln::motor previous = R*kln::exp((-0.5f*dt)*omega);
+    pose_tracker tracker;
+    pose_solver_result result;
+    for (auto _ : state){
+        tracker.reset(previous, omega);
+        result = tracker.track(dt, points, camera_points);
+        benchmark::DoNotOptimize(result);
+    }
+    state.counters["iterations"] = result.num_iterations;
+    state.counters["final_cost"] = result.final_cost;
+    state.SetItemsProcessed(state.iterations()*state.range(0));
+}
+
+
+BENCHMARK(BM_klein_exp);
+BENCHMARK(BM_klein_log);
+BENCHMARK(BM_outer_exp_line);
+BENCHMARK(BM_outer_exp_branch);
+BENCHMARK(BM_outer_log_motor);
+BENCHMARK(BM_cayley_line);
+BENCHMARK(BM_cayley_branch);
+BENCHMARK(BM_cayley_explicit);
+BENCHMARK(BM_cayley_motor);
+BENCHMARK(BM_explicit_motor_inverse);
+
+BENCHMARK(BM_line_times_line);
+BENCHMARK(BM_line_times_motor);
+BENCHMARK(BM_line_as_motor_times_motor);
+BENCHMARK(BM_branch_times_rotor);
+
+BENCHMARK(BM_cayley_kinematic_line);
+BENCHMARK(BM_cayley_kinematic_branch);
+BENCHMARK(BM_outer_exp_kinematic_line);
+BENCHMARK(BM_outer_exp_kinematic_branch);
+
+BENCHMARK(BM_project_points)->RangeMultiplier(10)->Range(10, 100000)->ArgName("points");
+BENCHMARK(BM_count_projection_inliers)->RangeMultiplier(10)->Range(10, 100000)->ArgName("points");
+BENCHMARK(BM_project_to_pixels)->RangeMultiplier(10)->Range(10, 100000)->ArgName("points");
+BENCHMARK(BM_reprojection_error)->RangeMultiplier(10)->Range(10, 100000)->ArgName("points");
+
+BENCHMARK_CAPTURE(BM_find_camera, outer_exp_chart, motor_chart::outer_exp, pose_parameterization::chart)
+    ->RangeMultiplier(10)->Range(10, 10000)->ArgName("points")->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_find_camera, cayley_chart, motor_chart::cayley, pose_parameterization::chart)
+    ->RangeMultiplier(10)->Range(10, 10000)->ArgName("points")->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_find_camera, outer_exp_manifold, motor_chart::outer_exp, pose_parameterization::manifold)
+    ->RangeMultiplier(10)->Range(10, 10000)->ArgName("points")->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_find_camera, cayley_manifold, motor_chart::cayley, pose_parameterization::manifold)
+    ->RangeMultiplier(10)->Range(10, 10000)->ArgName("points")->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(BM_find_camera_policy, exp_chart<se3>)
+    ->RangeMultiplier(10)->Range(10, 10000)->ArgName("points")->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(BM_find_camera_policy, outer_exp_chart<se3>)
+    ->RangeMultiplier(10)->Range(10, 10000)->ArgName("points")->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(BM_find_camera_policy, cayley_chart<se3>)
+    ->RangeMultiplier(10)->Range(10, 10000)->ArgName("points")->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_refine_pose, outer_exp_lm, motor_chart::outer_exp, pose_step_strategy::levenberg_marquardt)
+    ->RangeMultiplier(10)->Range(10, 10000)->ArgName("points")->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_refine_pose, cayley_lm, motor_chart::cayley, pose_step_strategy::levenberg_marquardt)
+    ->RangeMultiplier(10)->Range(10, 10000)->ArgName("points")->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_refine_pose, outer_exp_gauss_newton, motor_chart::outer_exp, pose_step_strategy::gauss_newton)
+    ->RangeMultiplier(10)->Range(10, 10000)->ArgName("points")->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_pose_tracker)->RangeMultiplier(10)->Range(10, 10000)->ArgName("points")->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,71 @@
+#include <memory>
+#include <random>
+#include <benchmark/benchmark.h>
+#include "klein/klein.hpp"
+#include "point_cloud.h"
+#include "camera_ops.h"
+
+
+/*
+Compares one residual block per correspondence, fixed size chunks of
+correspondences and a single block spanning every correspondence, across
+point counts and solver thread counts
+*/
+
+
+void make_pose_problem(std::size_t npoints, point_cloud& points, point_cloud& camera_points, kln::line& initial_biv){
+    std::default_random_engine generator(7);
+    std::normal_distribution<float> coordinate_distribution(0.0, 1.0);
+    points.clear();
+    for (std::size_t i=0; i < npoints; i++){
+        points.push_back(coordinate_distribution(generator), 
+                        coordinate_distribution(generator), 
+                        coordinate_distribution(generator) + 6.0f);
+    }
+    kln::line biv_cam{0.1f, -0.2f, 0.05f, 0.05f, -0.1f, 0.2f};
+    kln::motor R = outer_exp(biv_cam);
+    project_to_camera(R, points, camera_points);
+    initial_biv = kln::line{0.12f, -0.15f, 0.0f, 0.07f, -0.12f, 0.25f};
+}
+
+
+void BM_pose_solve(benchmark::State& state, residual_layout layout){
+    point_cloud points;
+    point_cloud camera_points;
+    kln::line initial_biv;
+    make_pose_problem(state.range(0), points, camera_points, initial_biv);
+
+    Solver::Options options;
+    options.num_threads = static_cast<int>(state.range(1));
+    options.logging_type = ceres::SILENT;
+    options.max_num_iterations = 10;
+
+    for (auto _ : state){
+        double x[6] = {initial_biv.e01(), initial_biv.e02(), initial_biv.e03(), 
+                       initial_biv.e23(), initial_biv.e31(), initial_biv.e12()};
+        Problem problem;
+        add_reprojection_residuals(problem, x, points, camera_points, motor_chart::outer_exp, layout);
+        Solver::Summary summary;
+        Solve(options, &problem, &summary);
+        benchmark::DoNotOptimize(x);
+    }
+    state.SetItemsProcessed(state.iterations()*state.range(0));
+}
+
+
+BENCHMARK_CAPTURE(BM_pose_solve, per_correspondence, residual_layout::per_correspondence)
+    ->ArgsProduct({{10, 100, 1000, 10000}, {1, 2, 4, 8}})
+    ->ArgNames({"points", "threads"})
+    ->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_CAPTURE(BM_pose_solve, chunked, residual_layout::chunked)
+    ->ArgsProduct({{10, 100, 1000, 10000}, {1, 2, 4, 8}})
+    ->ArgNames({"points", "threads"})
+    ->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_CAPTURE(BM_pose_solve, single_block, residual_layout::single_block)
+    ->ArgsProduct({{10, 100, 1000, 10000}, {1, 2, 4, 8}})
+    ->ArgNames({"points", "threads"})
+    ->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,118 @@
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include <klein/klein.hpp>
+#include "bench_common.h"
+#include "rigid_body.h"
+
+
+/*
+Compares the chart integrators against stepping every body with kln::exp of
+its velocity. Each benchmark integrates a fixed time span in state.range(1)
+steps, so the time per body step can be traded against the largest distance
+of a final motor from the exact motion, reported as the counter max_error
+*/
+
+
+constexpr float bench_duration = 1.0f;
+
+
+void make_bodies(std::size_t n, std::vector<kln::motor>& motors, std::vector<kln::line>& velocities){
+    std::default_random_engine generator(3);
+    std::normal_distribution<float> distribution(0.0f, 1.0f);
+    motors.resize(n);
+    velocities.resize(n);
+    for (std::size_t i=0; i < n; i++){
+        kln::line phi{distribution(generator), distribution(generator), distribution(generator),
+                      0.3f*distribution(generator), 0.3f*distribution(generator), 0.3f*distribution(generator)};
+        motors[i] = kln::exp(phi);
+        velocities[i] = kln::line{distribution(generator), distribution(generator), distribution(generator),
+                                  distribution(generator), distribution(generator), distribution(generator)};
+    }
+}
+
+
+double max_error(const std::vector<kln::motor>& initial, const std::vector<kln::line>& velocities,
+                const std::vector<kln::motor>& final){
+    double error = 0.0;
+    for (std::size_t i=0; i < initial.size(); i++){
+        kln::motor exact = initial[i]*kln::exp((0.5f*bench_duration)*velocities[i]);
+        error = std::max(error, motor_distance(final[i], exact));
+    }
+    return error;
+}
+
+
+void BM_klein_exp(benchmark::State& state){
+    std::vector<kln::motor> initial;
+    std::vector<kln::line> velocities;
+    make_bodies(state.range(0), initial, velocities);
+    const std::size_t num_steps = state.range(1);
+    const float dt = bench_duration/num_steps;
+    std::vector<kln::motor> motors;
+    for (auto _ : state){
+        motors = initial;
+        for (std::size_t step=0; step < num_steps; step++){
+            for (std::size_t i=0; i < motors.size(); i++){
+                motors[i] = motors[i]*kln::exp((0.5f*dt)*velocities[i]);
+            }
+        }
+        benchmark::ClobberMemory();
+    }
+    state.counters["max_error"] = max_error(initial, velocities, motors);
+    state.SetItemsProcessed(state.iterations()*state.range(0)*state.range(1));
+}
+
+
+template <integrator_scheme Scheme, motor_chart Chart>
+void BM_chart_integrator(benchmark::State& state){
+    std::vector<kln::motor> initial;
+    std::vector<kln::line> velocities;
+    make_bodies(state.range(0), initial, velocities);
+    const std::size_t num_steps = state.range(1);
+    integrator_options options;
+    options.scheme = Scheme;
+    options.chart = Chart;
+    rigid_body_integrator integrator(options, state.range(2));
+    rigid_body_state bodies;
+    for (auto _ : state){
+        state.PauseTiming();
+        bodies.clear();
+        for (std::size_t i=0; i < initial.size(); i++){
+            bodies.push_back(initial[i], velocities[i]);
+        }
+        state.ResumeTiming();
+        integrator.step(bodies, bench_duration/num_steps, num_steps);
+        benchmark::ClobberMemory();
+    }
+    motor_array final_motors(bodies.size());
+    integrator.motors(bodies, final_motors.span());
+    std::vector<kln::motor> motors(bodies.size());
+    for (std::size_t i=0; i < motors.size(); i++){
+        motors[i] = final_motors[i];
+    }
+    state.counters["max_error"] = max_error(initial, velocities, motors);
+    state.SetItemsProcessed(state.iterations()*state.range(0)*state.range(1));
+}
+
+
+BENCHMARK(BM_klein_exp)
+    ->ArgsProduct({{1 << 14}, {10, 100}})
+    ->ArgNames({"bodies", "steps"});
+
+BENCHMARK_TEMPLATE(BM_chart_integrator, integrator_scheme::rk4, motor_chart::cayley)
+    ->ArgsProduct({{1 << 14}, {10, 100}, {1, 4}})
+    ->ArgNames({"bodies", "steps", "threads"})->UseRealTime();
+BENCHMARK_TEMPLATE(BM_chart_integrator, integrator_scheme::rk4, motor_chart::outer_exp)
+    ->ArgsProduct({{1 << 14}, {10, 100}, {1, 4}})
+    ->ArgNames({"bodies", "steps", "threads"})->UseRealTime();
+BENCHMARK_TEMPLATE(BM_chart_integrator, integrator_scheme::lie_group, motor_chart::cayley)
+    ->ArgsProduct({{1 << 14}, {10, 100}, {1, 4}})
+    ->ArgNames({"bodies", "steps", "threads"})->UseRealTime();
+BENCHMARK_TEMPLATE(BM_chart_integrator, integrator_scheme::lie_group, motor_chart::outer_exp)
+    ->ArgsProduct({{1 << 14}, {10, 100}, {1, 4}})
+    ->ArgNames({"bodies", "steps", "threads"})->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,334 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <vector>
+#include <klein/klein.hpp>
+#include "cayley.h"
+#include "outer_exp.h"
+#include "reprojection_cost.h"
+#include "camera_ops.h"
+
+#include "ceres/ceres.h"
+
+
+/*
+Sparse bundle adjustment over many cameras observing shared world points.
+Every camera is a bivector in one of the motor charts and every point is a
+Euclidean 3 vector. Each observation contributes a 2x(6+3) residual block,
+so the normal equations have the usual arrow structure: points are
+eliminated first through the Schur complement, leaving a reduced camera
+system that is factorised sparsely or solved iteratively.
+*/
+
+
+/// Configuration of a bundle adjustment solve
+struct bundle_adjustment_options {
+    int num_threads = 1;
+    // SPARSE_SCHUR factorises the reduced camera system, ITERATIVE_SCHUR
+    // solves it with preconditioned conjugate gradients in bounded memory
+    // and is the better choice for thousands of cameras
+    ceres::LinearSolverType linear_solver_type = ceres::SPARSE_SCHUR;
+    ceres::PreconditionerType preconditioner_type = ceres::SCHUR_JACOBI;
+    // Keep the Schur complement implicit with the iterative solver, trading
+    // time for memory
+    bool use_explicit_schur_complement = false;
+    int max_num_iterations = 100;
+    double function_tolerance = 1e-6;
+    double gradient_tolerance = 1e-10;
+    double parameter_tolerance = 1e-8;
+    bool verbose = false;
+    motor_chart chart = motor_chart::outer_exp;
+    robust_loss loss = robust_loss::none;
+    // Residual norm, in image plane units, at which the loss starts to down weight
+    double loss_scale = 1e-2;
+    // Hold the first camera fixed to remove the rigid gauge freedom
+    bool fix_first_camera = true;
+    // Hold every point fixed, refining the cameras only
+    bool fix_points = false;
+};
+
+
+/// Outcome of a bundle adjustment solve
+struct bundle_adjustment_result {
+    double initial_cost = 0.0;
+    double final_cost = 0.0;
+    int num_iterations = 0;
+    ceres::TerminationType termination_type = ceres::FAILURE;
+    bool usable = false;
+};
+
+
+/// Per camera matrix and its derivative, evaluated once per solver step
+struct camera_matrix_cache {
+    double matrix[12];
+    double matrix_jacobian[72];
+};
+
+
+class BundleReprojectionCostFunction : public ceres::SizedCostFunction<2, 6, 3> {
+    /*
+    Reprojection residual of one observation as a function of its camera's
+    chart parameters and its point. The camera matrix and its jacobian are
+    read from a cache filled once per evaluation for all observations of the
+    camera, so each observation only costs the projection of its point.
+    */
+public:
+    BundleReprojectionCostFunction(const camera_matrix_cache* camera, double u, double v)
+        : camera_(camera), u_(u), v_(v)
+    {}
+
+    bool Evaluate(double const* const* parameters, double* residuals, double** jacobians) const override {
+        const double* m = camera_->matrix;
+        const double* p = parameters[1];
+        double X = m[0]*p[0] + m[1]*p[1] + m[2]*p[2] + m[3];
+        double Y = m[4]*p[0] + m[5]*p[1] + m[6]*p[2] + m[7];
+        double Z = m[8]*p[0] + m[9]*p[1] + m[10]*p[2] + m[11];
+        double inv_Z = 1.0/Z;
+        double u = X*inv_Z;
+        double v = Y*inv_Z;
+        residuals[0] = u_ - u;
+        residuals[1] = v_ - v;
+        if (jacobians == nullptr){
+            return true;
+        }
+
+        if (jacobians[0] != nullptr){
+            const double* mj = camera_->matrix_jacobian;
+            const double ph[4] = {p[0], p[1], p[2], 1.0};
+            for (int k=0; k<6; k++){
+                double dX = 0.0;
+                double dY = 0.0;
+                double dZ = 0.0;
+                for (int c=0; c<4; c++){
+                    dX += mj[6*c + k]*ph[c];
+                    dY += mj[6*(4 + c) + k]*ph[c];
+                    dZ += mj[6*(8 + c) + k]*ph[c];
+                }
+                jacobians[0][k] = -(dX - u*dZ)*inv_Z;
+                jacobians[0][6 + k] = -(dY - v*dZ)*inv_Z;
+            }
+        }
+        if (jacobians[1] != nullptr){
+            for (int c=0; c<3; c++){
+                jacobians[1][c] = -(m[c] - u*m[8 + c])*inv_Z;
+                jacobians[1][3 + c] = -(m[4 + c] - v*m[8 + c])*inv_Z;
+            }
+        }
+        return true;
+    }
+
+private:
+    const camera_matrix_cache* camera_;
+    double u_;
+    double v_;
+};
+
+
+class bundle_adjustment {
+    /*
+    Holds the cameras, points and observations of a reconstruction in flat
+    arrays and refines them jointly. Observations are stored structure of
+    arrays and their cost functions are allocated in large blocks rather than
+    one at a time, so memory grows by a fixed small amount per observation. Observations are image
+    plane points on z = 1, as produced by project_to_camera.
+    */
+public:
+    explicit bundle_adjustment(const bundle_adjustment_options& options=bundle_adjustment_options())
+        : options_(options)
+    {}
+
+    bundle_adjustment(const bundle_adjustment&) = delete;
+    bundle_adjustment& operator=(const bundle_adjustment&) = delete;
+
+    const bundle_adjustment_options& options() const noexcept { return options_; }
+
+    void reserve(std::size_t num_cameras, std::size_t num_points, std::size_t num_observations){
+        cameras_.reserve(6*num_cameras);
+        points_.reserve(3*num_points);
+        observation_camera_.reserve(num_observations);
+        observation_point_.reserve(num_observations);
+        observation_u_.reserve(num_observations);
+        observation_v_.reserve(num_observations);
+    }
+
+    std::size_t add_camera(kln::motor const& camera){
+        /*
+        Adds a camera at the given motor, returning its index
+        */
+        kln::line biv = chart_bivector(options_.chart, camera);
+        const double x[6] = {biv.e01(), biv.e02(), biv.e03(), biv.e23(), biv.e31(), biv.e12()};
+        cameras_.insert(cameras_.end(), x, x + 6);
+        return num_cameras() - 1;
+    }
+
+    std::size_t add_point(double x, double y, double z){
+        /*
+        Adds a world point, returning its index
+        */
+        points_.push_back(x);
+        points_.push_back(y);
+        points_.push_back(z);
+        return num_points() - 1;
+    }
+
+    bool add_observation(std::size_t camera, std::size_t point, double u, double v){
+        /*
+        Records that the camera sees the point at (u, v) on its image plane.
+        Returns false, recording nothing, when either index does not name a
+        camera or point that has been added or does not fit the 32 bit
+        indices observations are stored with
+        */
+        constexpr std::size_t max_index = std::numeric_limits<std::uint32_t>::max();
+        if (camera >= num_cameras() || point >= num_points() || camera > max_index || point > max_index){
+            return false;
+        }
+        observation_camera_.push_back(static_cast<std::uint32_t>(camera));
+        observation_point_.push_back(static_cast<std::uint32_t>(point));
+        observation_u_.push_back(u);
+        observation_v_.push_back(v);
+        return true;
+    }
+
+    std::size_t num_cameras() const noexcept { return cameras_.size()/6; }
+    std::size_t num_points() const noexcept { return points_.size()/3; }
+    std::size_t num_observations() const noexcept { return observation_u_.size(); }
+
+    kln::motor camera(std::size_t i) const {
+        // Evaluate the chart in double, rounding only the resulting motor
+        double m[8];
+        chart_motor(options_.chart, &cameras_[6*i], m);
+        return kln::motor{static_cast<float>(m[0]), static_cast<float>(m[1]), static_cast<float>(m[2]),
+                          static_cast<float>(m[3]), static_cast<float>(m[4]), static_cast<float>(m[5]),
+                          static_cast<float>(m[6]), static_cast<float>(m[7])};
+    }
+
+    kln::point point(std::size_t i) const {
+        const double* p = &points_[3*i];
+        return kln::point{static_cast<float>(p[0]), static_cast<float>(p[1]), static_cast<float>(p[2])};
+    }
+
+    const double* camera_parameters(std::size_t i) const { return &cameras_[6*i]; }
+    const double* point_parameters(std::size_t i) const { return &points_[3*i]; }
+
+    bundle_adjustment_result solve(){
+        /*
+        Jointly refines every camera and point by minimising the reprojection
+        error of all observations
+        */
+        const std::size_t num_obs = num_observations();
+        camera_cache_.assign(num_cameras(), camera_matrix_cache());
+        cost_functions_.clear();
+        loss_function_ = make_loss_function(options_.loss, options_.loss_scale);
+        callback_ = std::make_unique<camera_matrix_callback>(this);
+
+        Problem::Options problem_options;
+        problem_options.cost_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+        problem_options.loss_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+        problem_options.evaluation_callback = callback_.get();
+        Problem problem(problem_options);
+
+        for (std::size_t i=0; i<num_obs; i++){
+            std::size_t c = observation_camera_[i];
+            std::size_t p = observation_point_[i];
+            cost_functions_.emplace_back(&camera_cache_[c], observation_u_[i], observation_v_[i]);
+            problem.AddResidualBlock(&cost_functions_.back(), loss_function_.get(), &cameras_[6*c], &points_[3*p]);
+        }
+
+        // Eliminate the points first, leaving the reduced camera system
+        auto ordering = std::make_shared<ceres::ParameterBlockOrdering>();
+        for (std::size_t p=0; p<num_points(); p++){
+            if (problem.HasParameterBlock(&points_[3*p])){
+                ordering->AddElementToGroup(&points_[3*p], 0);
+                if (options_.fix_points){
+                    problem.SetParameterBlockConstant(&points_[3*p]);
+                }
+            }
+        }
+        for (std::size_t c=0; c<num_cameras(); c++){
+            if (problem.HasParameterBlock(&cameras_[6*c])){
+                ordering->AddElementToGroup(&cameras_[6*c], 1);
+            }
+        }
+        if (options_.fix_first_camera && num_cameras() > 0 && problem.HasParameterBlock(&cameras_[0])){
+            problem.SetParameterBlockConstant(&cameras_[0]);
+        }
+
+        Solver::Options solver_options;
+        solver_options.num_threads = options_.num_threads;
+        solver_options.linear_solver_type = options_.linear_solver_type;
+        solver_options.preconditioner_type = options_.preconditioner_type;
+        solver_options.use_explicit_schur_complement = options_.use_explicit_schur_complement;
+        solver_options.linear_solver_ordering = ordering;
+        solver_options.max_num_iterations = options_.max_num_iterations;
+        solver_options.function_tolerance = options_.function_tolerance;
+        solver_options.gradient_tolerance = options_.gradient_tolerance;
+        solver_options.parameter_tolerance = options_.parameter_tolerance;
+        solver_options.minimizer_progress_to_stdout = options_.verbose;
+        solver_options.logging_type = options_.verbose ? ceres::PER_MINIMIZER_ITERATION : ceres::SILENT;
+
+        Solver::Summary summary;
+        Solve(solver_options, &problem, &summary);
+        if (options_.verbose){
+            std::cout << summary.FullReport() << "\n";
+        }
+
+        bundle_adjustment_result result;
+        result.initial_cost = summary.initial_cost;
+        result.final_cost = summary.final_cost;
+        result.num_iterations = solver_iterations(summary);
+        result.termination_type = summary.termination_type;
+        result.usable = summary.IsSolutionUsable();
+        return result;
+    }
+
+private:
+    class camera_matrix_callback : public ceres::EvaluationCallback {
+        /*
+        Refreshes the matrix of every camera, and its jacobian when the
+        solver asks for jacobians, before each evaluation. Ceres writes the
+        evaluation point into the parameter blocks beforehand.
+        */
+    public:
+        explicit camera_matrix_callback(bundle_adjustment* owner)
+            : owner_(owner)
+        {}
+
+        void PrepareForEvaluation(bool evaluate_jacobians, bool new_evaluation_point) override {
+            // The jacobians are cheap next to the observations so they are
+            // always refreshed along with the matrices
+            (void)evaluate_jacobians;
+            if (!new_evaluation_point && prepared_){
+                return;
+            }
+            for (std::size_t c=0; c<owner_->camera_cache_.size(); c++){
+                camera_matrix_cache& cache = owner_->camera_cache_[c];
+                camera_matrix_jacobian(owner_->options_.chart, &owner_->cameras_[6*c],
+                                       cache.matrix, cache.matrix_jacobian);
+            }
+            prepared_ = true;
+        }
+
+    private:
+        bundle_adjustment* owner_;
+        bool prepared_ = false;
+    };
+
+    bundle_adjustment_options options_;
+    std::vector<double> cameras_;
+    std::vector<double> points_;
+    std::vector<std::uint32_t> observation_camera_;
+    std::vector<std::uint32_t> observation_point_;
+    std::vector<double> observation_u_;
+    std::vector<double> observation_v_;
+    std::vector<camera_matrix_cache> camera_cache_;
+    // Cost functions can not be moved, a deque keeps their addresses stable
+    std::deque<BundleReprojectionCostFunction> cost_functions_;
+    std::unique_ptr<ceres::LossFunction> loss_function_;
+    std::unique_ptr<camera_matrix_callback> callback_;
+};
@@ -0,0 +1,312 @@
+#pragma once
+
+#include <cstddef>
+#include <klein/klein.hpp>
+#include "distortion.h"
+#include "point_cloud.h"
+#include "projection_kernels.h"
+#include "reprojection_cost.h"
+
+#include "ceres/ceres.h"
+
+
+/*
+A full camera model, pinhole intrinsics followed by Brown-Conrady distortion,
+taking world points through the camera frame and the lens to pixels. The
+projection is fused into a single batched pass and the reprojection cost can
+refine the camera parameters alongside the motor.
+*/
+
+
+/// Intrinsics and lens distortion of a camera
+struct camera_model {
+    camera_intrinsics intrinsics;
+    brown_conrady distortion;
+
+    // Parameter order used by the solver
+    // {fx, fy, s, cx, cy, k1, k2, k3, p1, p2}
+    static constexpr int num_parameters = 10;
+
+    void to_parameters(double parameters[num_parameters]) const {
+        parameters[0] = intrinsics.fx;
+        parameters[1] = intrinsics.fy;
+        parameters[2] = intrinsics.s;
+        parameters[3] = intrinsics.cx;
+        parameters[4] = intrinsics.cy;
+        parameters[5] = distortion.k1;
+        parameters[6] = distortion.k2;
+        parameters[7] = distortion.k3;
+        parameters[8] = distortion.p1;
+        parameters[9] = distortion.p2;
+    }
+
+    void from_parameters(const double parameters[num_parameters]){
+        intrinsics.fx = parameters[0];
+        intrinsics.fy = parameters[1];
+        intrinsics.s = parameters[2];
+        intrinsics.cx = parameters[3];
+        intrinsics.cy = parameters[4];
+        distortion.k1 = parameters[5];
+        distortion.k2 = parameters[6];
+        distortion.k3 = parameters[7];
+        distortion.p1 = parameters[8];
+        distortion.p2 = parameters[9];
+    }
+};
+
+
+template <typename V>
+void project_to_pixels_kernel(const V m[12], const V k[5], const distortion_batch_coefficients<V>& c,
+                            V x, V y, V z, V w, V& u, V& v){
+    V X = m[0]*x + m[1]*y + m[2]*z + m[3]*w;
+    V Y = m[4]*x + m[5]*y + m[6]*z + m[7]*w;
+    V Z = m[8]*x + m[9]*y + m[10]*z + m[11]*w;
+    V inv_Z = c.one/Z;
+    V x_dist, y_dist;
+    distort_brown_conrady(c, X*inv_Z, Y*inv_Z, x_dist, y_dist);
+    u = k[0]*x_dist + k[2]*y_dist + k[3];
+    v = k[1]*y_dist + k[4];
+}
+
+
+void project_to_pixels(const float matrix[12], const camera_model& model,
+                        point_cloud_view points, float* u, float* v){
+    /*
+    Maps each point through the 3x4 camera matrix, onto the z = 1 plane,
+    through the lens distortion and the intrinsics in one pass, writing the
+    pixel coordinates to u and v
+    */
+    const std::size_t n = points.size();
+    const camera_intrinsics& K = model.intrinsics;
+    const double intrinsics[5] = {K.fx, K.fy, K.s, K.cx, K.cy};
+    std::size_t i = 0;
+    {
+        using V = float_batch;
+        V m[12];
+        V k[5];
+        for (int j=0; j<12; j++){
+            m[j] = V::broadcast(matrix[j]);
+        }
+        for (int j=0; j<5; j++){
+            k[j] = V::broadcast(static_cast<float>(intrinsics[j]));
+        }
+        const distortion_batch_coefficients<V> c(model.distortion);
+        for (; i + V::width <= n; i += V::width){
+            V ui, vi;
+            project_to_pixels_kernel(m, k, c, V::load(points.x + i), V::load(points.y + i),
+                                    V::load(points.z + i), V::load(points.w + i), ui, vi);
+            ui.store(u + i);
+            vi.store(v + i);
+        }
+    }
+    using W = scalar_batch<float>;
+    W m[12];
+    W k[5];
+    for (int j=0; j<12; j++){
+        m[j] = W::broadcast(matrix[j]);
+    }
+    for (int j=0; j<5; j++){
+        k[j] = W::broadcast(static_cast<float>(intrinsics[j]));
+    }
+    const distortion_batch_coefficients<W> c(model.distortion);
+    for (; i < n; i++){
+        W ui, vi;
+        project_to_pixels_kernel(m, k, c, W::load(points.x + i), W::load(points.y + i),
+                                W::load(points.z + i), W::load(points.w + i), ui, vi);
+        ui.store(u + i);
+        vi.store(v + i);
+    }
+}
+
+
+void project_to_pixels(kln::motor const& R, const camera_model& model,
+                        point_cloud_view points, float* u, float* v){
+    /*
+    Projects the points into the pixels of the camera at R
+    */
+    float matrix[12];
+    motor_to_mat3x4(~R, matrix);
+    project_to_pixels(matrix, model, points, u, v);
+}
+
+
+float total_pixel_reprojection_error(const float matrix[12], const camera_model& model,
+                                     point_cloud_view points, point_cloud_view pixel_points){
+    /*
+    Sum of the pixel distances between each observed pixel point and its
+    projection through the full camera model, fused into one pass without
+    storing the projected pixels
+    */
+    const std::size_t n = points.size();
+    const camera_intrinsics& K = model.intrinsics;
+    const double intrinsics[5] = {K.fx, K.fy, K.s, K.cx, K.cy};
+    std::size_t i = 0;
+    float total_error = 0.0f;
+    {
+        using V = float_batch;
+        V m[12];
+        V k[5];
+        for (int j=0; j<12; j++){
+            m[j] = V::broadcast(matrix[j]);
+        }
+        for (int j=0; j<5; j++){
+            k[j] = V::broadcast(static_cast<float>(intrinsics[j]));
+        }
+        const distortion_batch_coefficients<V> c(model.distortion);
+        V sum = V::broadcast(0.0f);
+        for (; i + V::width <= n; i += V::width){
+            V ui, vi;
+            project_to_pixels_kernel(m, k, c, V::load(points.x + i), V::load(points.y + i),
+                                    V::load(points.z + i), V::load(points.w + i), ui, vi);
+            V du = V::load(pixel_points.x + i) - ui;
+            V dv = V::load(pixel_points.y + i) - vi;
+            sum = sum + sqrt(du*du + dv*dv);
+        }
+        float lanes[V::width];
+        sum.store(lanes);
+        for (std::size_t j=0; j<V::width; j++){
+            total_error += lanes[j];
+        }
+    }
+    using W = scalar_batch<float>;
+    W m[12];
+    W k[5];
+    for (int j=0; j<12; j++){
+        m[j] = W::broadcast(matrix[j]);
+    }
+    for (int j=0; j<5; j++){
+        k[j] = W::broadcast(static_cast<float>(intrinsics[j]));
+    }
+    const distortion_batch_coefficients<W> c(model.distortion);
+    for (; i < n; i++){
+        W ui, vi;
+        project_to_pixels_kernel(m, k, c, W::load(points.x + i), W::load(points.y + i),
+                                W::load(points.z + i), W::load(points.w + i), ui, vi);
+        float du = pixel_points.x[i] - ui.v;
+        float dv = pixel_points.y[i] - vi.v;
+        total_error += std::sqrt(du*du + dv*dv);
+    }
+    return total_error;
+}
+
+
+void pixel_residuals_and_jacobian(const double matrix[12], const double* matrix_jacobian,
+                                const double camera[camera_model::num_parameters],
+                                point_cloud_view points, point_cloud_view pixel_points,
+                                double* residuals, double* motor_jacobian, double* camera_jacobian,
+                                int num_pose_parameters=6){
+    /*
+    Evaluates the residuals pixel_point - projected_pixel for each
+    correspondence in double precision and, for the jacobians that are not
+    null, their row major (2n)x(num_pose_parameters) derivative with respect
+    to the pose parameters and (2n)x10 derivative with respect to the camera
+    parameters
+    */
+    const int P = num_pose_parameters;
+    const double fx = camera[0], fy = camera[1], s = camera[2], cx = camera[3], cy = camera[4];
+    const double k1 = camera[5], k2 = camera[6], k3 = camera[7], p1 = camera[8], p2 = camera[9];
+    for (std::size_t i=0; i<points.size(); i++){
+        const double p[4] = {points.x[i], points.y[i], points.z[i], points.w[i]};
+        double X = matrix[0]*p[0] + matrix[1]*p[1] + matrix[2]*p[2] + matrix[3]*p[3];
+        double Y = matrix[4]*p[0] + matrix[5]*p[1] + matrix[6]*p[2] + matrix[7]*p[3];
+        double Z = matrix[8]*p[0] + matrix[9]*p[1] + matrix[10]*p[2] + matrix[11]*p[3];
+        double inv_Z = 1.0/Z;
+        double x = X*inv_Z;
+        double y = Y*inv_Z;
+
+        double r2 = x*x + y*y;
+        double radial = 1.0 + r2*(k1 + r2*(k2 + r2*k3));
+        double x_dist = x*radial + 2.0*p1*x*y + p2*(r2 + 2.0*x*x);
+        double y_dist = y*radial + 2.0*p2*x*y + p1*(r2 + 2.0*y*y);
+        residuals[2*i] = pixel_points.x[i] - (fx*x_dist + s*y_dist + cx);
+        residuals[2*i + 1] = pixel_points.y[i] - (fy*y_dist + cy);
+
+        if (motor_jacobian != nullptr){
+            // Chain the image plane jacobian through the lens and the intrinsics
+            double radial_r2 = k1 + r2*(2.0*k2 + 3.0*k3*r2);
+            double dxd_dx = radial + 2.0*x*x*radial_r2 + 2.0*p1*y + 6.0*p2*x;
+            double dxd_dy = 2.0*x*y*radial_r2 + 2.0*p1*x + 2.0*p2*y;
+            double dyd_dx = 2.0*x*y*radial_r2 + 2.0*p2*y + 2.0*p1*x;
+            double dyd_dy = radial + 2.0*y*y*radial_r2 + 2.0*p2*x + 6.0*p1*y;
+            double* row_u = motor_jacobian + 2*P*i;
+            double* row_v = row_u + P;
+            for (int k=0; k<P; k++){
+                double dX = 0.0;
+                double dY = 0.0;
+                double dZ = 0.0;
+                for (int c=0; c<4; c++){
+                    dX += matrix_jacobian[P*c + k]*p[c];
+                    dY += matrix_jacobian[P*(4 + c) + k]*p[c];
+                    dZ += matrix_jacobian[P*(8 + c) + k]*p[c];
+                }
+                double dx = (dX - x*dZ)*inv_Z;
+                double dy = (dY - y*dZ)*inv_Z;
+                double dxd = dxd_dx*dx + dxd_dy*dy;
+                double dyd = dyd_dx*dx + dyd_dy*dy;
+                row_u[k] = -(fx*dxd + s*dyd);
+                row_v[k] = -fy*dyd;
+            }
+        }
+
+        if (camera_jacobian != nullptr){
+            double* row_u = camera_jacobian + 2*camera_model::num_parameters*i;
+            double* row_v = row_u + camera_model::num_parameters;
+            double r4 = r2*r2;
+            double r6 = r4*r2;
+            // Derivatives of the distorted point with respect to k1 k2 k3 p1 p2
+            const double dxd[5] = {x*r2, x*r4, x*r6, 2.0*x*y, r2 + 2.0*x*x};
+            const double dyd[5] = {y*r2, y*r4, y*r6, r2 + 2.0*y*y, 2.0*x*y};
+            row_u[0] = -x_dist;
+            row_u[1] = 0.0;
+            row_u[2] = -y_dist;
+            row_u[3] = -1.0;
+            row_u[4] = 0.0;
+            row_v[0] = 0.0;
+            row_v[1] = -y_dist;
+            row_v[2] = 0.0;
+            row_v[3] = 0.0;
+            row_v[4] = -1.0;
+            for (int k=0; k<5; k++){
+                row_u[5 + k] = -(fx*dxd[k] + s*dyd[k]);
+                row_v[5 + k] = -fy*dyd[k];
+            }
+        }
+    }
+}
+
+
+class PixelReprojectionCostFunction : public ceres::CostFunction {
+    /*
+    Pixel reprojection residuals of a set of correspondences as a function of
+    the six chart parameters, or the eight motor coefficients, and the ten
+    camera model parameters, with analytic jacobians
+    */
+public:
+    PixelReprojectionCostFunction(point_cloud_view points, point_cloud_view pixel_points,
+                                motor_chart chart=motor_chart::outer_exp,
+                                pose_parameterization parameterization=pose_parameterization::chart)
+        : points_(points), pixel_points_(pixel_points), chart_(chart), parameterization_(parameterization)
+    {
+        set_num_residuals(2*static_cast<int>(points.size()));
+        mutable_parameter_block_sizes()->push_back(pose_parameter_size(parameterization));
+        mutable_parameter_block_sizes()->push_back(camera_model::num_parameters);
+    }
+
+    bool Evaluate(double const* const* parameters, double* residuals, double** jacobians) const override {
+        double matrix[12];
+        double matrix_jacobian[96];
+        pose_camera_matrix_jacobian(chart_, parameterization_, parameters[0], matrix, matrix_jacobian);
+        double* motor_jacobian = (jacobians != nullptr) ? jacobians[0] : nullptr;
+        double* camera_jacobian = (jacobians != nullptr) ? jacobians[1] : nullptr;
+        pixel_residuals_and_jacobian(matrix, matrix_jacobian, parameters[1], points_, pixel_points_,
+                                    residuals, motor_jacobian, camera_jacobian,
+                                    pose_parameter_size(parameterization_));
+        return true;
+    }
+
+private:
+    point_cloud_view points_;
+    point_cloud_view pixel_points_;
+    motor_chart chart_;
+    pose_parameterization parameterization_;
+};
@@ -1,35 +1,43 @@
+#pragma once
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <type_traits>
+#include <vector>
 #include <klein/klein.hpp>
 #include "cayley.h"
 #include "outer_exp.h"
+#include "camera_model.h"
+#include "motor_manifold.h"
+#include "point_cloud.h"
+#include "projection_kernels.h"
+#include "reprojection_cost.h"
 
 #include "ceres/ceres.h"
 
 
-using ceres::NumericDiffCostFunction;
 using ceres::CostFunction;
 using ceres::Problem;
 using ceres::Solve;
 using ceres::Solver;
 
 
-#define CERES_NPOINTS_2X 10
-
-
 
 void generate_internal_matrix(float params[5], float matrix[3][3]){
     /* 
     Turns a list of 5 parameters into an intrinsic matrix
-    params[6] = {fx, fy, s, cx, cy} 
+    params[5] = {fx, fy, s, cx, cy} 
     */
     matrix[0][0] = params[0];
-    matrix[1][1] = params[1];
-    matrix[2][2] = 1.0f;
     matrix[0][1] = params[2];
     matrix[0][2] = params[3];
-    matrix[0][3] = params[4];
     matrix[1][0] = 0.0f;
+    matrix[1][1] = params[1];
+    matrix[1][2] = params[4];
     matrix[2][0] = 0.0f;
     matrix[2][1] = 0.0f;
+    matrix[2][2] = 1.0f;
 }
 
 
@@ -129,171 +137,631 @@ void remove_radial_distortion(double x_dist, double y_dist,
 }
 
 
+void project_to_camera(kln::motor &R, 
+                        point_cloud_view points, 
+                        point_cloud &output_points){
+    /*
+    Maps each point into the camera frame and intersects the ray through the
+    camera centre with the standard image plane. The motor is expanded once and
+    the perspective divide is fused into the batched kernel, so the output
+    points are already normalized.
+    */
+    output_points.resize(points.size());
+    project_points(R, points, output_points.x.data(), output_points.y.data());
+    std::fill(output_points.z.begin(), output_points.z.end(), 1.0f);
+    std::fill(output_points.w.begin(), output_points.w.end(), 1.0f);
+}
+
+
+/// Scratch point clouds for the overloads taking individually allocated points
+struct reprojection_workspace {
+    point_cloud points;
+    point_cloud camera_points;
+    point_cloud projected;
+};
+
+
+reprojection_workspace& thread_reprojection_workspace(){
+    /*
+    Workspace shared by every call on the current thread, it grows to the
+    largest set of points seen and is then reused without allocating
+    */
+    thread_local reprojection_workspace workspace;
+    return workspace;
+}
+
+
 void project_to_camera(kln::motor &R, 
                         std::vector<std::shared_ptr<kln::point>> &points, 
-                        std::vector<std::shared_ptr<kln::point>> &output_points){
-
-    output_points.reserve(points.size()); 
-
-    kln::point remapped_point;
-    kln::point origin = kln::origin();
-    kln::plane standard_plane = {0.0f, 0.0f, -1.0f, 1.0f};
-    for (std::size_t i=0; i< points.size(); i++){ 
-        // Map to the camera coordinate system
-        remapped_point = (~R)(*points[i]);
-        // Intersect
-        kln::point resulting_point = (remapped_point & origin) ^ standard_plane;
-        // Store
-        auto pnt = std::make_shared<kln::point> (resulting_point);
-        output_points.push_back(std::move(pnt));
-    }
+                        std::vector<std::shared_ptr<kln::point>> &output_points,
+                        reprojection_workspace& workspace=thread_reprojection_workspace()){
+    /*
+    Only the appended output points are allocated, the intermediate clouds
+    live in the workspace
+    */
+    to_point_cloud(points, workspace.points);
+    project_to_camera(R, workspace.points, workspace.projected);
+    append_to_shared_points(workspace.projected, output_points);
+}
+
+
+float reprojection_error(kln::motor &R, 
+                        point_cloud_view points, 
+                        point_cloud_view camera_points){
+
+    // Project the points to the standard camera plane and accumulate the
+    // error in the same pass
+    float matrix[12];
+    motor_to_mat3x4(~R, matrix);
+
+    // The camera points are on the normalised image plane here, the
+    // camera_model overload compares against raw pixels instead
+    return total_reprojection_error(matrix, points, camera_points);
+}
+
+
+float reprojection_error(kln::motor &R, 
+                        const camera_model& model,
+                        point_cloud_view points, 
+                        point_cloud_view pixel_points){
+    /*
+    Total pixel distance between the observed pixel points and the points
+    projected through the full camera model
+    */
+    float matrix[12];
+    motor_to_mat3x4(~R, matrix);
+    return total_pixel_reprojection_error(matrix, model, points, pixel_points);
 }
 
 
 float reprojection_error(kln::motor &R, 
                         std::vector<std::shared_ptr<kln::point>> &points, 
-                        std::vector<std::shared_ptr<kln::point>> &camera_points){
+                        std::vector<std::shared_ptr<kln::point>> &camera_points,
+                        reprojection_workspace& workspace=thread_reprojection_workspace()){
+
+    to_point_cloud(points, workspace.points);
+    to_point_cloud(camera_points, workspace.camera_points);
+    return reprojection_error(R, workspace.points, workspace.camera_points);
+}
+
 
-    // Project the points to the standard camera plane
-    std::vector<std::shared_ptr<kln::point>> output_points;
-    output_points.reserve(points.size()); 
-    project_to_camera(R, points, output_points);
+float reprojection_residuals(kln::motor &R, 
+                        point_cloud_view points, 
+                        point_cloud_view camera_points,
+                        double* residual){
 
-    // Map the points to the pixel positions (intrinsics)
-    // Actually just assume the camera points are already expressed in the form we want
+    // Project the points to the standard camera plane in double, the
+    // motor of the reversed camera only widens the float coefficients
+    const double reverse[8] = {R.scalar(), -R.e23(), -R.e31(), -R.e12(),
+                               -R.e01(), -R.e02(), -R.e03(), R.e0123()};
+    double matrix[12];
+    motor_to_mat3x4(reverse, matrix);
+
+    // The camera points are on the normalised image plane here, the
+    // camera_model overload compares against raw pixels instead
+    image_plane_residuals(matrix, points, camera_points, residual);
 
     // Return the error with camera points
-    float total_error = 0.0f;
-    kln::point diff_pnt;
+    double total_error = 0.0;
     for (std::size_t i=0; i< camera_points.size(); i++){ 
-        diff_pnt = ((*camera_points[i]) - output_points[i]->normalized());
-        auto x = diff_pnt.x();
-        auto y = diff_pnt.y();
-        total_error += std::sqrt(x*x + y*y);
+        total_error += std::sqrt(residual[2*i]*residual[2*i] + residual[2*i + 1]*residual[2*i + 1]);
     }
-    return total_error;
+    return static_cast<float>(total_error);
 }
 
 
 float reprojection_residuals(kln::motor &R, 
                         std::vector<std::shared_ptr<kln::point>> &points, 
                         std::vector<std::shared_ptr<kln::point>> &camera_points,
-                        double* residual){
+                        double* residual,
+                        reprojection_workspace& workspace=thread_reprojection_workspace()){
 
-    // Project the points to the standard camera plane
-    std::vector<std::shared_ptr<kln::point>> output_points;
-    output_points.reserve(points.size()); 
-    project_to_camera(R, points, output_points);
+    to_point_cloud(points, workspace.points);
+    to_point_cloud(camera_points, workspace.camera_points);
+    return reprojection_residuals(R, workspace.points, workspace.camera_points, residual);
+}
 
-    // Map the points to the pixel positions (intrinsics)
-    // Actually just assume the camera points are already expressed in the form we want
 
-    // Return the error with camera points
-    float total_error = 0.0f;
-    kln::point diff_pnt;
-    for (std::size_t i=0; i< camera_points.size(); i++){ 
-        diff_pnt = ((*camera_points[i]) - output_points[i]->normalized());
-        residual[2*i] = (double) diff_pnt.x();
-        residual[2*i + 1] = (double) diff_pnt.y();
+/// Robust loss applied to each correspondence during refinement
+enum class robust_loss {
+    none,
+    huber,
+    cauchy
+};
+
+
+/// Configuration of the nonlinear pose refinement in find_camera
+struct pose_solver_options {
+    int num_threads = 1;
+    ceres::LinearSolverType linear_solver_type = ceres::DENSE_QR;
+    ceres::TrustRegionStrategyType trust_region_strategy_type = ceres::LEVENBERG_MARQUARDT;
+    int max_num_iterations = 50;
+    double function_tolerance = 1e-6;
+    double gradient_tolerance = 1e-10;
+    double parameter_tolerance = 1e-8;
+    // Print the solver progress and full report to stdout
+    bool verbose = false;
+    motor_chart chart = motor_chart::outer_exp;
+    // Solve for the chart coordinates of the whole motor, or for the motor
+    // coefficients with each step taken through the chart by MotorManifold.
+    // The manifold keeps the chart near the identity so large rotations
+    // converge as well as small ones.
+    pose_parameterization parameterization = pose_parameterization::chart;
+    residual_layout layout = residual_layout::chunked;
+    // Correspondences per residual block for the chunked layout
+    std::size_t chunk_size = 64;
+    // A robust loss has to see each correspondence separately, so any loss
+    // other than none implies one residual block per correspondence
+    robust_loss loss = robust_loss::none;
+    // Residual norm, in image plane units, at which the loss starts to down weight
+    double loss_scale = 1e-2;
+};
+
+
+/// Outcome of a pose refinement
+struct pose_solver_result {
+    kln::motor motor;
+    kln::line bivector;
+    double initial_cost = 0.0;
+    double final_cost = 0.0;
+    int num_iterations = 0;
+    ceres::TerminationType termination_type = ceres::FAILURE;
+    bool usable = false;
+};
+
+
+kln::motor chart_motor(motor_chart chart, kln::line biv){
+    /*
+    Maps a bivector to the motor it represents in the chosen chart
+    */
+    return with_chart(chart, [&](auto policy){
+        return chart_map<decltype(policy)>(biv);
+    });
+}
+
+
+kln::line chart_bivector(motor_chart chart, kln::motor R){
+    /*
+    Maps a motor to its bivector in the chosen chart, the inverse of chart_motor
+    */
+    return with_chart(chart, [&](auto policy){
+        return chart_inverse_map<decltype(policy)>(R);
+    });
+}
+
+
+std::unique_ptr<ceres::LossFunction> make_loss_function(robust_loss loss, double scale){
+    /*
+    Creates the ceres loss function for a robust loss, or null for none
+    */
+    switch (loss){
+        case robust_loss::huber:
+            return std::make_unique<ceres::HuberLoss>(scale);
+        case robust_loss::cauchy:
+            return std::make_unique<ceres::CauchyLoss>(scale);
+        default:
+            return nullptr;
     }
-    return total_error;
 }
 
 
-void find_camera(kln::line initial_biv,
-                std::vector<std::shared_ptr<kln::point>>& points, 
-                std::vector<std::shared_ptr<kln::point>>& camera_points){
-
-
-  // The variable to solve for with its initial value. It will be
-  // mutated in place by the solver.
-  double x[6];
-  x[0] = initial_biv.e01();
-  x[1] = initial_biv.e02();
-  x[2] = initial_biv.e03();
-  x[3] = initial_biv.e23();
-  x[4] = initial_biv.e31();
-  x[5] = initial_biv.e12();
-  const double initial_x[6] = {x[0], x[1], x[2], x[3], x[4], x[5]};
-
-
-  // Build the problem.
-  Problem problem;
-
-
-    // Set up the cost function
-    struct CostFunctor {
-        std::vector<std::shared_ptr<kln::point>>& points;
-        std::vector<std::shared_ptr<kln::point>>& camera_points;
-        bool operator()(const double* const parameters, double* residuals) const {
-            // Set up a camera
-            kln::line biv_est = {parameters[0], parameters[1], parameters[2], 
-                                parameters[3], parameters[4], parameters[5]};
-            // kln::motor R_est = kln::exp(biv_est);
-            kln::motor R_est = outer_exp(biv_est);
-            // kln::motor R_est = cayley(biv_est);
-
-            // Calculate the reprojection error
-            residuals[0] = reprojection_error(R_est, this->points, this->camera_points);
-            return true;
+void configure_solver(const pose_solver_options& pose_options, Solver::Options& options){
+    /*
+    Copies the pose solver configuration onto the ceres solver options
+    */
+    options.num_threads = pose_options.num_threads;
+    options.linear_solver_type = pose_options.linear_solver_type;
+    options.trust_region_strategy_type = pose_options.trust_region_strategy_type;
+    options.max_num_iterations = pose_options.max_num_iterations;
+    options.function_tolerance = pose_options.function_tolerance;
+    options.gradient_tolerance = pose_options.gradient_tolerance;
+    options.parameter_tolerance = pose_options.parameter_tolerance;
+    options.minimizer_progress_to_stdout = pose_options.verbose;
+    options.logging_type = pose_options.verbose ? ceres::PER_MINIMIZER_ITERATION : ceres::SILENT;
+}
+
+
+int solver_iterations(const Solver::Summary& summary){
+    /*
+    Steps the solver took. Ceres records the starting point as iteration 0,
+    so a solve that stops there took none
+    */
+    return std::max(static_cast<int>(summary.iterations.size()) - 1, 0);
+}
+
+
+std::size_t residual_chunk_size(const pose_solver_options& pose_options, std::size_t n){
+    /*
+    Correspondences per residual block for a problem over n correspondences,
+    a robust loss needs one block per correspondence whatever the layout
+    */
+    std::size_t chunk_size = pose_options.chunk_size;
+    if (pose_options.layout == residual_layout::single_block){
+        chunk_size = n;
+    }
+    if (pose_options.layout == residual_layout::per_correspondence || pose_options.loss != robust_loss::none){
+        chunk_size = 1;
+    }
+    return std::max<std::size_t>(chunk_size, 1);
+}
+
+
+template <typename Chart>
+void fill_pose_result(const pose_solver_options& pose_options, const double* x, 
+                    const Solver::Summary& summary, pose_solver_result& result){
+    /*
+    Collects the solution and the solver summary into a pose result, x holds
+    the chart coordinates or the motor coefficients as per the parameterization
+    */
+    if (pose_options.parameterization == pose_parameterization::manifold){
+        double phi[6];
+        chart_inverse<Chart>(x, phi);
+        result.bivector = kln::line{static_cast<float>(phi[0]), static_cast<float>(phi[1]), static_cast<float>(phi[2]), 
+                                    static_cast<float>(phi[3]), static_cast<float>(phi[4]), static_cast<float>(phi[5])};
+        result.motor = kln::motor{static_cast<float>(x[0]), static_cast<float>(x[1]), static_cast<float>(x[2]), 
+                                  static_cast<float>(x[3]), static_cast<float>(x[4]), static_cast<float>(x[5]),
+                                  static_cast<float>(x[6]), static_cast<float>(x[7])};
+    }
+    else{
+        result.bivector = kln::line{static_cast<float>(x[0]), static_cast<float>(x[1]), static_cast<float>(x[2]), 
+                                    static_cast<float>(x[3]), static_cast<float>(x[4]), static_cast<float>(x[5])};
+        result.motor = chart_map<Chart>(result.bivector);
+    }
+    result.initial_cost = summary.initial_cost;
+    result.final_cost = summary.final_cost;
+    result.num_iterations = solver_iterations(summary);
+    result.termination_type = summary.termination_type;
+    result.usable = summary.IsSolutionUsable();
+}
+
+
+void fill_pose_result(const pose_solver_options& pose_options, const double* x, 
+                    const Solver::Summary& summary, pose_solver_result& result){
+    with_chart(pose_options.chart, [&](auto policy){
+        fill_pose_result<decltype(policy)>(pose_options, x, summary, result);
+    });
+}
+
+
+template <typename Chart>
+class chart_pose_solver_workspace {
+    /*
+    Scratch state for repeated pose refinements in a chart fixed at compile
+    time. The ceres problem, the parameter block and the cost functions are
+    kept between solves and rebound to each new set of correspondences
+    instead of being reallocated, and when consecutive solves have the same
+    number of correspondences and settings the residual blocks are left in
+    the problem as well. The chart field of the options is not read. A
+    workspace holds pointers into itself so it can not be copied or moved.
+    */
+public:
+    chart_pose_solver_workspace()
+        : problem_(problem_options())
+    {}
+
+    chart_pose_solver_workspace(const chart_pose_solver_workspace&) = delete;
+    chart_pose_solver_workspace& operator=(const chart_pose_solver_workspace&) = delete;
+
+    pose_solver_result solve(kln::line initial_biv,
+                            point_cloud_view points, 
+                            point_cloud_view camera_points,
+                            const pose_solver_options& pose_options){
+        if (pose_options.parameterization == pose_parameterization::manifold){
+            set_motor(chart_map<Chart>(initial_biv));
         }
-    };
-
-
-    // Set up the residual function
-    struct NumericDiffCostFunctor {
-        std::vector<std::shared_ptr<kln::point>>& points;
-        std::vector<std::shared_ptr<kln::point>>& camera_points;
-        bool operator()(const double* const parameters, double* residuals) const {
-            // Set up a camera
-            kln::line biv_est = {parameters[0], parameters[1], parameters[2], 
-                                parameters[3], parameters[4], parameters[5]};
-            // kln::motor R_est = kln::exp(biv_est);
-            kln::motor R_est = outer_exp(biv_est);
-            // kln::motor R_est = cayley(biv_est);
-
-            // Calculate the reprojection error
-            reprojection_residuals(R_est, this->points, this->camera_points, residuals);
-            return true;
+        else{
+            set_bivector(initial_biv);
         }
-    };
+        return refine(points, camera_points, pose_options);
+    }
 
-    // Make a cost function pointer that is then owned by the problem
-    CostFunction* cost_function =
-        new NumericDiffCostFunction<NumericDiffCostFunctor, ceres::CENTRAL, CERES_NPOINTS_2X, 6>(
-            new NumericDiffCostFunctor{points, camera_points});
-    
-    problem.AddResidualBlock(cost_function, nullptr, &x[0]);
+    pose_solver_result solve(const kln::motor& initial_motor,
+                            point_cloud_view points, 
+                            point_cloud_view camera_points,
+                            const pose_solver_options& pose_options){
+        /*
+        Starts from a motor rather than a bivector, which on the manifold
+        avoids going through the chart of a possibly large motion
+        */
+        if (pose_options.parameterization == pose_parameterization::manifold){
+            set_motor(initial_motor);
+        }
+        else{
+            set_bivector(chart_inverse_map<Chart>(initial_motor));
+        }
+        return refine(points, camera_points, pose_options);
+    }
 
+private:
+    void set_motor(const kln::motor& R){
+        x_[0] = R.scalar();
+        x_[1] = R.e23();
+        x_[2] = R.e31();
+        x_[3] = R.e12();
+        x_[4] = R.e01();
+        x_[5] = R.e02();
+        x_[6] = R.e03();
+        x_[7] = R.e0123();
+    }
 
+    void set_bivector(const kln::line& biv){
+        x_[0] = biv.e01();
+        x_[1] = biv.e02();
+        x_[2] = biv.e03();
+        x_[3] = biv.e23();
+        x_[4] = biv.e31();
+        x_[5] = biv.e12();
+    }
 
-     // Run the solver!
-    Solver::Options options;
-    options.minimizer_progress_to_stdout = true;
-    Solver::Summary summary;
-    Solve(options, &problem, &summary);
-    std::cout << summary.FullReport() << "\n";
-    std::cout << "x[0] : " << initial_x[0] << " -> " << x[0] << "\n";
-    std::cout << "x[1] : " << initial_x[1] << " -> " << x[1] << "\n";
-    std::cout << "x[2] : " << initial_x[2] << " -> " << x[2] << "\n";
-    std::cout << "x[3] : " << initial_x[3] << " -> " << x[3] << "\n";
-    std::cout << "x[4] : " << initial_x[4] << " -> " << x[4] << "\n";
-    std::cout << "x[5] : " << initial_x[5] << " -> " << x[5] << "\n";
+    pose_solver_result refine(point_cloud_view points, 
+                            point_cloud_view camera_points,
+                            const pose_solver_options& pose_options){
+        const pose_parameterization parameterization = pose_options.parameterization;
+        const std::size_t chunk_size = residual_chunk_size(pose_options, points.size());
+        const bool loss_changed = (pose_options.loss != loss_type_ || pose_options.loss_scale != loss_scale_);
+
+        // When the previous solve had the same blocks, as between the frames of
+        // a track, the residual blocks stay in the problem and only the
+        // correspondences their cost functions look at are swapped
+        const bool same_structure = problem_.HasParameterBlock(x_) && !loss_changed
+            && points.size() == num_points_ && chunk_size == chunk_size_
+            && parameterization == parameterization_;
+        if (same_structure){
+            std::size_t block = 0;
+            for (std::size_t offset=0; offset<points.size(); offset+=chunk_size, block++){
+                std::size_t n = std::min(chunk_size, points.size() - offset);
+                cost_functions_[block]->reset(points.subview(offset, n), camera_points.subview(offset, n), 
+                                              parameterization);
+            }
+        }
+        else{
+            // Clear out the previous problem, which also removes its residual blocks
+            if (problem_.HasParameterBlock(x_)){
+                problem_.RemoveParameterBlock(x_);
+            }
+            if (loss_changed){
+                loss_function_ = make_loss_function(pose_options.loss, pose_options.loss_scale);
+                loss_type_ = pose_options.loss;
+                loss_scale_ = pose_options.loss_scale;
+            }
+
+            // Rebind pooled cost functions to chunks of the correspondences
+            std::size_t block = 0;
+            for (std::size_t offset=0; offset<points.size(); offset+=chunk_size, block++){
+                std::size_t n = std::min(chunk_size, points.size() - offset);
+                if (block == cost_functions_.size()){
+                    cost_functions_.push_back(std::make_unique<ChartReprojectionCostFunction<Chart>>(
+                        points.subview(offset, n), camera_points.subview(offset, n), parameterization));
+                }
+                else{
+                    cost_functions_[block]->reset(points.subview(offset, n), camera_points.subview(offset, n), 
+                                                  parameterization);
+                }
+                problem_.AddResidualBlock(cost_functions_[block].get(), loss_function_.get(), x_);
+            }
+            if (parameterization == pose_parameterization::manifold){
+                problem_.SetManifold(x_, &manifold_);
+            }
+            num_points_ = points.size();
+            chunk_size_ = chunk_size;
+            parameterization_ = parameterization;
+        }
 
+        configure_solver(pose_options, options_);
+        Solve(options_, &problem_, &summary_);
+        if (pose_options.verbose){
+            std::cout << summary_.FullReport() << "\n";
+        }
 
+        pose_solver_result result;
+        fill_pose_result<Chart>(pose_options, x_, summary_, result);
+        return result;
+    }
 
-    // // Calculate the cost before and after optimisation
-    CostFunctor cost_tester = {points, camera_points};
-    double op;
-    cost_tester(initial_x, &op);
-    std::cout << "pre cost " << op << std::endl;
+    static Problem::Options problem_options(){
+        Problem::Options options;
+        options.cost_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+        options.loss_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+        options.manifold_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+        options.enable_fast_removal = true;
+        return options;
+    }
 
-    cost_tester(x, &op);
-    std::cout << "post cost " << op << std::endl;
+    std::vector<std::unique_ptr<ChartReprojectionCostFunction<Chart>>> cost_functions_;
+    std::unique_ptr<ceres::LossFunction> loss_function_;
+    robust_loss loss_type_ = robust_loss::none;
+    double loss_scale_ = 0.0;
+    Problem problem_;
+    Solver::Options options_;
+    Solver::Summary summary_;
+    MotorManifold<Chart> manifold_;
+    // Chart coordinates in the first six entries, or the motor coefficients
+    double x_[8] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+    // Shape of the residual blocks currently in the problem
+    std::size_t num_points_ = 0;
+    std::size_t chunk_size_ = 0;
+    pose_parameterization parameterization_ = pose_parameterization::chart;
+};
+
+
+class pose_solver_workspace {
+    /*
+    chart_pose_solver_workspace for the chart chosen in the options of each
+    solve. It keeps one per chart, so the chart is switched on once per
+    solve and a track that changes chart keeps both warm.
+    */
+public:
+    pose_solver_workspace() = default;
+
+    pose_solver_workspace(const pose_solver_workspace&) = delete;
+    pose_solver_workspace& operator=(const pose_solver_workspace&) = delete;
+
+    pose_solver_result solve(kln::line initial_biv,
+                            point_cloud_view points, 
+                            point_cloud_view camera_points,
+                            const pose_solver_options& pose_options){
+        return with_chart(pose_options.chart, [&](auto policy){
+            return workspace<decltype(policy)>().solve(initial_biv, points, camera_points, pose_options);
+        });
+    }
 
+    pose_solver_result solve(const kln::motor& initial_motor,
+                            point_cloud_view points, 
+                            point_cloud_view camera_points,
+                            const pose_solver_options& pose_options){
+        return with_chart(pose_options.chart, [&](auto policy){
+            return workspace<decltype(policy)>().solve(initial_motor, points, camera_points, pose_options);
+        });
+    }
+
+private:
+    template <typename Chart>
+    chart_pose_solver_workspace<Chart>& workspace(){
+        if constexpr (std::is_same_v<Chart, cayley_chart<se3>>){
+            return cayley_;
+        }
+        else{
+            return outer_exp_;
+        }
+    }
+
+    chart_pose_solver_workspace<outer_exp_chart<se3>> outer_exp_;
+    chart_pose_solver_workspace<cayley_chart<se3>> cayley_;
+};
+
+
+template <typename Chart>
+pose_solver_result find_camera(kln::line initial_biv,
+                point_cloud_view points,
+                point_cloud_view camera_points,
+                const pose_solver_options& pose_options=pose_solver_options()){
+    /*
+    Refines the camera motor in a chart policy fixed at compile time, for
+    example find_camera<exp_chart<se3>>. The chart is the template parameter
+    and the chart field of the options is not read, everything else, the
+    parameterization among it, applies as for the runtime chosen charts.
+    */
+    chart_pose_solver_workspace<Chart> workspace;
+    return workspace.solve(initial_biv, points, camera_points, pose_options);
+}
+
+
+pose_solver_result find_camera(kln::line initial_biv,
+                point_cloud_view points, 
+                point_cloud_view camera_points,
+                const pose_solver_options& pose_options=pose_solver_options()){
+    /*
+    Refines the camera motor, parameterised by a bivector in the chosen chart
+    or by its coefficients on the motor manifold, by minimising the
+    reprojection error of the correspondences. The residuals and their
+    jacobian are evaluated analytically in double precision.
+    Nothing is printed unless verbose is set.
+    */
+    return with_chart(pose_options.chart, [&](auto policy){
+        return find_camera<decltype(policy)>(initial_biv, points, camera_points, pose_options);
+    });
+}
+
+
+pose_solver_result find_camera(kln::line initial_biv,
+                std::vector<std::shared_ptr<kln::point>>& points, 
+                std::vector<std::shared_ptr<kln::point>>& camera_points,
+                const pose_solver_options& pose_options=pose_solver_options()){
 
+    point_cloud point_data = to_point_cloud(points);
+    point_cloud camera_data = to_point_cloud(camera_points);
+    return find_camera(initial_biv, point_data, camera_data, pose_options);
 }
 
 
+/// Camera model parameters refined together with the motor
+struct intrinsics_refinement {
+    bool focal_length = false;
+    bool skew = false;
+    bool principal_point = false;
+    // k1, k2 and k3
+    bool radial = false;
+    // p1 and p2
+    bool tangential = false;
+
+    bool any() const noexcept { return focal_length || skew || principal_point || radial || tangential; }
+
+    std::vector<int> constant_parameters() const {
+        /*
+        Indices into the camera_model parameters that stay fixed
+        */
+        std::vector<int> constant;
+        const bool refined[camera_model::num_parameters] = {focal_length, focal_length, skew,
+                                                            principal_point, principal_point,
+                                                            radial, radial, radial, tangential, tangential};
+        for (int i=0; i<camera_model::num_parameters; i++){
+            if (!refined[i]){
+                constant.push_back(i);
+            }
+        }
+        return constant;
+    }
+};
+
+
+pose_solver_result find_camera(kln::line initial_biv,
+                camera_model& model,
+                point_cloud_view points, 
+                point_cloud_view pixel_points,
+                const pose_solver_options& pose_options=pose_solver_options(),
+                const intrinsics_refinement& refinement=intrinsics_refinement()){
+    /*
+    Refines the camera motor against raw pixel observations through the full
+    camera model, optionally calibrating the selected camera parameters at the
+    same time, in which case model is updated with the refined values.
+    The loss scale is in pixels here.
+    */
+    double x[8] = {initial_biv.e01(), initial_biv.e02(), initial_biv.e03(),
+                   initial_biv.e23(), initial_biv.e31(), initial_biv.e12(), 0.0, 0.0};
+    if (pose_options.parameterization == pose_parameterization::manifold){
+        kln::motor R = chart_motor(pose_options.chart, initial_biv);
+        const double coefficients[8] = {R.scalar(), R.e23(), R.e31(), R.e12(), R.e01(), R.e02(), R.e03(), R.e0123()};
+        std::copy(coefficients, coefficients + 8, x);
+    }
+    double camera[camera_model::num_parameters];
+    model.to_parameters(camera);
+
+    Problem problem;
+    const std::size_t chunk_size = residual_chunk_size(pose_options, points.size());
+    for (std::size_t offset=0; offset<points.size(); offset+=chunk_size){
+        std::size_t n = std::min(chunk_size, points.size() - offset);
+        problem.AddResidualBlock(new PixelReprojectionCostFunction(points.subview(offset, n), 
+                                                                   pixel_points.subview(offset, n),
+                                                                   pose_options.chart,
+                                                                   pose_options.parameterization),
+                                make_loss_function(pose_options.loss, pose_options.loss_scale).release(),
+                                x, camera);
+    }
+    if (pose_options.parameterization == pose_parameterization::manifold){
+        problem.SetManifold(x, make_motor_manifold(pose_options.chart));
+    }
+    if (!refinement.any()){
+        problem.SetParameterBlockConstant(camera);
+    }
+    else{
+        std::vector<int> constant = refinement.constant_parameters();
+        if (!constant.empty()){
+            problem.SetManifold(camera, new ceres::SubsetManifold(camera_model::num_parameters, constant));
+        }
+    }
 
+    Solver::Options options;
+    Solver::Summary summary;
+    configure_solver(pose_options, options);
+    Solve(options, &problem, &summary);
+    if (pose_options.verbose){
+        std::cout << summary.FullReport() << "\n";
+    }
 
+    pose_solver_result result;
+    fill_pose_result(pose_options, x, summary, result);
+    if (refinement.any() && result.usable){
+        model.from_parameters(camera);
+    }
+    return result;
+}
@@ -0,0 +1,765 @@
+#pragma once
+
+#include <cmath>
+#include <klein/klein.hpp>
+#include "batched_maps.h"
+#include "simd_batch.h"
+
+
+/*
+Compile time chart policies. Each of exp_chart, outer_exp_chart and
+cayley_chart is specialised for so3, rotors, and se3, motors, and provides
+
+    map(phi, motor)                    the chart
+    inverse(motor, phi)                its inverse
+    kinematic(cross, phi, omega, phi') the rate of the chart coordinates of
+                                       a body moving with velocity omega,
+                                       cross is -1 for body frame velocities,
+                                       R' = R omega/2, and +1 for spatial
+                                       ones, R' = omega R/2
+    jacobian(phi, motor, jacobian)     the chart and its derivative in double
+
+over coefficient arrays in the orders of the group below, written against
+the SIMD batch types so code templated on a policy gets one specialised
+loop per chart. The so3 policies are the se3 ones restricted to the
+euclidean bivector and rotor coefficients rather than a second copy of
+every formula. The exponential needs trigonometric functions and so only
+runs on scalar_batch, which its vectorized flag records. with_chart turns
+a motor_chart chosen at runtime into its se3 policy once, so callers that
+take the chart as a value still run the loops specialised for it, and the
+klein overloads in cayley.h and outer_exp.h are the policies applied to a
+single bivector or motor.
+
+Writing phi = u + w with u the ideal and w the euclidean part, t = |w| and
+D(x) for the commutator (w x v + u x a, w x a) of phi with x = v + a, the
+exponential chart is
+
+    exp(phi) = cos t + f w + f u + g (u.w) w + f (u.w) e0123
+    phi'     = (omega + cross D(omega) + c2 D^2(omega) + c4 D^4(omega))/2
+
+with f = sin(t)/t, g = (cos(t) - f)/t^2, c2 = p + 2 c4 t^2,
+c4 = -(t cot(t) - 1 + t^2 p)/t^4 and p = (1/sin(t)^2 - cot(t)/t)/2, the
+closed form of the inverse of its differential.
+*/
+
+
+/// Rotations, bivectors {e23, e31, e12} and rotors {scalar, e23, e31, e12}
+struct so3 {
+    static constexpr int dimension = 3;
+    static constexpr int motor_size = 4;
+    using bivector = kln::branch;
+    using motor = kln::rotor;
+
+    static void coefficients(kln::branch const& phi, float out[3]){
+        out[0] = phi.e23();
+        out[1] = phi.e31();
+        out[2] = phi.e12();
+    }
+
+    static void coefficients(kln::rotor const& R, float out[4]){
+        out[0] = R.scalar();
+        out[1] = R.e23();
+        out[2] = R.e31();
+        out[3] = R.e12();
+    }
+
+    static kln::branch make_bivector(const float phi[3]){
+        return kln::branch{phi[0], phi[1], phi[2]};
+    }
+
+    static kln::rotor make_motor(const float R[4]){
+        kln::rotor out;
+        out.p1_ = _mm_set_ps(R[3], R[2], R[1], R[0]);
+        return out;
+    }
+};
+
+
+/// Rigid motions, bivectors {e01, e02, e03, e23, e31, e12} and motors
+/// {scalar, e23, e31, e12, e01, e02, e03, e0123}
+struct se3 {
+    static constexpr int dimension = 6;
+    static constexpr int motor_size = 8;
+    using bivector = kln::line;
+    using motor = kln::motor;
+
+    static void coefficients(kln::line const& phi, float out[6]){
+        out[0] = phi.e01();
+        out[1] = phi.e02();
+        out[2] = phi.e03();
+        out[3] = phi.e23();
+        out[4] = phi.e31();
+        out[5] = phi.e12();
+    }
+
+    static void coefficients(kln::motor const& R, float out[8]){
+        out[0] = R.scalar();
+        out[1] = R.e23();
+        out[2] = R.e31();
+        out[3] = R.e12();
+        out[4] = R.e01();
+        out[5] = R.e02();
+        out[6] = R.e03();
+        out[7] = R.e0123();
+    }
+
+    static kln::line make_bivector(const float phi[6]){
+        return kln::line{phi[0], phi[1], phi[2], phi[3], phi[4], phi[5]};
+    }
+
+    static kln::motor make_motor(const float R[8]){
+        return kln::motor{R[0], R[1], R[2], R[3], R[4], R[5], R[6], R[7]};
+    }
+};
+
+
+template <typename V>
+void commutator(const V phi[6], const V x[6], V out[6]){
+    /*
+    D(x) = (w x v + u x a, w x a) for phi = u + w and x = v + a
+    */
+    const V* u = phi;
+    const V* w = phi + 3;
+    const V* v = x;
+    const V* a = x + 3;
+    out[0] = w[1]*v[2] - w[2]*v[1] + u[1]*a[2] - u[2]*a[1];
+    out[1] = w[2]*v[0] - w[0]*v[2] + u[2]*a[0] - u[0]*a[2];
+    out[2] = w[0]*v[1] - w[1]*v[0] + u[0]*a[1] - u[1]*a[0];
+    out[3] = w[1]*a[2] - w[2]*a[1];
+    out[4] = w[2]*a[0] - w[0]*a[2];
+    out[5] = w[0]*a[1] - w[1]*a[0];
+}
+
+
+template <typename T>
+void exp_chart_coefficients(T t2, T& f, T& g){
+    /*
+    f = sin(t)/t and g = (cos(t) - f)/t^2, from their series for small t
+    */
+    using std::sqrt;
+    using std::sin;
+    using std::cos;
+    if (t2 < T(1e-2)){
+        f = T(1.0) - t2/T(6.0) + t2*t2/T(120.0);
+        g = T(-1.0/3.0) + t2/T(30.0) - t2*t2/T(840.0);
+    }
+    else{
+        T t = sqrt(t2);
+        f = sin(t)/t;
+        g = (cos(t) - f)/t2;
+    }
+}
+
+
+template <typename T>
+void screw_exp(const T phi[6], T motor[8]){
+    using std::cos;
+    using std::sqrt;
+    const T* u = phi;
+    const T* w = phi + 3;
+    const T t2 = w[0]*w[0] + w[1]*w[1] + w[2]*w[2];
+    const T q = u[0]*w[0] + u[1]*w[1] + u[2]*w[2];
+    T f, g;
+    exp_chart_coefficients(t2, f, g);
+    motor[0] = cos(sqrt(t2));
+    for (int i=0; i<3; i++){
+        motor[1 + i] = f*w[i];
+        motor[4 + i] = f*u[i] + g*q*w[i];
+    }
+    motor[7] = f*q;
+}
+
+
+template <typename T>
+void screw_log(const T motor[8], T phi[6]){
+    /*
+    Inverse of screw_exp, the motor is taken with non negative scalar part
+    */
+    using std::atan2;
+    using std::sqrt;
+    const T sign = (motor[0] < T(0.0)) ? T(-1.0) : T(1.0);
+    const T* b = motor + 1;
+    const T* e = motor + 4;
+    const T t = atan2(sqrt(b[0]*b[0] + b[1]*b[1] + b[2]*b[2]), sign*motor[0]);
+    T f, g;
+    exp_chart_coefficients(t*t, f, g);
+    T* u = phi;
+    T* w = phi + 3;
+    const T inv = sign/f;
+    for (int i=0; i<3; i++){
+        w[i] = inv*b[i];
+    }
+    const T q = inv*motor[7];
+    for (int i=0; i<3; i++){
+        u[i] = inv*e[i] - (g*q/f)*w[i];
+    }
+}
+
+
+template <typename T>
+void screw_exp_kinematic(T cross, const T phi[6], const T omega[6], T phi_dot[6]){
+    using std::sin;
+    using std::tan;
+    using std::sqrt;
+    const T* w = phi + 3;
+    const T t2 = w[0]*w[0] + w[1]*w[1] + w[2]*w[2];
+    T c2, c4;
+    if (t2 < T(1e-2)){
+        c2 = T(1.0/3.0) - T(2.0/945.0)*t2*t2;
+        c4 = T(-1.0/45.0) - T(4.0/945.0)*t2;
+    }
+    else{
+        const T t = sqrt(t2);
+        const T s = sin(t);
+        const T t_cot = t/tan(t);
+        const T p = T(0.5)*(T(1.0)/(s*s) - t_cot/t2);
+        c4 = -(t_cot - T(1.0) + t2*p)/(t2*t2);
+        c2 = p + T(2.0)*c4*t2;
+    }
+    T d1[6], d2[6], d3[6], d4[6];
+    commutator(phi, omega, d1);
+    commutator(phi, d1, d2);
+    commutator(phi, d2, d3);
+    commutator(phi, d3, d4);
+    for (int i=0; i<6; i++){
+        phi_dot[i] = T(0.5)*(omega[i] + cross*d1[i] + c2*d2[i] + c4*d4[i]);
+    }
+}
+
+
+void screw_exp_jacobian(const double phi[6], double motor[8], double jacobian[48]){
+    /*
+    Closed form se3 exponential and its row major 8x6 derivative. With
+    df/dw = g w and dg/dw = h w, h = -(f + 3g)/t^2
+    */
+    const double* u = phi;
+    const double* w = phi + 3;
+    const double t2 = w[0]*w[0] + w[1]*w[1] + w[2]*w[2];
+    const double q = u[0]*w[0] + u[1]*w[1] + u[2]*w[2];
+    double f, g;
+    exp_chart_coefficients(t2, f, g);
+    const double h = (t2 < 1e-2) ? 1.0/15.0 - t2/210.0 : -(f + 3.0*g)/t2;
+    screw_exp(phi, motor);
+
+    for (int k=0; k<3; k++){
+        // Scalar
+        jacobian[k] = 0.0;
+        jacobian[3 + k] = -f*w[k];
+        for (int i=0; i<3; i++){
+            double delta = (i == k) ? 1.0 : 0.0;
+            // Euclidean bivector part
+            jacobian[6*(1 + i) + k] = 0.0;
+            jacobian[6*(1 + i) + 3 + k] = f*delta + g*w[i]*w[k];
+            // Ideal bivector part
+            jacobian[6*(4 + i) + k] = f*delta + g*w[i]*w[k];
+            jacobian[6*(4 + i) + 3 + k] = g*w[k]*u[i] + (g*u[k] + h*q*w[k])*w[i] + g*q*delta;
+        }
+        // Pseudoscalar
+        jacobian[42 + k] = f*w[k];
+        jacobian[45 + k] = g*q*w[k] + f*u[k];
+    }
+}
+
+
+void outer_exp_jacobian(const double phi[6], double motor[8], double jacobian[48]){
+    /*
+    Closed form se3 outer exponential and its derivative with respect to the six
+    bivector coefficients. phi is ordered as {e01, e02, e03, e23, e31, e12},
+    motor as {scalar, e23, e31, e12, e01, e02, e03, e0123} and the jacobian is
+    row major 8x6. Writing phi = u + w with u the ideal and w the euclidean part,
+    outer_exp(phi) = (1 + u + w + (u.w)e0123)/sqrt(1 + w.w)
+    */
+    const double* u = phi;
+    const double* w = phi + 3;
+    double s = 1.0/std::sqrt(1.0 + w[0]*w[0] + w[1]*w[1] + w[2]*w[2]);
+    double s3 = s*s*s;
+    double q = u[0]*w[0] + u[1]*w[1] + u[2]*w[2];
+
+    motor[0] = s;
+    motor[1] = s*w[0];
+    motor[2] = s*w[1];
+    motor[3] = s*w[2];
+    motor[4] = s*u[0];
+    motor[5] = s*u[1];
+    motor[6] = s*u[2];
+    motor[7] = s*q;
+
+    for (int k=0; k<3; k++){
+        // Scalar
+        jacobian[k] = 0.0;
+        jacobian[3 + k] = -s3*w[k];
+        for (int i=0; i<3; i++){
+            double delta = (i == k) ? 1.0 : 0.0;
+            // Euclidean bivector part
+            jacobian[6*(1 + i) + k] = 0.0;
+            jacobian[6*(1 + i) + 3 + k] = s*delta - s3*w[i]*w[k];
+            // Ideal bivector part
+            jacobian[6*(4 + i) + k] = s*delta;
+            jacobian[6*(4 + i) + 3 + k] = -s3*u[i]*w[k];
+        }
+        // Pseudoscalar
+        jacobian[42 + k] = s*w[k];
+        jacobian[45 + k] = s*u[k] - s3*q*w[k];
+    }
+}
+
+
+void cayley_jacobian(const double phi[6], double motor[8], double jacobian[48]){
+    /*
+    Closed form se3 cayley map and its derivative with respect to the six
+    bivector coefficients. phi is ordered as {e01, e02, e03, e23, e31, e12},
+    motor as {scalar, e23, e31, e12, e01, e02, e03, e0123} and the jacobian is
+    row major 8x6. Writing phi = u + w with u the ideal and w the euclidean part
+    and d = 1 + w.w, expanding the simplified map gives
+    ((1 - w.w)d + 2d(u + w) - 4(u.w)w + 4(u.w)e0123)/(d*d)
+    */
+    const double* u = phi;
+    const double* w = phi + 3;
+    double d = 1.0 + w[0]*w[0] + w[1]*w[1] + w[2]*w[2];
+    double d2 = d*d;
+    double d3 = d2*d;
+    double q = u[0]*w[0] + u[1]*w[1] + u[2]*w[2];
+
+    motor[0] = (2.0 - d)/d;
+    motor[1] = 2.0*w[0]/d;
+    motor[2] = 2.0*w[1]/d;
+    motor[3] = 2.0*w[2]/d;
+    motor[4] = 2.0*u[0]/d - 4.0*q*w[0]/d2;
+    motor[5] = 2.0*u[1]/d - 4.0*q*w[1]/d2;
+    motor[6] = 2.0*u[2]/d - 4.0*q*w[2]/d2;
+    motor[7] = 4.0*q/d2;
+
+    for (int k=0; k<3; k++){
+        // Scalar
+        jacobian[k] = 0.0;
+        jacobian[3 + k] = -4.0*w[k]/d2;
+        for (int i=0; i<3; i++){
+            double delta = (i == k) ? 1.0 : 0.0;
+            // Euclidean bivector part
+            jacobian[6*(1 + i) + k] = 0.0;
+            jacobian[6*(1 + i) + 3 + k] = 2.0*delta/d - 4.0*w[i]*w[k]/d2;
+            // Ideal bivector part
+            jacobian[6*(4 + i) + k] = 2.0*delta/d - 4.0*w[i]*w[k]/d2;
+            jacobian[6*(4 + i) + 3 + k] = -4.0*(u[i]*w[k] + u[k]*w[i] + q*delta)/d2 
+                                          + 16.0*q*w[i]*w[k]/d3;
+        }
+        // Pseudoscalar
+        jacobian[42 + k] = 4.0*w[k]/d2;
+        jacobian[45 + k] = 4.0*u[k]/d2 - 16.0*q*w[k]/d3;
+    }
+}
+
+
+template <typename Group>
+struct exp_chart;
+
+template <typename Group>
+struct outer_exp_chart;
+
+template <typename Group>
+struct cayley_chart;
+
+
+template <>
+struct exp_chart<se3> {
+    using group = se3;
+    static constexpr bool vectorized = false;
+    // The chart coordinates of exp(x/2) are step_scale*x to first order
+    static constexpr float step_scale = 0.5f;
+
+    template <typename V>
+    static void map(const V phi[6], V motor[8]){
+        static_assert(V::width == 1, "the exponential chart only runs on scalar_batch");
+        using T = decltype(phi[0].v);
+        T x[6], y[8];
+        for (int i=0; i<6; i++){
+            x[i] = phi[i].v;
+        }
+        screw_exp(x, y);
+        for (int i=0; i<8; i++){
+            motor[i] = {y[i]};
+        }
+    }
+
+    template <typename V>
+    static void inverse(const V motor[8], V phi[6]){
+        static_assert(V::width == 1, "the exponential chart only runs on scalar_batch");
+        using T = decltype(motor[0].v);
+        T x[8], y[6];
+        for (int i=0; i<8; i++){
+            x[i] = motor[i].v;
+        }
+        screw_log(x, y);
+        for (int i=0; i<6; i++){
+            phi[i] = {y[i]};
+        }
+    }
+
+    template <typename V>
+    static void kinematic(const V& cross, const V phi[6], const V omega[6], V phi_dot[6]){
+        static_assert(V::width == 1, "the exponential chart only runs on scalar_batch");
+        using T = decltype(phi[0].v);
+        T x[6], v[6], y[6];
+        for (int i=0; i<6; i++){
+            x[i] = phi[i].v;
+            v[i] = omega[i].v;
+        }
+        screw_exp_kinematic(cross.v, x, v, y);
+        for (int i=0; i<6; i++){
+            phi_dot[i] = {y[i]};
+        }
+    }
+
+    static void jacobian(const double phi[6], double motor[8], double jacobian[48]){
+        screw_exp_jacobian(phi, motor, jacobian);
+    }
+};
+
+
+template <>
+struct outer_exp_chart<se3> {
+    using group = se3;
+    static constexpr bool vectorized = true;
+    static constexpr float step_scale = 0.5f;
+
+    template <typename V>
+    static void map(const V phi[6], V motor[8]){
+        outer_exp_map::apply(phi, motor);
+    }
+
+    template <typename V>
+    static void inverse(const V motor[8], V phi[6]){
+        outer_log_map::apply(motor, phi);
+    }
+
+    template <typename V>
+    static void kinematic(const V& cross, const V phi[6], const V omega[6], V phi_dot[6]){
+        /*
+        Spatial frame this is outer_exp_kinematic
+        */
+        const V* u = phi;
+        const V* w = phi + 3;
+        const V* a = omega + 3;
+        const V half = V::broadcast(0.5f);
+        const V half_cross = half*cross;
+        const V half_wa = half*(w[0]*a[0] + w[1]*a[1] + w[2]*a[2]);
+        const V half_uw = half*(u[0]*w[0] + u[1]*w[1] + u[2]*w[2]);
+        V d[6];
+        commutator(phi, omega, d);
+        for (int i=0; i<3; i++){
+            phi_dot[i] = half*omega[i] + half_cross*d[i] - half_uw*a[i] + half_wa*u[i];
+            phi_dot[3 + i] = half*a[i] + half_cross*d[3 + i] + half_wa*w[i];
+        }
+    }
+
+    static void jacobian(const double phi[6], double motor[8], double jacobian[48]){
+        outer_exp_jacobian(phi, motor, jacobian);
+    }
+};
+
+
+template <>
+struct cayley_chart<se3> {
+    using group = se3;
+    static constexpr bool vectorized = true;
+    static constexpr float step_scale = 0.25f;
+
+    template <typename V>
+    static void map(const V phi[6], V motor[8]){
+        cayley_map::apply(phi, motor);
+    }
+
+    template <typename V>
+    static void inverse(const V motor[8], V phi[6]){
+        cayley_inverse_map::apply(motor, phi);
+    }
+
+    template <typename V>
+    static void kinematic(const V& cross, const V phi[6], const V omega[6], V phi_dot[6]){
+        /*
+        Body frame this is cayley_kinematic
+        */
+        const V* u = phi;
+        const V* w = phi + 3;
+        const V* v = omega;
+        const V* a = omega + 3;
+        const V quarter = V::broadcast(0.25f);
+        const V half = V::broadcast(0.5f);
+        const V scale = quarter*(V::broadcast(1.0f) - (w[0]*w[0] + w[1]*w[1] + w[2]*w[2]));
+        const V half_cross = half*cross;
+        const V half_wa = half*(w[0]*a[0] + w[1]*a[1] + w[2]*a[2]);
+        const V half_uw = half*(u[0]*w[0] + u[1]*w[1] + u[2]*w[2]);
+        const V half_ua_wv = half*(u[0]*a[0] + u[1]*a[1] + u[2]*a[2] + w[0]*v[0] + w[1]*v[1] + w[2]*v[2]);
+        V d[6];
+        commutator(phi, omega, d);
+        for (int i=0; i<3; i++){
+            phi_dot[i] = scale*v[i] + half_cross*d[i] - half_uw*a[i] + half_ua_wv*w[i] + half_wa*u[i];
+            phi_dot[3 + i] = scale*a[i] + half_cross*d[3 + i] + half_wa*w[i];
+        }
+    }
+
+    static void jacobian(const double phi[6], double motor[8], double jacobian[48]){
+        cayley_jacobian(phi, motor, jacobian);
+    }
+};
+
+
+template <template <typename> class Chart>
+struct so3_restriction {
+    /*
+    A chart on rotors as its se3 counterpart with the ideal coefficients zero
+    */
+    using group = so3;
+    static constexpr bool vectorized = Chart<se3>::vectorized;
+    static constexpr float step_scale = Chart<se3>::step_scale;
+
+    template <typename V>
+    static void map(const V phi[3], V rotor[4]){
+        const V zero = V::broadcast(0.0f);
+        const V x[6] = {zero, zero, zero, phi[0], phi[1], phi[2]};
+        V motor[8];
+        Chart<se3>::map(x, motor);
+        for (int i=0; i<4; i++){
+            rotor[i] = motor[i];
+        }
+    }
+
+    template <typename V>
+    static void inverse(const V rotor[4], V phi[3]){
+        const V zero = V::broadcast(0.0f);
+        const V motor[8] = {rotor[0], rotor[1], rotor[2], rotor[3], zero, zero, zero, zero};
+        V x[6];
+        Chart<se3>::inverse(motor, x);
+        for (int i=0; i<3; i++){
+            phi[i] = x[3 + i];
+        }
+    }
+
+    template <typename V>
+    static void kinematic(const V& cross, const V phi[3], const V omega[3], V phi_dot[3]){
+        const V zero = V::broadcast(0.0f);
+        const V x[6] = {zero, zero, zero, phi[0], phi[1], phi[2]};
+        const V v[6] = {zero, zero, zero, omega[0], omega[1], omega[2]};
+        V y[6];
+        Chart<se3>::kinematic(cross, x, v, y);
+        for (int i=0; i<3; i++){
+            phi_dot[i] = y[3 + i];
+        }
+    }
+
+    static void jacobian(const double phi[3], double rotor[4], double jacobian[12]){
+        const double x[6] = {0.0, 0.0, 0.0, phi[0], phi[1], phi[2]};
+        double motor[8];
+        double full[48];
+        Chart<se3>::jacobian(x, motor, full);
+        for (int i=0; i<4; i++){
+            rotor[i] = motor[i];
+            for (int k=0; k<3; k++){
+                jacobian[3*i + k] = full[6*i + 3 + k];
+            }
+        }
+    }
+};
+
+
+template <>
+struct exp_chart<so3> : so3_restriction<exp_chart> {};
+
+template <>
+struct outer_exp_chart<so3> : so3_restriction<outer_exp_chart> {};
+
+template <>
+struct cayley_chart<so3> : so3_restriction<cayley_chart> {};
+
+
+template <typename Chart>
+struct policy_map {
+    /*
+    The chart of a policy in the shape apply_map expects
+    */
+    static constexpr int num_inputs = Chart::group::dimension;
+    static constexpr int num_outputs = Chart::group::motor_size;
+
+    template <typename V>
+    static void apply(const V phi[], V motor[]){
+        Chart::map(phi, motor);
+    }
+};
+
+
+template <typename Chart>
+struct policy_inverse_map {
+    /*
+    The inverse chart of a policy in the shape apply_map expects
+    */
+    static constexpr int num_inputs = Chart::group::motor_size;
+    static constexpr int num_outputs = Chart::group::dimension;
+
+    template <typename V>
+    static void apply(const V motor[], V phi[]){
+        Chart::inverse(motor, phi);
+    }
+};
+
+
+template <typename F>
+decltype(auto) with_chart(motor_chart chart, F&& f){
+    /*
+    Calls f with a default constructed se3 policy of the chart chosen at
+    runtime, so code holding a motor_chart switches once and then runs the
+    loop instantiated for that policy, f(cayley_chart<se3>()) for example
+    */
+    if (chart == motor_chart::cayley){
+        return f(cayley_chart<se3>());
+    }
+    return f(outer_exp_chart<se3>());
+}
+
+
+template <typename T>
+void chart_motor(motor_chart chart, const T phi[6], T motor[8]){
+    /*
+    Motor of the bivector coefficients phi in the chosen chart, evaluated in T
+    */
+    with_chart(chart, [&](auto policy){
+        apply_map_scalar<policy_map<decltype(policy)>>(phi, motor);
+    });
+}
+
+
+template <typename T>
+void chart_bivector(motor_chart chart, const T motor[8], T phi[6]){
+    /*
+    Bivector coefficients of a motor in the chosen chart, the inverse of
+    chart_motor, evaluated in T
+    */
+    with_chart(chart, [&](auto policy){
+        apply_map_scalar<policy_inverse_map<decltype(policy)>>(motor, phi);
+    });
+}
+
+
+template <typename Chart>
+typename Chart::group::motor chart_map(typename Chart::group::bivector const& phi){
+    /*
+    The chart applied to a klein bivector
+    */
+    using Group = typename Chart::group;
+    using V = scalar_batch<float>;
+    float x[Group::dimension];
+    float y[Group::motor_size];
+    V in[Group::dimension];
+    V out[Group::motor_size];
+    Group::coefficients(phi, x);
+    for (int i=0; i<Group::dimension; i++){
+        in[i] = {x[i]};
+    }
+    Chart::map(in, out);
+    for (int i=0; i<Group::motor_size; i++){
+        y[i] = out[i].v;
+    }
+    return Group::make_motor(y);
+}
+
+
+template <typename Chart>
+typename Chart::group::bivector chart_inverse_map(typename Chart::group::motor const& R){
+    /*
+    The inverse chart applied to a klein rotor or motor
+    */
+    using Group = typename Chart::group;
+    using V = scalar_batch<float>;
+    float x[Group::motor_size];
+    float y[Group::dimension];
+    V in[Group::motor_size];
+    V out[Group::dimension];
+    Group::coefficients(R, x);
+    for (int i=0; i<Group::motor_size; i++){
+        in[i] = {x[i]};
+    }
+    Chart::inverse(in, out);
+    for (int i=0; i<Group::dimension; i++){
+        y[i] = out[i].v;
+    }
+    return Group::make_bivector(y);
+}
+
+
+template <typename Chart>
+typename Chart::group::bivector chart_kinematic_map(float cross, typename Chart::group::bivector const& phi,
+                                                    typename Chart::group::bivector const& omega){
+    /*
+    Rate of the chart coordinates of a body at phi moving with velocity
+    omega, cross is -1 for body frame and +1 for spatial velocities
+    */
+    using Group = typename Chart::group;
+    using V = scalar_batch<float>;
+    float x[Group::dimension];
+    float v[Group::dimension];
+    float y[Group::dimension];
+    V in[Group::dimension];
+    V velocity[Group::dimension];
+    V out[Group::dimension];
+    Group::coefficients(phi, x);
+    Group::coefficients(omega, v);
+    for (int i=0; i<Group::dimension; i++){
+        in[i] = {x[i]};
+        velocity[i] = {v[i]};
+    }
+    Chart::kinematic(V::broadcast(cross), in, velocity, out);
+    for (int i=0; i<Group::dimension; i++){
+        y[i] = out[i].v;
+    }
+    return Group::make_bivector(y);
+}
+
+
+template <typename Chart>
+typename Chart::group::bivector chart_body_kinematic(typename Chart::group::bivector const& phi,
+                                                     typename Chart::group::bivector const& omega){
+    /*
+    Rate of the chart coordinates of a body at phi moving with body frame
+    velocity omega, R' = R omega/2
+    */
+    return chart_kinematic_map<Chart>(-1.0f, phi, omega);
+}
+
+
+template <typename Chart>
+typename Chart::group::bivector chart_spatial_kinematic(typename Chart::group::bivector const& phi,
+                                                        typename Chart::group::bivector const& omega){
+    /*
+    Rate of the chart coordinates of a body at phi moving with spatial
+    velocity omega, R' = omega R/2
+    */
+    return chart_kinematic_map<Chart>(1.0f, phi, omega);
+}
+
+
+template <typename Chart, typename V>
+void chart_rk4_kernel(const V& cross, const V& dt, V phi[], const V omega[]){
+    /*
+    One classic fourth order Runge-Kutta step of the chart kinematics
+    */
+    constexpr int N = Chart::group::dimension;
+    const V half_dt = V::broadcast(0.5f)*dt;
+    const V two = V::broadcast(2.0f);
+    V k1[N], k2[N], k3[N], k4[N], x[N];
+    Chart::kinematic(cross, phi, omega, k1);
+    for (int i=0; i<N; i++){
+        x[i] = phi[i] + half_dt*k1[i];
+    }
+    Chart::kinematic(cross, x, omega, k2);
+    for (int i=0; i<N; i++){
+        x[i] = phi[i] + half_dt*k2[i];
+    }
+    Chart::kinematic(cross, x, omega, k3);
+    for (int i=0; i<N; i++){
+        x[i] = phi[i] + dt*k3[i];
+    }
+    Chart::kinematic(cross, x, omega, k4);
+    const V sixth_dt = dt/V::broadcast(6.0f);
+    for (int i=0; i<N; i++){
+        phi[i] = phi[i] + sixth_dt*(k1[i] + two*(k2[i] + k3[i]) + k4[i]);
+    }
+}
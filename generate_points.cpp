@@ -1,13 +1,17 @@
 
 #include <memory>
+#include <algorithm>
+#include <string>
 #include <random>
-#include <fstream>
 #include <iostream>
 #include "klein/klein.hpp"
 #include "klein_ops.h"
 #include "cayley.h"
 #include "outer_exp.h"
+#include "point_cloud.h"
 #include "camera_ops.h"
+#include "pnp.h"
+#include "point_io.h"
 
 
 
@@ -35,47 +39,57 @@ void generate_random_points(std::vector<std::shared_ptr<kln::point>>& points,
 }
 
 
-void write_points(std::ofstream& file, std::vector<std::shared_ptr<kln::point>>& points){
-    std::cout << points.size() << std::endl;
-    for (std::size_t i=0; i < points.size(); i++){
-        file << points[i]->x() <<','<< points[i]->y() <<','<< points[i]->z() << std::endl;
+void generate_random_points(point_cloud& points, 
+        unsigned int npoints, 
+        std::default_random_engine& generator=default_generator){
+    float array[3];
+    points.reserve(points.size() + npoints);
+    for (std::size_t i=0; i < npoints; i++){
+        random_point(array, generator);
+        points.push_back(array[0], array[1], array[2]);
     }
 }
 
 
+int main(int argc, char** argv){
 
-int main(){
-
-    const unsigned int npoints = CERES_NPOINTS_2X/2;
-
-    std::ofstream output_stream;
-    output_stream.open("200.txt");
+    // The number of correspondences is only known at runtime
+    const unsigned int npoints = (argc > 1) ? std::stoul(argv[1]) : 200;
+    const std::string path = (argc > 2) ? argv[2] : "points.kkp";
 
     // Generate a load of points
-    std::vector<std::shared_ptr<kln::point>> points;
-    points.reserve(npoints);
-    generate_random_points(points, npoints);
-
-    std::cout << points.size() << std::endl;
-
-    // Write the points to file
-    write_points(output_stream, points);
-    output_stream.close();
-
+    point_cloud generated_points;
+    generate_random_points(generated_points, npoints);
 
+    std::cout << generated_points.size() << std::endl;
 
     // Set up a true camera
     kln::line biv_cam{0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 3.0f};
     kln::motor R = kln::exp(biv_cam);
 
     // Project the points into that camera
-    std::vector<std::shared_ptr<kln::point>> camera_points;
-    camera_points.reserve(points.size()); 
-    project_to_camera(R, points, camera_points);
-    for (std::size_t i=0; i<camera_points.size(); i++){
-        camera_points[i]->normalize();
+    point_cloud generated_camera_points;
+    project_to_camera(R, generated_points, generated_camera_points);
+    generated_camera_points.normalize();
+
+    // Write the correspondences to file, in a single chunk so that the
+    // mapping below can hand all of them to the solver at once
+    point_file_writer writer(path, point_file_layout::correspondences, std::max(npoints, 1u));
+    writer.write(generated_points, generated_camera_points);
+    if (!writer.close()){
+        std::cerr << "could not write " << path << std::endl;
+        return 1;
     }
 
+    // Everything from here on reads straight out of the mapped file
+    mapped_point_file file(path);
+    if (!file.is_open() || !file.verify()){
+        std::cerr << "could not read " << path << std::endl;
+        return 1;
+    }
+    point_cloud_view points = file.points();
+    point_cloud_view camera_points = file.camera_points();
+
     // Assert that there is no reprojection error with the true camera
     auto output = reprojection_error(R, points, camera_points);
     std::cout << output << std::endl;
@@ -93,7 +107,22 @@ int main(){
     kln::line biv_est_outer = outer_log(R_est);
     kln::line biv_est_cayley = cayley(R_est);
 
-    find_camera(biv_est_outer, points, camera_points); 
+    // Start instead from the closed form EPnP estimate when it is available
+    pnp_pose initial;
+    if (pose_from_epnp(points, camera_points, initial)){
+        biv_est_outer = initial.outer_bivector;
+        biv_est_cayley = initial.cayley_bivector;
+        std::cout << reprojection_error(initial.motor, points, camera_points) << std::endl;
+    }
+
+    pose_solver_options options;
+    options.num_threads = 4;
+    pose_solver_result result = find_camera(biv_est_outer, points, camera_points, options); 
+    std::cout << "cost " << result.initial_cost << " -> " << result.final_cost
+              << " after " << result.num_iterations << " iterations ("
+              << ceres::TerminationTypeToString(result.termination_type) << ")" << std::endl;
+    std::cout << result.bivector.e01() << " " << result.bivector.e02() << " " << result.bivector.e03() << " "
+              << result.bivector.e23() << " " << result.bivector.e31() << " " << result.bivector.e12() << std::endl;
 
 }
 
@@ -64,7 +64,10 @@
 /// Line scalar addition
 [[nodiscard]] inline kln::motor KLN_VEC_CALL operator+(float a, kln::line b) noexcept
 {
-    return a + as_motor(b);
+    kln::motor out;
+    out.p1_ = _mm_move_ss(b.p1_, _mm_set_ss(a));
+    out.p2_ = _mm_move_ss(b.p2_, _mm_setzero_ps());
+    return out;
 }
 
 [[nodiscard]] inline kln::motor KLN_VEC_CALL operator+(kln::line b, float a) noexcept
@@ -73,42 +76,123 @@
 }
 
 
+/*
+Grade aware products. Lanes 1-3 of p1_ hold the euclidean bivector
+{e23, e31, e12} and of p2_ the ideal bivector {e01, e02, e03}, lane 0 holds
+the scalar and e0123 of rotors and motors and is ignored for lines and
+branches. Writing a = a0 + A + a' + ap e0123 with A euclidean and a' ideal,
+the product of two motors is
+
+    a0 b0 - A.B
+    a0 B + b0 A - AxB
+    a0 b' + b0 a' - Axb' - a'xB - ap B - bp A
+    (a0 bp + b0 ap + A.b' + a'.B) e0123
+
+so with lines and branches in the mix most of the terms drop out and only
+the lanes that can be non zero are computed.
+*/
+
+
+/// Cross product of lanes 1-3, lane 0 of the result is zero for finite input
+[[nodiscard]] inline __m128 KLN_VEC_CALL cross3(__m128 a, __m128 b) noexcept
+{
+    __m128 a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(1, 3, 2, 0));
+    __m128 b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(1, 3, 2, 0));
+    __m128 c = _mm_sub_ps(_mm_mul_ps(a, b_yzx), _mm_mul_ps(a_yzx, b));
+    return _mm_shuffle_ps(c, c, _MM_SHUFFLE(1, 3, 2, 0));
+}
+
+
+/// Dot product of lanes 1-3 in lane 0, the other lanes are zero
+[[nodiscard]] inline __m128 KLN_VEC_CALL dot3(__m128 a, __m128 b) noexcept
+{
+#ifdef KLEIN_SSE_4_1
+    return _mm_dp_ps(a, b, 0xe1);
+#else
+    __m128 ab = _mm_move_ss(_mm_mul_ps(a, b), _mm_setzero_ps());
+    __m128 sum = _mm_add_ps(ab, _mm_movehl_ps(ab, ab));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 1, 1, 1)));
+    return _mm_move_ss(_mm_setzero_ps(), sum);
+#endif
+}
+
+
+/// Lane 0 broadcast to all lanes
+[[nodiscard]] inline __m128 KLN_VEC_CALL splat0(__m128 a) noexcept
+{
+    return _mm_shuffle_ps(a, a, _MM_SHUFFLE(0, 0, 0, 0));
+}
+
 
 /// Branch times rotor
 [[nodiscard]] inline kln::rotor KLN_VEC_CALL operator*(kln::branch a, kln::rotor b) noexcept
 {
-    kln::rotor out = as_rotor(a);
-    return out*b;
+    __m128 p1 = _mm_sub_ps(_mm_mul_ps(splat0(b.p1_), a.p1_), cross3(a.p1_, b.p1_));
+    kln::rotor out;
+    out.p1_ = _mm_move_ss(p1, _mm_sub_ps(_mm_setzero_ps(), dot3(a.p1_, b.p1_)));
+    return out;
+}
+
+
+/// Rotor times branch
+[[nodiscard]] inline kln::rotor KLN_VEC_CALL operator*(kln::rotor a, kln::branch b) noexcept
+{
+    __m128 p1 = _mm_sub_ps(_mm_mul_ps(splat0(a.p1_), b.p1_), cross3(a.p1_, b.p1_));
+    kln::rotor out;
+    out.p1_ = _mm_move_ss(p1, _mm_sub_ps(_mm_setzero_ps(), dot3(a.p1_, b.p1_)));
+    return out;
 }
 
 
 /// Line times rotor
 [[nodiscard]] inline kln::motor KLN_VEC_CALL operator*(kln::line a, kln::rotor b) noexcept
 {
-    kln::motor out = as_motor(a);
-    return out*b;
+    __m128 b0 = splat0(b.p1_);
+    __m128 p1 = _mm_sub_ps(_mm_mul_ps(b0, a.p1_), cross3(a.p1_, b.p1_));
+    __m128 p2 = _mm_sub_ps(_mm_mul_ps(b0, a.p2_), cross3(a.p2_, b.p1_));
+    kln::motor out;
+    out.p1_ = _mm_move_ss(p1, _mm_sub_ps(_mm_setzero_ps(), dot3(a.p1_, b.p1_)));
+    out.p2_ = _mm_move_ss(p2, dot3(a.p2_, b.p1_));
+    return out;
 }
 
 
 /// Line times motor
 [[nodiscard]] inline kln::motor KLN_VEC_CALL operator*(kln::line a, kln::motor b) noexcept
 {
-    kln::motor out = as_motor(a);
-    return out*b;
+    __m128 b0 = splat0(b.p1_);
+    __m128 p1 = _mm_sub_ps(_mm_mul_ps(b0, a.p1_), cross3(a.p1_, b.p1_));
+    __m128 p2 = _mm_sub_ps(_mm_mul_ps(b0, a.p2_), _mm_mul_ps(splat0(b.p2_), a.p1_));
+    p2 = _mm_sub_ps(p2, _mm_add_ps(cross3(a.p1_, b.p2_), cross3(a.p2_, b.p1_)));
+    kln::motor out;
+    out.p1_ = _mm_move_ss(p1, _mm_sub_ps(_mm_setzero_ps(), dot3(a.p1_, b.p1_)));
+    out.p2_ = _mm_move_ss(p2, _mm_add_ss(dot3(a.p1_, b.p2_), dot3(a.p2_, b.p1_)));
+    return out;
 }
 
 
 /// Rotor times line
 [[nodiscard]] inline kln::motor KLN_VEC_CALL operator*(kln::rotor a, kln::line b) noexcept
 {
-    kln::motor out = as_motor(b);
-    return a*out;
+    __m128 a0 = splat0(a.p1_);
+    __m128 p1 = _mm_sub_ps(_mm_mul_ps(a0, b.p1_), cross3(a.p1_, b.p1_));
+    __m128 p2 = _mm_sub_ps(_mm_mul_ps(a0, b.p2_), cross3(a.p1_, b.p2_));
+    kln::motor out;
+    out.p1_ = _mm_move_ss(p1, _mm_sub_ps(_mm_setzero_ps(), dot3(a.p1_, b.p1_)));
+    out.p2_ = _mm_move_ss(p2, dot3(a.p1_, b.p2_));
+    return out;
 }
 
 
 /// Motor times line
 [[nodiscard]] inline kln::motor KLN_VEC_CALL operator*(kln::motor a, kln::line b) noexcept
 {
-    kln::motor out = as_motor(b);
-    return a*out;
+    __m128 a0 = splat0(a.p1_);
+    __m128 p1 = _mm_sub_ps(_mm_mul_ps(a0, b.p1_), cross3(a.p1_, b.p1_));
+    __m128 p2 = _mm_sub_ps(_mm_mul_ps(a0, b.p2_), _mm_mul_ps(splat0(a.p2_), b.p1_));
+    p2 = _mm_sub_ps(p2, _mm_add_ps(cross3(a.p1_, b.p2_), cross3(a.p2_, b.p1_)));
+    kln::motor out;
+    out.p1_ = _mm_move_ss(p1, _mm_sub_ps(_mm_setzero_ps(), dot3(a.p1_, b.p1_)));
+    out.p2_ = _mm_move_ss(p2, _mm_add_ss(dot3(a.p1_, b.p2_), dot3(a.p2_, b.p1_)));
+    return out;
 }
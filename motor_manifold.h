@@ -0,0 +1,176 @@
+#pragma once
+
+#include <cmath>
+#include <klein/klein.hpp>
+#include "batched_maps.h"
+#include "cayley.h"
+#include "chart_policy.h"
+#include "outer_exp.h"
+#include "reprojection_cost.h"
+#include "simd_batch.h"
+
+#include "ceres/ceres.h"
+
+
+/*
+Motors as a ceres manifold. The parameter block holds the eight motor
+coefficients {scalar, e23, e31, e12, e01, e02, e03, e0123} and every step is
+composed onto the current estimate through the bivector chart of the policy
+the manifold is instantiated with, x + delta = x*chart(delta), so the chart
+is only ever evaluated close to the identity where it is well conditioned,
+whatever the size of the rotation.
+*/
+
+
+template <typename T>
+void motor_left_product_matrix(const T a[8], T matrix[64]){
+    /*
+    Row major 8x8 matrix of b -> a*b, which is linear in b
+    */
+    T basis[8] = {T(0), T(0), T(0), T(0), T(0), T(0), T(0), T(0)};
+    T column[8];
+    for (int j=0; j<8; j++){
+        basis[j] = T(1);
+        motor_product(a, basis, column);
+        basis[j] = T(0);
+        for (int i=0; i<8; i++){
+            matrix[8*i + j] = column[i];
+        }
+    }
+}
+
+
+void normalize_motor_coefficients(double motor[8]){
+    /*
+    normalize_motor on a single motor given by its coefficients
+    */
+    scalar_batch<double> m[8];
+    for (int i=0; i<8; i++){
+        m[i] = {motor[i]};
+    }
+    normalize_motor(m);
+    for (int i=0; i<8; i++){
+        motor[i] = m[i].v;
+    }
+}
+
+
+template <typename Chart>
+void chart_inverse(const double motor[8], double phi[6]){
+    /*
+    Bivector coordinates of a motor in the chart, the inverse of Chart::map.
+    The motor is taken with non negative scalar part, the sign does not
+    change the transformation it represents, and normalised onto the unit
+    motors the inverse maps assume.
+    */
+    double m[8];
+    const double sign = (motor[0] < 0.0) ? -1.0 : 1.0;
+    for (int i=0; i<8; i++){
+        m[i] = sign*motor[i];
+    }
+    normalize_motor_coefficients(m);
+    apply_map_scalar<policy_inverse_map<Chart>>(m, phi);
+}
+
+
+template <typename Chart>
+class MotorManifold : public ceres::Manifold {
+    /*
+    The eight coefficients of a unit motor with six dimensional tangent space,
+    x + delta = x*chart(delta) and y - x = chart^-1(~x*y), for an se3 chart
+    policy
+    */
+public:
+    MotorManifold()
+    {
+        // Derivative of the chart at the identity and its left inverse, the
+        // columns only touch the bivector coefficients and are orthogonal
+        const double zero[6] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+        double identity[8];
+        Chart::jacobian(zero, identity, chart_jacobian_);
+        for (int k=0; k<6; k++){
+            double norm2 = 0.0;
+            for (int i=0; i<8; i++){
+                norm2 += chart_jacobian_[6*i + k]*chart_jacobian_[6*i + k];
+            }
+            for (int i=0; i<8; i++){
+                chart_inverse_jacobian_[8*k + i] = chart_jacobian_[6*i + k]/norm2;
+            }
+        }
+    }
+
+    int AmbientSize() const override { return 8; }
+    int TangentSize() const override { return 6; }
+
+    bool Plus(const double* x, const double* delta, double* x_plus_delta) const override {
+        double step[8];
+        apply_map_scalar<policy_map<Chart>>(delta, step);
+        motor_product(x, step, x_plus_delta);
+        // Keep rounding from accumulating over many steps, in the norm and in
+        // the relation between the ideal and pseudoscalar parts
+        normalize_motor_coefficients(x_plus_delta);
+        return true;
+    }
+
+    bool PlusJacobian(const double* x, double* jacobian) const override {
+        /*
+        d(x*chart(delta))/d(delta) at delta = 0, the left product matrix of x
+        applied to the chart derivative at the identity
+        */
+        double left[64];
+        motor_left_product_matrix(x, left);
+        for (int i=0; i<8; i++){
+            for (int k=0; k<6; k++){
+                double sum = 0.0;
+                for (int j=0; j<8; j++){
+                    sum += left[8*i + j]*chart_jacobian_[6*j + k];
+                }
+                jacobian[6*i + k] = sum;
+            }
+        }
+        return true;
+    }
+
+    bool Minus(const double* y, const double* x, double* y_minus_x) const override {
+        double x_reverse[8];
+        double relative[8];
+        motor_reverse(x, x_reverse);
+        motor_product(x_reverse, y, relative);
+        chart_inverse<Chart>(relative, y_minus_x);
+        return true;
+    }
+
+    bool MinusJacobian(const double* x, double* jacobian) const override {
+        /*
+        d(chart^-1(~x*y))/dy at y = x
+        */
+        double x_reverse[8];
+        double left[64];
+        motor_reverse(x, x_reverse);
+        motor_left_product_matrix(x_reverse, left);
+        for (int k=0; k<6; k++){
+            for (int j=0; j<8; j++){
+                double sum = 0.0;
+                for (int i=0; i<8; i++){
+                    sum += chart_inverse_jacobian_[8*k + i]*left[8*i + j];
+                }
+                jacobian[8*k + j] = sum;
+            }
+        }
+        return true;
+    }
+
+private:
+    double chart_jacobian_[48];
+    double chart_inverse_jacobian_[48];
+};
+
+
+ceres::Manifold* make_motor_manifold(motor_chart chart){
+    /*
+    MotorManifold for a chart chosen at runtime, the caller owns the result
+    */
+    return with_chart(chart, [](auto policy) -> ceres::Manifold* {
+        return new MotorManifold<decltype(policy)>();
+    });
+}
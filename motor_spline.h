@@ -0,0 +1,335 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+#include <klein/klein.hpp>
+#include "batched_maps.h"
+#include "point_cloud.h"
+#include "rigid_body.h"
+#include "simd_batch.h"
+
+
+/*
+Motor trajectories evaluated at many timestamps per call. Both splines are
+built from the motion between consecutive keyframes expressed in a bivector
+chart, delta_k = chart^-1(~R_k R_k+1), which is computed once when the spline
+is built. A sample is then the keyframe motor times the chart of weighted
+deltas,
+
+    linear:        R_k chart(s delta_k)
+    cubic:         R_i-1 chart(B1(u) delta_i-1) chart(B2(u) delta_i) chart(B3(u) delta_i+1)
+
+with s and u the position within the segment and B1, B2 and B3 the
+cumulative cubic B-spline basis. As chart(delta_k) is exactly ~R_k R_k+1 the
+linear spline passes through the keyframes and the cumulative cubic spline
+is twice continuously differentiable, for either chart, while only needing
+the closed form maps of batched_maps.h instead of kln::exp and kln::log.
+Keyframes are sign corrected on construction so that consecutive motors lie
+in the same half of the double cover and every delta stays inside the chart.
+
+Samples are evaluated in blocks: the segment data of each sample is gathered
+into a small structure-of-arrays block and the chart maps and motor products
+then run over it on the SIMD batch types.
+*/
+
+
+constexpr std::size_t spline_block_size = 128;
+
+
+/// Segment data gathered for a block of samples
+struct spline_block {
+    alignas(POINT_CLOUD_ALIGNMENT) float reference[8][spline_block_size];
+    alignas(POINT_CLOUD_ALIGNMENT) float delta[3][6][spline_block_size];
+    alignas(POINT_CLOUD_ALIGNMENT) float weight[3][spline_block_size];
+};
+
+
+template <typename Chart, typename V>
+std::size_t spline_block_batches(int num_factors, const spline_block& block,
+                                 float* const output[8], std::size_t begin, std::size_t n){
+    /*
+    Evaluates the reference motor times the chart of every weighted delta for
+    whole batches of V::width samples from begin, returning the index of the
+    first sample left over
+    */
+    std::size_t i = begin;
+    for (; i + V::width <= n; i += V::width){
+        V motor[8];
+        for (int k=0; k<8; k++){
+            motor[k] = V::load(block.reference[k] + i);
+        }
+        for (int j=0; j<num_factors; j++){
+            const V weight = V::load(block.weight[j] + i);
+            V phi[6];
+            V local[8];
+            for (int k=0; k<6; k++){
+                phi[k] = weight*V::load(block.delta[j][k] + i);
+            }
+            Chart::map(phi, local);
+            motor_product(motor, local, motor);
+        }
+        for (int k=0; k<8; k++){
+            motor[k].store(output[k] + i);
+        }
+    }
+    return i;
+}
+
+
+#if defined(SIMD_BATCH_RUNTIME_AVX2)
+template <typename Chart>
+SIMD_BATCH_AVX2_DRIVER std::size_t spline_block_batches_avx2(int num_factors, const spline_block& block,
+                                                             float* const output[8], std::size_t n){
+    return spline_block_batches<Chart, avx2_float_batch>(num_factors, block, output, 0, n);
+}
+#endif
+
+
+void evaluate_spline_block(motor_chart chart, int num_factors, const spline_block& block,
+                           motor_array_span R, std::size_t offset, std::size_t n){
+    /*
+    Writes the n samples of a gathered block to R from offset, on the widest
+    batch the cpu supports and one at a time over the tail
+    */
+    float* const output[8] = {R.scalar + offset, R.e23 + offset, R.e31 + offset, R.e12 + offset,
+                              R.e01 + offset, R.e02 + offset, R.e03 + offset, R.e0123 + offset};
+    with_chart(chart, [&](auto policy){
+        using Chart = decltype(policy);
+        std::size_t i = 0;
+#if defined(SIMD_BATCH_RUNTIME_AVX2)
+        if (cpu_supports_avx2()){
+            i = spline_block_batches_avx2<Chart>(num_factors, block, output, n);
+        }
+#endif
+        i = spline_block_batches<Chart, float_batch>(num_factors, block, output, i, n);
+        spline_block_batches<Chart, scalar_batch<float>>(num_factors, block, output, i, n);
+    });
+}
+
+
+void spline_keyframes(motor_chart chart, motor_array_view keyframes, motor_array& motors, line_array& deltas){
+    /*
+    Copies the keyframes into motors, flipping signs so that consecutive
+    motors are in the same half of the double cover, and fills deltas with
+    the chart coordinates of the motion between each consecutive pair
+    */
+    motors.clear();
+    deltas.clear();
+    motors.reserve(keyframes.size());
+    deltas.reserve(keyframes.size());
+    float previous[8];
+    for (std::size_t k=0; k<keyframes.size(); k++){
+        float current[8] = {keyframes.scalar[k], keyframes.e23[k], keyframes.e31[k], keyframes.e12[k],
+                            keyframes.e01[k], keyframes.e02[k], keyframes.e03[k], keyframes.e0123[k]};
+        if (k > 0){
+            float reverse[8];
+            float relative[8];
+            motor_reverse(previous, reverse);
+            motor_product(reverse, current, relative);
+            if (relative[0] < 0.0f){
+                for (int i=0; i<8; i++){
+                    current[i] = -current[i];
+                    relative[i] = -relative[i];
+                }
+            }
+            float phi[6];
+            chart_bivector(chart, relative, phi);
+            deltas.push_back(kln::line{phi[0], phi[1], phi[2], phi[3], phi[4], phi[5]});
+        }
+        motors.push_back(kln::motor{current[0], current[1], current[2], current[3],
+                                    current[4], current[5], current[6], current[7]});
+        std::copy(current, current + 8, previous);
+    }
+}
+
+
+void gather_motor(motor_array_view motors, std::size_t k, spline_block& block, std::size_t i){
+    block.reference[0][i] = motors.scalar[k];
+    block.reference[1][i] = motors.e23[k];
+    block.reference[2][i] = motors.e31[k];
+    block.reference[3][i] = motors.e12[k];
+    block.reference[4][i] = motors.e01[k];
+    block.reference[5][i] = motors.e02[k];
+    block.reference[6][i] = motors.e03[k];
+    block.reference[7][i] = motors.e0123[k];
+}
+
+
+void gather_delta(line_array_view deltas, std::size_t k, float weight, int factor, spline_block& block, std::size_t i){
+    block.delta[factor][0][i] = deltas.e01[k];
+    block.delta[factor][1][i] = deltas.e02[k];
+    block.delta[factor][2][i] = deltas.e03[k];
+    block.delta[factor][3][i] = deltas.e23[k];
+    block.delta[factor][4][i] = deltas.e31[k];
+    block.delta[factor][5][i] = deltas.e12[k];
+    block.weight[factor][i] = weight;
+}
+
+
+class linear_motor_spline {
+    /*
+    Piecewise linear interpolation in the chart between keyframe motors at
+    increasing, not necessarily uniform, times. Samples outside the keyframe
+    times are clamped to the first or last keyframe.
+    */
+public:
+    linear_motor_spline() = default;
+
+    linear_motor_spline(const std::vector<float>& times, motor_array_view keyframes,
+                        motor_chart chart=motor_chart::cayley){
+        build(times, keyframes, chart);
+    }
+
+    void build(const std::vector<float>& times, motor_array_view keyframes,
+               motor_chart chart=motor_chart::cayley){
+        /*
+        Precomputes the segment data, times must be strictly increasing and
+        hold one entry per keyframe
+        */
+        chart_ = chart;
+        times_ = times;
+        spline_keyframes(chart, keyframes, motors_, deltas_);
+        inverse_durations_.resize(deltas_.size());
+        for (std::size_t k=0; k<deltas_.size(); k++){
+            inverse_durations_[k] = 1.0f/(times_[k + 1] - times_[k]);
+        }
+    }
+
+    std::size_t size() const noexcept { return motors_.size(); }
+    bool empty() const noexcept { return motors_.empty(); }
+    motor_chart chart() const noexcept { return chart_; }
+    float begin_time() const noexcept { return times_.front(); }
+    float end_time() const noexcept { return times_.back(); }
+
+    kln::motor operator()(float t) const {
+        motor_array R(1);
+        evaluate(&t, 1, R.span());
+        return R[0];
+    }
+
+    void evaluate(const float* t, std::size_t n, motor_array_span R) const {
+        /*
+        Samples the spline at the n times in t, R must hold at least as many
+        motors. Sorted times find their segments in constant time.
+        */
+        if (deltas_.empty()){
+            for (std::size_t i=0; i<n && !motors_.empty(); i++){
+                R.set(i, motors_[0]);
+            }
+            return;
+        }
+        spline_block block;
+        std::size_t segment = 0;
+        for (std::size_t offset=0; offset<n; offset+=spline_block_size){
+            std::size_t m = std::min(spline_block_size, n - offset);
+            for (std::size_t i=0; i<m; i++){
+                float time = t[offset + i];
+                segment = find_segment(time, segment);
+                float s = (time - times_[segment])*inverse_durations_[segment];
+                gather_motor(motors_, segment, block, i);
+                gather_delta(deltas_, segment, std::clamp(s, 0.0f, 1.0f), 0, block, i);
+            }
+            evaluate_spline_block(chart_, 1, block, R, offset, m);
+        }
+    }
+
+private:
+    std::size_t find_segment(float t, std::size_t hint) const {
+        /*
+        Segment k covering [times_k, times_k+1), starting from the hint
+        */
+        const std::size_t last = deltas_.size() - 1;
+        if (t >= times_[hint] && (t < times_[hint + 1] || hint == last)){
+            return hint;
+        }
+        if (hint < last && t >= times_[hint + 1] && (t < times_[hint + 2] || hint + 1 == last)){
+            return hint + 1;
+        }
+        std::size_t k = std::upper_bound(times_.begin(), times_.end(), t) - times_.begin();
+        return std::min(k == 0 ? 0 : k - 1, last);
+    }
+
+    motor_chart chart_ = motor_chart::cayley;
+    std::vector<float> times_;
+    std::vector<float> inverse_durations_;
+    motor_array motors_;
+    line_array deltas_;
+};
+
+
+class cubic_motor_spline {
+    /*
+    Cumulative cubic B-spline over control motors spaced uniformly in time,
+    control motor k sitting at start + k*interval. Like any B-spline it
+    approximates rather than passes through its control motors. It is
+    defined between the second and the second to last control motor and
+    needs at least four, samples outside are clamped to that range.
+    */
+public:
+    cubic_motor_spline() = default;
+
+    cubic_motor_spline(float start, float interval, motor_array_view control,
+                       motor_chart chart=motor_chart::cayley){
+        build(start, interval, control, chart);
+    }
+
+    void build(float start, float interval, motor_array_view control,
+               motor_chart chart=motor_chart::cayley){
+        chart_ = chart;
+        start_ = start;
+        interval_ = interval;
+        inverse_interval_ = 1.0f/interval;
+        spline_keyframes(chart, control, motors_, deltas_);
+    }
+
+    std::size_t size() const noexcept { return motors_.size(); }
+    bool empty() const noexcept { return motors_.empty(); }
+    motor_chart chart() const noexcept { return chart_; }
+    float begin_time() const noexcept { return start_ + interval_; }
+    float end_time() const noexcept { return start_ + (static_cast<float>(motors_.size()) - 2.0f)*interval_; }
+
+    kln::motor operator()(float t) const {
+        motor_array R(1);
+        evaluate(&t, 1, R.span());
+        return R[0];
+    }
+
+    void evaluate(const float* t, std::size_t n, motor_array_span R) const {
+        /*
+        Samples the spline at the n times in t, R must hold at least as many
+        motors. Nothing is written with fewer than four control motors.
+        */
+        if (motors_.size() < 4){
+            return;
+        }
+        const float last_segment = static_cast<float>(motors_.size() - 3);
+        spline_block block;
+        for (std::size_t offset=0; offset<n; offset+=spline_block_size){
+            std::size_t m = std::min(spline_block_size, n - offset);
+            for (std::size_t i=0; i<m; i++){
+                // Segment i runs from control motor i to i + 1 and blends i - 1 to i + 2
+                float x = std::clamp((t[offset + i] - start_)*inverse_interval_, 1.0f, last_segment + 1.0f);
+                float segment = std::min(std::floor(x), last_segment);
+                float u = x - segment;
+                float u2 = u*u;
+                float u3 = u2*u;
+                std::size_t k = static_cast<std::size_t>(segment) - 1;
+                gather_motor(motors_, k, block, i);
+                gather_delta(deltas_, k, (5.0f + 3.0f*u - 3.0f*u2 + u3)/6.0f, 0, block, i);
+                gather_delta(deltas_, k + 1, (1.0f + 3.0f*u + 3.0f*u2 - 2.0f*u3)/6.0f, 1, block, i);
+                gather_delta(deltas_, k + 2, u3/6.0f, 2, block, i);
+            }
+            evaluate_spline_block(chart_, 3, block, R, offset, m);
+        }
+    }
+
+private:
+    motor_chart chart_ = motor_chart::cayley;
+    float start_ = 0.0f;
+    float interval_ = 1.0f;
+    float inverse_interval_ = 1.0f;
+    motor_array motors_;
+    line_array deltas_;
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <klein/klein.hpp>
+#include "chart_policy.h"
 #include "klein_ops.h"
 
 
@@ -8,7 +9,7 @@ kln::branch outer_log(kln::rotor  R){
     /*
     For a given rotor this returns the bivector that when outer exponeniated gives the rotor
     */
-    return as_branch(R)/R.scalar();
+    return chart_inverse_map<outer_exp_chart<so3>>(R);
 }
 
 
@@ -16,7 +17,7 @@ kln::line outer_log(kln::motor  R){
     /*
     For a given motor this returns the bivector that when outer exponeniated gives the rotor
     */
-    return as_line(R)/R.scalar();
+    return chart_inverse_map<outer_exp_chart<se3>>(R);
 }
 
 
@@ -24,8 +25,7 @@ kln::rotor outer_exp(kln::branch phi){
     /*
     Implements the so3 outer exponential from bivectors to rotors
     */
-    kln::rotor phi2 = (phi*phi);
-    return (1.0f + phi)/std::sqrt(1.0f - phi2.scalar());
+    return chart_map<outer_exp_chart<so3>>(phi);
 }
 
 
@@ -33,9 +33,7 @@ kln::motor outer_exp(kln::line phi){
     /*
     Implements the se3 outer exponential from bivectors to rotors
     */
-    kln::motor phi2 = (phi*phi);
-    kln::motor phi2_4 = kln::motor(0,0,0,0,0,0,0,phi2.e0123());
-    return (1.0f + phi + 0.5f*phi2_4)/std::sqrt(1.0f - phi2.scalar());
+    return chart_map<outer_exp_chart<se3>>(phi);
 }
 
 
@@ -44,9 +42,7 @@ kln::branch outer_exp_kinematic(kln::branch phi, kln::branch omega){
     This is the kinematic equation for the outer exponential map as found in
     Hadfield H., Lasenby J., Screw Theory in Geometric Algebra for Constrained Rigid Body Dynamics AACA (2021)
     */
-    kln::rotor R = outer_exp(phi);
-    kln::rotor omegaR = omega*R;
-    return -0.5f*sqrtf(1.0f - (phi*phi).scalar())*(-as_branch(omegaR) + omegaR.scalar()*as_branch(R)/R.scalar());
+    return chart_spatial_kinematic<outer_exp_chart<so3>>(phi, omega);
 }
 
 
@@ -55,8 +51,5 @@ kln::line outer_exp_kinematic(kln::line phi, kln::line omega){
     This is the kinematic equation for the outer exponential map as found in
     Hadfield H., Lasenby J., Screw Theory in Geometric Algebra for Constrained Rigid Body Dynamics AACA (2021)
     */
-    kln::motor R = outer_exp(phi);
-    kln::motor omegaR = omega*R;
-    return -0.5f*sqrtf(1.0f - (phi*phi).scalar())*(-as_line(omegaR) + omegaR.scalar()*as_line(R)/R.scalar());
+    return chart_spatial_kinematic<outer_exp_chart<se3>>(phi, omega);
 }
-
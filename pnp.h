@@ -0,0 +1,546 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstddef>
+#include <limits>
+#include <vector>
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+#include <klein/klein.hpp>
+#include "klein_ops.h"
+#include "cayley.h"
+#include "outer_exp.h"
+#include "point_cloud.h"
+
+
+/*
+Closed form camera pose estimation from world to image correspondences.
+Image points are on the standard camera plane z = 1, as produced by
+project_to_camera, and the camera motor R maps world points into the camera
+frame through its reverse, p_camera = (~R)(p_world).
+*/
+
+
+kln::motor rigid_transform_to_motor(const Eigen::Matrix3d& rotation, const Eigen::Vector3d& translation){
+    /*
+    Builds the motor M for which M p ~M = rotation*p + translation
+    */
+    Eigen::Quaterniond q(rotation);
+    q.normalize();
+    // The rotor a + b e23 + c e31 + d e12 acts as the quaternion (a, -b, -c, -d)
+    kln::motor rotor_part{static_cast<float>(q.w()), static_cast<float>(-q.x()),
+                          static_cast<float>(-q.y()), static_cast<float>(-q.z()),
+                          0.0f, 0.0f, 0.0f, 0.0f};
+    kln::motor translator_part{1.0f, 0.0f, 0.0f, 0.0f,
+                               static_cast<float>(-0.5*translation.x()),
+                               static_cast<float>(-0.5*translation.y()),
+                               static_cast<float>(-0.5*translation.z()), 0.0f};
+    return translator_part*rotor_part;
+}
+
+
+kln::motor camera_motor_from_extrinsics(const Eigen::Matrix3d& rotation, const Eigen::Vector3d& translation){
+    /*
+    Converts the world to camera transform p_camera = rotation*p_world + translation
+    into the camera motor used throughout camera_ops.h. Of the two motors
+    representing the transform the one with non negative scalar part is
+    returned, as outer_log and the cayley map are singular at scalar 0 and -1.
+    */
+    kln::motor camera = ~rigid_transform_to_motor(rotation, translation);
+    if (camera.scalar() < 0.0f){
+        camera = -camera;
+    }
+    return camera;
+}
+
+
+/// A camera estimate with its coordinates in both bivector charts
+struct pnp_pose {
+    kln::motor motor;
+    // outer_log(motor), the initial bivector for the outer_exp chart
+    kln::line outer_bivector;
+    // cayley(motor), the initial bivector for the cayley chart
+    kln::line cayley_bivector;
+};
+
+
+pnp_pose make_pnp_pose(kln::motor camera){
+    pnp_pose pose;
+    pose.motor = camera;
+    pose.outer_bivector = outer_log(camera);
+    pose.cayley_bivector = cayley(camera);
+    return pose;
+}
+
+
+Eigen::Vector3d world_point(point_cloud_view points, std::size_t i){
+    return Eigen::Vector3d(points.x[i], points.y[i], points.z[i])/points.w[i];
+}
+
+
+double mean_reprojection_error(point_cloud_view points, point_cloud_view camera_points,
+                                const Eigen::Matrix3d& rotation, const Eigen::Vector3d& translation){
+    double error = 0.0;
+    for (std::size_t i=0; i<points.size(); i++){
+        Eigen::Vector3d p = rotation*world_point(points, i) + translation;
+        double du = camera_points.x[i] - p.x()/p.z();
+        double dv = camera_points.y[i] - p.y()/p.z();
+        error += std::sqrt(du*du + dv*dv);
+    }
+    return error/std::max<std::size_t>(points.size(), 1);
+}
+
+
+bool rigid_alignment(const Eigen::Matrix3Xd& world, const Eigen::Matrix3Xd& camera,
+                    Eigen::Matrix3d& rotation, Eigen::Vector3d& translation){
+    /*
+    Least squares rotation and translation taking the world points onto the
+    camera frame points (Kabsch / Umeyama without scale)
+    */
+    Eigen::Matrix4d transform = Eigen::umeyama(world, camera, false);
+    rotation = transform.topLeftCorner<3, 3>();
+    translation = transform.topRightCorner<3, 1>();
+    return rotation.allFinite() && translation.allFinite();
+}
+
+
+std::size_t p3p_extrinsics(point_cloud_view points, point_cloud_view camera_points,
+                        std::vector<Eigen::Matrix3d>& rotations, std::vector<Eigen::Vector3d>& translations){
+    /*
+    Grunert's closed form solution of the perspective three point problem,
+    writing up to four world to camera transforms consistent with the first
+    three correspondences. With the unit bearings f_i, the depths s_i satisfy
+    s_i^2 + s_j^2 - 2 s_i s_j f_i.f_j = |P_i - P_j|^2. Substituting
+    s_2 = u s_1 and s_3 = v s_1 leaves two conics in (u, v), whose resultant
+    in v is a quartic in u.
+    */
+    rotations.clear();
+    translations.clear();
+    if (points.size() < 3){
+        return 0;
+    }
+
+    Eigen::Vector3d P[3];
+    Eigen::Vector3d f[3];
+    for (std::size_t i=0; i<3; i++){
+        P[i] = world_point(points, i);
+        f[i] = Eigen::Vector3d(camera_points.x[i], camera_points.y[i], 1.0).normalized();
+    }
+    const double c12 = f[0].dot(f[1]);
+    const double c13 = f[0].dot(f[2]);
+    const double c23 = f[1].dot(f[2]);
+    const double a = (P[0] - P[1]).squaredNorm();
+    const double b = (P[0] - P[2]).squaredNorm();
+    const double c = (P[1] - P[2]).squaredNorm();
+    if (!(a > 0.0 && b > 0.0 && c > 0.0)){
+        return 0;
+    }
+
+    // Both conics written as a v^2 + B(u) v + C(u), polynomials lowest order first
+    using poly = std::vector<double>;
+    auto multiply = [](const poly& p, const poly& q){
+        poly out(p.size() + q.size() - 1, 0.0);
+        for (std::size_t i=0; i<p.size(); i++){
+            for (std::size_t j=0; j<q.size(); j++){
+                out[i + j] += p[i]*q[j];
+            }
+        }
+        return out;
+    };
+    auto combine = [](const poly& p, double alpha, const poly& q, double beta){
+        poly out(std::max(p.size(), q.size()), 0.0);
+        for (std::size_t i=0; i<p.size(); i++){
+            out[i] += alpha*p[i];
+        }
+        for (std::size_t i=0; i<q.size(); i++){
+            out[i] += beta*q[i];
+        }
+        return out;
+    };
+    const poly B1 = {-2.0*c13*a};
+    const poly C1 = {a - b, 2.0*c12*b, -b};
+    const poly B2 = {0.0, -2.0*c23*a};
+    const poly C2 = {-c, 2.0*c12*c, a - c};
+
+    // Resultant of a v^2 + B1 v + C1 and a v^2 + B2 v + C2
+    const poly C_diff = combine(C2, a, C1, -a);
+    const poly B_diff = combine(B2, a, B1, -a);
+    const poly cross = combine(multiply(B1, C2), 1.0, multiply(B2, C1), -1.0);
+    poly quartic = combine(multiply(C_diff, C_diff), 1.0, multiply(B_diff, cross), -1.0);
+    quartic.resize(5, 0.0);
+    if (std::abs(quartic[4]) < 1e-14*std::abs(quartic[0]) || quartic[4] == 0.0){
+        return 0;
+    }
+
+    // Real roots from the eigenvalues of the companion matrix
+    Eigen::Matrix4d companion = Eigen::Matrix4d::Zero();
+    companion.block<3, 3>(1, 0) = Eigen::Matrix3d::Identity();
+    for (int i=0; i<4; i++){
+        companion(i, 3) = -quartic[i]/quartic[4];
+    }
+    Eigen::EigenSolver<Eigen::Matrix4d> eigen_solver(companion, false);
+    for (int r=0; r<4; r++){
+        std::complex<double> root = eigen_solver.eigenvalues()[r];
+        if (std::abs(root.imag()) > 1e-8*std::max(1.0, std::abs(root.real()))){
+            continue;
+        }
+        double u = root.real();
+        if (u <= 0.0){
+            continue;
+        }
+        // The conics share the v^2 coefficient, so their difference is linear in v
+        double denominator = (B1[0]) - (B2[1]*u);
+        if (std::abs(denominator) < 1e-15){
+            continue;
+        }
+        double C1u = C1[0] + C1[1]*u + C1[2]*u*u;
+        double C2u = C2[0] + C2[1]*u + C2[2]*u*u;
+        double v = (C2u - C1u)/denominator;
+        if (v <= 0.0){
+            continue;
+        }
+        double norm = 1.0 + u*u - 2.0*u*c12;
+        if (norm <= 0.0){
+            continue;
+        }
+        double s1 = std::sqrt(a/norm);
+        Eigen::Matrix3Xd world(3, 3);
+        Eigen::Matrix3Xd camera(3, 3);
+        for (int i=0; i<3; i++){
+            world.col(i) = P[i];
+        }
+        camera.col(0) = s1*f[0];
+        camera.col(1) = u*s1*f[1];
+        camera.col(2) = v*s1*f[2];
+        Eigen::Matrix3d rotation;
+        Eigen::Vector3d translation;
+        if (rigid_alignment(world, camera, rotation, translation)){
+            rotations.push_back(rotation);
+            translations.push_back(translation);
+        }
+    }
+    return rotations.size();
+}
+
+
+std::size_t pose_from_p3p(point_cloud_view points, point_cloud_view camera_points, 
+                        std::vector<kln::motor>& solutions){
+    /*
+    Writes the up to four camera motors solving P3P for the first three
+    correspondences
+    */
+    std::vector<Eigen::Matrix3d> rotations;
+    std::vector<Eigen::Vector3d> translations;
+    p3p_extrinsics(points, camera_points, rotations, translations);
+    solutions.clear();
+    for (std::size_t i=0; i<rotations.size(); i++){
+        solutions.push_back(camera_motor_from_extrinsics(rotations[i], translations[i]));
+    }
+    return solutions.size();
+}
+
+
+bool pose_from_p3p(point_cloud_view points, point_cloud_view camera_points, pnp_pose& pose){
+    /*
+    P3P on the first three correspondences, disambiguated by the reprojection
+    error over all of them
+    */
+    std::vector<Eigen::Matrix3d> rotations;
+    std::vector<Eigen::Vector3d> translations;
+    if (p3p_extrinsics(points, camera_points, rotations, translations) == 0){
+        return false;
+    }
+    std::size_t best = 0;
+    double best_error = std::numeric_limits<double>::infinity();
+    for (std::size_t i=0; i<rotations.size(); i++){
+        double error = mean_reprojection_error(points, camera_points, rotations[i], translations[i]);
+        if (error < best_error){
+            best_error = error;
+            best = i;
+        }
+    }
+    pose = make_pnp_pose(camera_motor_from_extrinsics(rotations[best], translations[best]));
+    return true;
+}
+
+
+bool pose_from_dlt(point_cloud_view points, point_cloud_view camera_points, kln::motor& camera){
+    /*
+    Direct linear transform estimate of the camera from six or more
+    correspondences. The world points are centred and scaled for conditioning,
+    the projection matrix is taken from the null space of the stacked
+    constraints and its left 3x3 block is projected onto the nearest rotation.
+    */
+    const std::size_t n = points.size();
+    if (n < 6){
+        return false;
+    }
+
+    // Normalise the world points
+    Eigen::Vector3d centroid = Eigen::Vector3d::Zero();
+    for (std::size_t i=0; i<n; i++){
+        centroid += Eigen::Vector3d(points.x[i], points.y[i], points.z[i])/points.w[i];
+    }
+    centroid /= static_cast<double>(n);
+    double spread = 0.0;
+    for (std::size_t i=0; i<n; i++){
+        spread += (Eigen::Vector3d(points.x[i], points.y[i], points.z[i])/points.w[i] - centroid).norm();
+    }
+    spread /= static_cast<double>(n);
+    if (!(spread > 0.0)){
+        return false;
+    }
+    const double scale = std::sqrt(3.0)/spread;
+
+    Eigen::MatrixXd A(2*n, 12);
+    for (std::size_t i=0; i<n; i++){
+        Eigen::Vector3d p = (Eigen::Vector3d(points.x[i], points.y[i], points.z[i])/points.w[i] - centroid)*scale;
+        double u = camera_points.x[i];
+        double v = camera_points.y[i];
+        A.row(2*i) << p.x(), p.y(), p.z(), 1.0, 0.0, 0.0, 0.0, 0.0, -u*p.x(), -u*p.y(), -u*p.z(), -u;
+        A.row(2*i + 1) << 0.0, 0.0, 0.0, 0.0, p.x(), p.y(), p.z(), 1.0, -v*p.x(), -v*p.y(), -v*p.z(), -v;
+    }
+    Eigen::JacobiSVD<Eigen::MatrixXd> svd(A, Eigen::ComputeFullV);
+    Eigen::Matrix<double, 12, 1> h = svd.matrixV().col(11);
+    Eigen::Matrix<double, 3, 4> P;
+    P << h(0), h(1), h(2), h(3),
+         h(4), h(5), h(6), h(7),
+         h(8), h(9), h(10), h(11);
+
+    // Fix the overall sign so that the points lie in front of the camera
+    double depth_sum = 0.0;
+    for (std::size_t i=0; i<n; i++){
+        Eigen::Vector3d p = (Eigen::Vector3d(points.x[i], points.y[i], points.z[i])/points.w[i] - centroid)*scale;
+        depth_sum += P.row(2).head<3>().dot(p) + P(2, 3);
+    }
+    if (depth_sum < 0.0){
+        P = -P;
+    }
+
+    // Project onto the nearest scaled rotation
+    Eigen::JacobiSVD<Eigen::Matrix3d> rotation_svd(P.leftCols<3>(), Eigen::ComputeFullU | Eigen::ComputeFullV);
+    Eigen::Matrix3d rotation = rotation_svd.matrixU()*rotation_svd.matrixV().transpose();
+    if (rotation.determinant() < 0.0){
+        return false;
+    }
+    double projection_scale = rotation_svd.singularValues().mean();
+    if (!(projection_scale > 0.0)){
+        return false;
+    }
+    Eigen::Vector3d translation = P.col(3)/projection_scale;
+
+    // Undo the normalisation p' = scale*(p - centroid), the overall scale of
+    // the camera frame does not change the projection
+    translation = translation/scale - rotation*centroid;
+    camera = camera_motor_from_extrinsics(rotation, translation);
+    return std::isfinite(camera.scalar());
+}
+
+
+void epnp_betas_to_extrinsics(const Eigen::Matrix<double, 12, 4>& kernel, const double betas[4],
+                            const Eigen::MatrixXd& alphas, point_cloud_view points,
+                            Eigen::Matrix3d& rotation, Eigen::Vector3d& translation){
+    /*
+    Camera frame control points from the kernel combination, the points they
+    span and the rigid transform aligning the world points onto them
+    */
+    Eigen::Matrix<double, 12, 1> control = kernel*Eigen::Map<const Eigen::Vector4d>(betas);
+    const std::size_t n = points.size();
+    Eigen::Matrix3Xd world(3, n);
+    Eigen::Matrix3Xd camera(3, n);
+    for (std::size_t i=0; i<n; i++){
+        world.col(i) = world_point(points, i);
+        camera.col(i).setZero();
+        for (int j=0; j<4; j++){
+            camera.col(i) += alphas(i, j)*control.segment<3>(3*j);
+        }
+    }
+    // The kernel is only defined up to sign and only one sign is reachable by
+    // a rigid motion, keep whichever aligns better
+    Eigen::Matrix3d flipped_rotation;
+    Eigen::Vector3d flipped_translation;
+    rigid_alignment(world, camera, rotation, translation);
+    rigid_alignment(world, -camera, flipped_rotation, flipped_translation);
+    double error = ((rotation*world).colwise() + translation - camera).squaredNorm();
+    double flipped_error = ((flipped_rotation*world).colwise() + flipped_translation + camera).squaredNorm();
+    if (flipped_error < error){
+        rotation = flipped_rotation;
+        translation = flipped_translation;
+    }
+}
+
+
+bool pose_from_epnp(point_cloud_view points, point_cloud_view camera_points, pnp_pose& pose){
+    /*
+    EPnP estimate of the camera from four or more correspondences, linear in
+    the number of points. Every world point is written as a barycentric
+    combination of four control points aligned with its principal axes, the
+    camera frame control points lie in the span of the smallest eigenvectors
+    of a 12x12 system, and the span coefficients are found from the control
+    point distances with the N = 1, 2, 3 approximations each polished by a
+    few Gauss-Newton steps. The candidate with the smallest reprojection
+    error is kept.
+    */
+    const std::size_t n = points.size();
+    if (n < 4){
+        return false;
+    }
+
+    // Control points at the centroid and along the principal axes
+    Eigen::Vector3d centroid = Eigen::Vector3d::Zero();
+    for (std::size_t i=0; i<n; i++){
+        centroid += world_point(points, i);
+    }
+    centroid /= static_cast<double>(n);
+    Eigen::Matrix3d covariance = Eigen::Matrix3d::Zero();
+    for (std::size_t i=0; i<n; i++){
+        Eigen::Vector3d d = world_point(points, i) - centroid;
+        covariance += d*d.transpose();
+    }
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> axes(covariance/static_cast<double>(n));
+    Eigen::Matrix<double, 4, 3> control;
+    control.row(0) = centroid.transpose();
+    for (int j=0; j<3; j++){
+        double extent = std::sqrt(std::max(axes.eigenvalues()(j), 0.0));
+        if (!(extent > 0.0)){
+            // Planar or degenerate configurations need another solver
+            return false;
+        }
+        control.row(j + 1) = (centroid + extent*axes.eigenvectors().col(j)).transpose();
+    }
+
+    // Barycentric coordinates of the world points
+    Eigen::Matrix3d basis;
+    for (int j=0; j<3; j++){
+        basis.col(j) = (control.row(j + 1) - control.row(0)).transpose();
+    }
+    Eigen::Matrix3d basis_inverse = basis.inverse();
+    Eigen::MatrixXd alphas(n, 4);
+    for (std::size_t i=0; i<n; i++){
+        Eigen::Vector3d a = basis_inverse*(world_point(points, i) - centroid);
+        alphas(i, 0) = 1.0 - a.sum();
+        alphas.block<1, 3>(i, 1) = a.transpose();
+    }
+
+    // Accumulate M^T M directly instead of forming the 2n x 12 matrix M
+    Eigen::Matrix<double, 12, 12> MtM = Eigen::Matrix<double, 12, 12>::Zero();
+    for (std::size_t i=0; i<n; i++){
+        Eigen::Matrix<double, 2, 12> rows = Eigen::Matrix<double, 2, 12>::Zero();
+        const double u = camera_points.x[i];
+        const double v = camera_points.y[i];
+        for (int j=0; j<4; j++){
+            rows(0, 3*j) = alphas(i, j);
+            rows(0, 3*j + 2) = -u*alphas(i, j);
+            rows(1, 3*j + 1) = alphas(i, j);
+            rows(1, 3*j + 2) = -v*alphas(i, j);
+        }
+        MtM.noalias() += rows.transpose()*rows;
+    }
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix<double, 12, 12>> null_space(MtM);
+    Eigen::Matrix<double, 12, 4> kernel = null_space.eigenvectors().leftCols<4>();
+
+    // Squared control point distances as linear functions of the ten products
+    // b11 b12 b22 b13 b23 b33 b14 b24 b34 b44 of the span coefficients
+    const int pairs[6][2] = {{0, 1}, {0, 2}, {0, 3}, {1, 2}, {1, 3}, {2, 3}};
+    Eigen::Matrix<double, 6, 10> L;
+    Eigen::Matrix<double, 6, 1> rho;
+    for (int r=0; r<6; r++){
+        Eigen::Vector3d dv[4];
+        for (int k=0; k<4; k++){
+            dv[k] = kernel.col(k).segment<3>(3*pairs[r][0]) - kernel.col(k).segment<3>(3*pairs[r][1]);
+        }
+        L(r, 0) = dv[0].dot(dv[0]);
+        L(r, 1) = 2.0*dv[0].dot(dv[1]);
+        L(r, 2) = dv[1].dot(dv[1]);
+        L(r, 3) = 2.0*dv[0].dot(dv[2]);
+        L(r, 4) = 2.0*dv[1].dot(dv[2]);
+        L(r, 5) = dv[2].dot(dv[2]);
+        L(r, 6) = 2.0*dv[0].dot(dv[3]);
+        L(r, 7) = 2.0*dv[1].dot(dv[3]);
+        L(r, 8) = 2.0*dv[2].dot(dv[3]);
+        L(r, 9) = dv[3].dot(dv[3]);
+        rho(r) = (control.row(pairs[r][0]) - control.row(pairs[r][1])).squaredNorm();
+    }
+
+    // The betas are recovered from their products up to sign, the root is
+    // taken of the magnitude and the sign chosen by the caller
+    auto abs_root = [](double value){
+        return std::sqrt(std::abs(value));
+    };
+    double candidates[3][4] = {};
+    {
+        // N = 1, b11 b12 b13 b14
+        Eigen::Matrix<double, 6, 4> L4;
+        L4 << L.col(0), L.col(1), L.col(3), L.col(6);
+        Eigen::Vector4d b = L4.colPivHouseholderQr().solve(rho);
+        double b0 = abs_root(b(0));
+        double sign = (b(0) < 0.0) ? -1.0 : 1.0;
+        candidates[0][0] = b0;
+        for (int k=1; k<4; k++){
+            candidates[0][k] = (b0 > 0.0) ? sign*b(k)/b0 : 0.0;
+        }
+    }
+    {
+        // N = 2, b11 b12 b22
+        Eigen::Matrix<double, 6, 3> L3;
+        L3 << L.col(0), L.col(1), L.col(2);
+        Eigen::Vector3d b = L3.colPivHouseholderQr().solve(rho);
+        double b0 = abs_root(b(0));
+        double b1 = ((b(0) < 0.0) == (b(2) < 0.0)) ? abs_root(b(2)) : 0.0;
+        candidates[1][0] = (b(1) < 0.0) ? -b0 : b0;
+        candidates[1][1] = b1;
+    }
+    {
+        // N = 3, b11 b12 b22 b13 b23
+        Eigen::Matrix<double, 6, 5> L5 = L.leftCols<5>();
+        Eigen::Matrix<double, 5, 1> b = L5.colPivHouseholderQr().solve(rho);
+        double b0 = abs_root(b(0));
+        double b1 = ((b(0) < 0.0) == (b(2) < 0.0)) ? abs_root(b(2)) : 0.0;
+        b0 = (b(1) < 0.0) ? -b0 : b0;
+        candidates[2][0] = b0;
+        candidates[2][1] = b1;
+        candidates[2][2] = (b0 != 0.0) ? b(3)/b0 : 0.0;
+    }
+
+    double best_error = std::numeric_limits<double>::infinity();
+    for (auto& betas : candidates){
+        // Gauss-Newton on |L b(betas) - rho|^2
+        for (int iteration=0; iteration<5; iteration++){
+            Eigen::Matrix<double, 6, 4> A;
+            Eigen::Matrix<double, 6, 1> residual;
+            const double* B = betas;
+            for (int r=0; r<6; r++){
+                double products[10] = {B[0]*B[0], B[0]*B[1], B[1]*B[1], B[0]*B[2], B[1]*B[2],
+                                       B[2]*B[2], B[0]*B[3], B[1]*B[3], B[2]*B[3], B[3]*B[3]};
+                double value = 0.0;
+                for (int k=0; k<10; k++){
+                    value += L(r, k)*products[k];
+                }
+                residual(r) = rho(r) - value;
+                A(r, 0) = 2.0*L(r, 0)*B[0] + L(r, 1)*B[1] + L(r, 3)*B[2] + L(r, 6)*B[3];
+                A(r, 1) = L(r, 1)*B[0] + 2.0*L(r, 2)*B[1] + L(r, 4)*B[2] + L(r, 7)*B[3];
+                A(r, 2) = L(r, 3)*B[0] + L(r, 4)*B[1] + 2.0*L(r, 5)*B[2] + L(r, 8)*B[3];
+                A(r, 3) = L(r, 6)*B[0] + L(r, 7)*B[1] + L(r, 8)*B[2] + 2.0*L(r, 9)*B[3];
+            }
+            Eigen::Vector4d step = A.colPivHouseholderQr().solve(residual);
+            for (int k=0; k<4; k++){
+                betas[k] += step(k);
+            }
+        }
+
+        Eigen::Matrix3d rotation;
+        Eigen::Vector3d translation;
+        epnp_betas_to_extrinsics(kernel, betas, alphas, points, rotation, translation);
+        if (!rotation.allFinite() || !translation.allFinite()){
+            continue;
+        }
+        double error = mean_reprojection_error(points, camera_points, rotation, translation);
+        if (error < best_error){
+            best_error = error;
+            pose = make_pnp_pose(camera_motor_from_extrinsics(rotation, translation));
+        }
+    }
+    return std::isfinite(best_error);
+}
@@ -0,0 +1,228 @@
+#pragma once
+
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <new>
+#include <vector>
+#include <klein/klein.hpp>
+
+
+/// Alignment of every coordinate array in a point cloud, wide enough for AVX loads
+#define POINT_CLOUD_ALIGNMENT 32
+
+
+/// Minimal allocator handing out storage aligned to Alignment bytes
+template <typename T, std::size_t Alignment>
+struct aligned_allocator {
+    using value_type = T;
+
+    template <typename U>
+    struct rebind {
+        using other = aligned_allocator<U, Alignment>;
+    };
+
+    aligned_allocator() noexcept = default;
+
+    template <typename U>
+    aligned_allocator(const aligned_allocator<U, Alignment>&) noexcept {}
+
+    T* allocate(std::size_t n){
+        if (n > std::numeric_limits<std::size_t>::max()/sizeof(T)){
+            throw std::bad_array_new_length();
+        }
+        return static_cast<T*>(::operator new(n*sizeof(T), std::align_val_t(Alignment)));
+    }
+
+    void deallocate(T* p, std::size_t) noexcept {
+        ::operator delete(p, std::align_val_t(Alignment));
+    }
+
+    template <typename U>
+    bool operator==(const aligned_allocator<U, Alignment>&) const noexcept { return true; }
+
+    template <typename U>
+    bool operator!=(const aligned_allocator<U, Alignment>&) const noexcept { return false; }
+};
+
+
+using aligned_float_vector = std::vector<float, aligned_allocator<float, POINT_CLOUD_ALIGNMENT>>;
+
+
+/// Build a klein point from homogeneous coordinates without renormalising
+[[nodiscard]] inline kln::point KLN_VEC_CALL make_point(float x, float y, float z, float w) noexcept
+{
+    kln::point out;
+    out.p3_ = _mm_set_ps(z, y, x, w);
+    return out;
+}
+
+
+/// Read only view over a contiguous structure-of-arrays set of points
+struct point_cloud_view {
+    const float* x = nullptr;
+    const float* y = nullptr;
+    const float* z = nullptr;
+    const float* w = nullptr;
+    std::size_t count = 0;
+
+    std::size_t size() const noexcept { return count; }
+    bool empty() const noexcept { return count == 0; }
+
+    kln::point operator[](std::size_t i) const noexcept {
+        return make_point(x[i], y[i], z[i], w[i]);
+    }
+
+    point_cloud_view subview(std::size_t offset, std::size_t n) const noexcept {
+        return {x + offset, y + offset, z + offset, w + offset, n};
+    }
+};
+
+
+/// Mutable view over a contiguous structure-of-arrays set of points
+struct point_cloud_span {
+    float* x = nullptr;
+    float* y = nullptr;
+    float* z = nullptr;
+    float* w = nullptr;
+    std::size_t count = 0;
+
+    std::size_t size() const noexcept { return count; }
+    bool empty() const noexcept { return count == 0; }
+
+    kln::point operator[](std::size_t i) const noexcept {
+        return make_point(x[i], y[i], z[i], w[i]);
+    }
+
+    void set(std::size_t i, kln::point const& p) noexcept {
+        x[i] = p.x();
+        y[i] = p.y();
+        z[i] = p.z();
+        w[i] = p.w();
+    }
+
+    point_cloud_span subspan(std::size_t offset, std::size_t n) const noexcept {
+        return {x + offset, y + offset, z + offset, w + offset, n};
+    }
+
+    operator point_cloud_view() const noexcept {
+        return {x, y, z, w, count};
+    }
+};
+
+
+/// Owning structure-of-arrays point container, each coordinate is stored in its own aligned array
+struct point_cloud {
+    aligned_float_vector x;
+    aligned_float_vector y;
+    aligned_float_vector z;
+    aligned_float_vector w;
+
+    point_cloud() = default;
+
+    explicit point_cloud(std::size_t n)
+    {
+        resize(n);
+    }
+
+    std::size_t size() const noexcept { return x.size(); }
+    bool empty() const noexcept { return x.empty(); }
+
+    void reserve(std::size_t n){
+        x.reserve(n);
+        y.reserve(n);
+        z.reserve(n);
+        w.reserve(n);
+    }
+
+    void resize(std::size_t n){
+        x.resize(n, 0.0f);
+        y.resize(n, 0.0f);
+        z.resize(n, 0.0f);
+        w.resize(n, 1.0f);
+    }
+
+    void clear() noexcept {
+        x.clear();
+        y.clear();
+        z.clear();
+        w.clear();
+    }
+
+    void push_back(float px, float py, float pz, float pw=1.0f){
+        x.push_back(px);
+        y.push_back(py);
+        z.push_back(pz);
+        w.push_back(pw);
+    }
+
+    void push_back(kln::point const& p){
+        push_back(p.x(), p.y(), p.z(), p.w());
+    }
+
+    kln::point operator[](std::size_t i) const noexcept {
+        return make_point(x[i], y[i], z[i], w[i]);
+    }
+
+    void set(std::size_t i, kln::point const& p) noexcept {
+        x[i] = p.x();
+        y[i] = p.y();
+        z[i] = p.z();
+        w[i] = p.w();
+    }
+
+    void normalize() noexcept {
+        for (std::size_t i=0; i<size(); i++){
+            float inv_w = 1.0f/w[i];
+            x[i] *= inv_w;
+            y[i] *= inv_w;
+            z[i] *= inv_w;
+            w[i] = 1.0f;
+        }
+    }
+
+    point_cloud_view view() const noexcept {
+        return {x.data(), y.data(), z.data(), w.data(), size()};
+    }
+
+    point_cloud_span span() noexcept {
+        return {x.data(), y.data(), z.data(), w.data(), size()};
+    }
+
+    operator point_cloud_view() const noexcept {
+        return view();
+    }
+};
+
+
+void to_point_cloud(const std::vector<std::shared_ptr<kln::point>>& points, point_cloud& cloud){
+    /*
+    Copies a vector of individually allocated points into an existing point
+    cloud, which only allocates when it has to grow past its capacity
+    */
+    cloud.resize(points.size());
+    for (std::size_t i=0; i<points.size(); i++){
+        cloud.set(i, *points[i]);
+    }
+}
+
+
+point_cloud to_point_cloud(const std::vector<std::shared_ptr<kln::point>>& points){
+    /*
+    Copies a vector of individually allocated points into a contiguous point cloud
+    */
+    point_cloud cloud;
+    to_point_cloud(points, cloud);
+    return cloud;
+}
+
+
+void append_to_shared_points(point_cloud_view cloud, std::vector<std::shared_ptr<kln::point>>& points){
+    /*
+    Appends the contents of a point cloud to a vector of individually allocated points
+    */
+    points.reserve(points.size() + cloud.size());
+    for (std::size_t i=0; i<cloud.size(); i++){
+        points.push_back(std::make_shared<kln::point>(cloud[i]));
+    }
+}
@@ -0,0 +1,539 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "point_cloud.h"
+
+
+/*
+Binary point and correspondence files. A file is a fixed header followed by
+chunks of up to chunk_capacity records. Each chunk holds its own header and
+then the records as structure-of-arrays: x, y, z and w of the world points
+and, for correspondence files, x, y, z and w of the camera points. Every
+array starts on a POINT_CLOUD_ALIGNMENT boundary, so a memory mapped file
+hands out point_cloud_views straight into the mapping that the projection
+and solver functions take without copying. Values are stored in the native
+byte order, which the magic number guards against.
+
+Each chunk carries a 64 bit FNV-1a checksum of its coordinates, taken a 32
+bit word at a time, and the file header a checksum over the chunk checksums.
+The writer streams one chunk at a time and fills in the header on close, so
+neither writing nor reading with point_file_reader needs more than a chunk
+in memory.
+*/
+
+
+constexpr std::uint32_t point_file_magic = 0x50504b4b; // "KKPP"
+constexpr std::uint32_t point_file_version = 1;
+
+
+/// What each record of a point file holds
+enum class point_file_layout : std::uint32_t {
+    // World points only
+    points = 1,
+    // World points and the camera points they are observed at
+    correspondences = 2
+};
+
+
+/// Header at the start of every point file
+struct point_file_header {
+    std::uint32_t magic = point_file_magic;
+    std::uint32_t version = point_file_version;
+    std::uint32_t layout = static_cast<std::uint32_t>(point_file_layout::points);
+    std::uint32_t alignment = POINT_CLOUD_ALIGNMENT;
+    std::uint64_t count = 0;
+    std::uint64_t num_chunks = 0;
+    std::uint64_t chunk_capacity = 0;
+    std::uint64_t checksum = 0;
+    std::uint64_t reserved[2] = {0, 0};
+};
+
+
+/// Header in front of the arrays of every chunk
+struct point_chunk_header {
+    std::uint64_t count = 0;
+    std::uint64_t checksum = 0;
+    // Bytes of arrays and padding following this header
+    std::uint64_t payload_size = 0;
+    std::uint64_t reserved = 0;
+};
+
+
+static_assert(sizeof(point_file_header) % POINT_CLOUD_ALIGNMENT == 0, "chunks must start aligned");
+static_assert(sizeof(point_chunk_header) % POINT_CLOUD_ALIGNMENT == 0, "arrays must start aligned");
+
+
+constexpr std::uint64_t fnv_offset_basis = 0xcbf29ce484222325ull;
+constexpr std::uint64_t fnv_prime = 0x100000001b3ull;
+
+
+std::uint64_t checksum_floats(const float* data, std::size_t n, std::uint64_t hash){
+    /*
+    Folds n floats into an FNV-1a hash a 32 bit word at a time
+    */
+    for (std::size_t i=0; i<n; i++){
+        std::uint32_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word)*fnv_prime;
+    }
+    return hash;
+}
+
+
+std::uint64_t checksum_word(std::uint64_t word, std::uint64_t hash){
+    return (hash ^ word)*fnv_prime;
+}
+
+
+std::size_t point_file_arrays(point_file_layout layout){
+    return (layout == point_file_layout::correspondences) ? 8 : 4;
+}
+
+
+std::uint64_t padded_array_size(std::uint64_t count){
+    /*
+    Bytes taken by an array of count floats padded to the alignment
+    */
+    const std::uint64_t bytes = count*sizeof(float);
+    return (bytes + POINT_CLOUD_ALIGNMENT - 1)/POINT_CLOUD_ALIGNMENT*POINT_CLOUD_ALIGNMENT;
+}
+
+
+std::uint64_t chunk_checksum(point_cloud_view points, point_cloud_view camera_points){
+    std::uint64_t hash = fnv_offset_basis;
+    const float* arrays[8] = {points.x, points.y, points.z, points.w,
+                              camera_points.x, camera_points.y, camera_points.z, camera_points.w};
+    const std::size_t num_arrays = camera_points.empty() ? 4 : 8;
+    for (std::size_t k=0; k<num_arrays; k++){
+        hash = checksum_floats(arrays[k], points.size(), hash);
+    }
+    return hash;
+}
+
+
+class point_file_writer {
+    /*
+    Streams points or correspondences to a file, buffering a chunk at a time.
+    The header is only valid once close has returned true, which the
+    destructor calls if it has not been already.
+    */
+public:
+    point_file_writer() = default;
+
+    point_file_writer(const std::string& path, point_file_layout layout, std::size_t chunk_capacity=1 << 20){
+        open(path, layout, chunk_capacity);
+    }
+
+    point_file_writer(const point_file_writer&) = delete;
+    point_file_writer& operator=(const point_file_writer&) = delete;
+
+    ~point_file_writer(){
+        close();
+    }
+
+    bool open(const std::string& path, point_file_layout layout, std::size_t chunk_capacity=1 << 20){
+        close();
+        file_.open(path, std::ios::binary | std::ios::trunc);
+        header_ = point_file_header();
+        header_.layout = static_cast<std::uint32_t>(layout);
+        header_.chunk_capacity = (chunk_capacity == 0) ? 1 : chunk_capacity;
+        file_checksum_ = fnv_offset_basis;
+        points_.clear();
+        camera_points_.clear();
+        points_.reserve(header_.chunk_capacity);
+        if (layout == point_file_layout::correspondences){
+            camera_points_.reserve(header_.chunk_capacity);
+        }
+        // Written again with the final counts on close
+        file_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+        return is_open();
+    }
+
+    bool is_open() const { return file_.is_open() && file_.good(); }
+
+    bool write(point_cloud_view points){
+        /*
+        Appends world points to a points file
+        */
+        if (!is_open() || layout() != point_file_layout::points){
+            return false;
+        }
+        return append(points, point_cloud_view());
+    }
+
+    bool write(point_cloud_view points, point_cloud_view camera_points){
+        /*
+        Appends correspondences to a correspondence file
+        */
+        if (!is_open() || layout() != point_file_layout::correspondences || points.size() != camera_points.size()){
+            return false;
+        }
+        return append(points, camera_points);
+    }
+
+    bool close(){
+        /*
+        Writes out the last partial chunk and the final header
+        */
+        if (!file_.is_open()){
+            return false;
+        }
+        flush_chunk();
+        header_.checksum = checksum_word(header_.count, file_checksum_);
+        file_.seekp(0);
+        file_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+        bool ok = file_.good();
+        file_.close();
+        return ok;
+    }
+
+private:
+    point_file_layout layout() const { return static_cast<point_file_layout>(header_.layout); }
+
+    bool append(point_cloud_view points, point_cloud_view camera_points){
+        const bool correspondences = !camera_points.empty();
+        std::size_t offset = 0;
+        while (offset < points.size()){
+            std::size_t n = std::min<std::size_t>(points.size() - offset, header_.chunk_capacity - points_.size());
+            for (std::size_t i=offset; i<offset + n; i++){
+                points_.push_back(points.x[i], points.y[i], points.z[i], points.w[i]);
+                if (correspondences){
+                    camera_points_.push_back(camera_points.x[i], camera_points.y[i],
+                                             camera_points.z[i], camera_points.w[i]);
+                }
+            }
+            offset += n;
+            if (points_.size() == header_.chunk_capacity){
+                flush_chunk();
+            }
+        }
+        return is_open();
+    }
+
+    void write_array(const aligned_float_vector& values){
+        static const char padding[POINT_CLOUD_ALIGNMENT] = {};
+        const std::uint64_t bytes = values.size()*sizeof(float);
+        file_.write(reinterpret_cast<const char*>(values.data()), bytes);
+        file_.write(padding, padded_array_size(values.size()) - bytes);
+    }
+
+    void flush_chunk(){
+        if (points_.empty()){
+            return;
+        }
+        point_chunk_header chunk;
+        chunk.count = points_.size();
+        chunk.checksum = chunk_checksum(points_, camera_points_);
+        chunk.payload_size = point_file_arrays(layout())*padded_array_size(chunk.count);
+        file_.write(reinterpret_cast<const char*>(&chunk), sizeof(chunk));
+        write_array(points_.x);
+        write_array(points_.y);
+        write_array(points_.z);
+        write_array(points_.w);
+        if (layout() == point_file_layout::correspondences){
+            write_array(camera_points_.x);
+            write_array(camera_points_.y);
+            write_array(camera_points_.z);
+            write_array(camera_points_.w);
+        }
+        header_.count += chunk.count;
+        header_.num_chunks++;
+        file_checksum_ = checksum_word(chunk.checksum, file_checksum_);
+        points_.clear();
+        camera_points_.clear();
+    }
+
+    std::ofstream file_;
+    point_file_header header_;
+    std::uint64_t file_checksum_ = fnv_offset_basis;
+    point_cloud points_;
+    point_cloud camera_points_;
+};
+
+
+bool valid_point_file_header(const point_file_header& header){
+    return header.magic == point_file_magic && header.version == point_file_version
+        && header.alignment == POINT_CLOUD_ALIGNMENT && header.chunk_capacity > 0
+        && (header.layout == static_cast<std::uint32_t>(point_file_layout::points)
+            || header.layout == static_cast<std::uint32_t>(point_file_layout::correspondences));
+}
+
+
+class point_file_reader {
+    /*
+    Streams a point file a chunk at a time into caller owned point clouds,
+    which are reused between chunks, checking each chunk's checksum
+    */
+public:
+    point_file_reader() = default;
+
+    explicit point_file_reader(const std::string& path){
+        open(path);
+    }
+
+    bool open(const std::string& path){
+        file_.close();
+        file_.clear();
+        file_.open(path, std::ios::binary | std::ios::ate);
+        chunks_read_ = 0;
+        failed_ = false;
+        file_checksum_ = fnv_offset_basis;
+        // Chunks are checked against the bytes left before anything is sized by them
+        remaining_ = file_.is_open() ? static_cast<std::uint64_t>(file_.tellg()) : 0;
+        file_.seekg(0);
+        file_.read(reinterpret_cast<char*>(&header_), sizeof(header_));
+        if (!file_.good() || !valid_point_file_header(header_)){
+            failed_ = true;
+            file_.close();
+            return false;
+        }
+        remaining_ -= sizeof(header_);
+        return true;
+    }
+
+    const point_file_header& header() const noexcept { return header_; }
+    std::size_t size() const noexcept { return header_.count; }
+    point_file_layout layout() const noexcept { return static_cast<point_file_layout>(header_.layout); }
+
+    // Set when a chunk could not be read or failed its checksum
+    bool failed() const noexcept { return failed_; }
+
+    bool next(point_cloud& points){
+        point_cloud unused;
+        return layout() == point_file_layout::points && next(points, unused);
+    }
+
+    bool next(point_cloud& points, point_cloud& camera_points){
+        /*
+        Reads the next chunk, returning false at the end of the file or on
+        failure. Once the last chunk has been read the file checksum is
+        checked as well.
+        */
+        if (failed_ || !file_.is_open() || chunks_read_ == header_.num_chunks){
+            return false;
+        }
+        point_chunk_header chunk;
+        file_.read(reinterpret_cast<char*>(&chunk), sizeof(chunk));
+        const bool correspondences = (layout() == point_file_layout::correspondences);
+        if (!file_.good() || sizeof(chunk) > remaining_
+            || chunk.count > header_.chunk_capacity || chunk.count > remaining_/sizeof(float)
+            || chunk.payload_size != point_file_arrays(layout())*padded_array_size(chunk.count)
+            || chunk.payload_size > remaining_ - sizeof(chunk)){
+            failed_ = true;
+            return false;
+        }
+        remaining_ -= sizeof(chunk) + chunk.payload_size;
+        points.resize(chunk.count);
+        read_array(points.x);
+        read_array(points.y);
+        read_array(points.z);
+        read_array(points.w);
+        if (correspondences){
+            camera_points.resize(chunk.count);
+            read_array(camera_points.x);
+            read_array(camera_points.y);
+            read_array(camera_points.z);
+            read_array(camera_points.w);
+        }
+        const point_cloud_view camera_view = correspondences ? camera_points.view() : point_cloud_view();
+        if (!file_.good() || chunk_checksum(points, camera_view) != chunk.checksum){
+            failed_ = true;
+            return false;
+        }
+        file_checksum_ = checksum_word(chunk.checksum, file_checksum_);
+        chunks_read_++;
+        if (chunks_read_ == header_.num_chunks && checksum_word(header_.count, file_checksum_) != header_.checksum){
+            failed_ = true;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    void read_array(aligned_float_vector& values){
+        const std::uint64_t bytes = values.size()*sizeof(float);
+        file_.read(reinterpret_cast<char*>(values.data()), bytes);
+        file_.ignore(padded_array_size(values.size()) - bytes);
+    }
+
+    std::ifstream file_;
+    point_file_header header_;
+    std::uint64_t chunks_read_ = 0;
+    // Bytes of the file after what has been read so far
+    std::uint64_t remaining_ = 0;
+    std::uint64_t file_checksum_ = fnv_offset_basis;
+    bool failed_ = false;
+};
+
+
+class mapped_point_file {
+    /*
+    Read only memory mapping of a point file. The views it hands out point
+    into the mapping and stay valid until the file is closed, pages are only
+    read from disk as they are touched. open checks the structure of the
+    file, verify additionally checks every checksum.
+    */
+public:
+    mapped_point_file() = default;
+
+    explicit mapped_point_file(const std::string& path){
+        open(path);
+    }
+
+    mapped_point_file(const mapped_point_file&) = delete;
+    mapped_point_file& operator=(const mapped_point_file&) = delete;
+
+    ~mapped_point_file(){
+        close();
+    }
+
+    bool open(const std::string& path){
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0){
+            return false;
+        }
+        struct stat status;
+        if (::fstat(fd, &status) != 0 || static_cast<std::size_t>(status.st_size) < sizeof(point_file_header)){
+            ::close(fd);
+            return false;
+        }
+        size_ = static_cast<std::size_t>(status.st_size);
+        void* data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED){
+            size_ = 0;
+            return false;
+        }
+        data_ = static_cast<const char*>(data);
+        if (!index_chunks()){
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close(){
+        if (data_ != nullptr){
+            ::munmap(const_cast<char*>(data_), size_);
+        }
+        data_ = nullptr;
+        size_ = 0;
+        chunks_.clear();
+    }
+
+    bool is_open() const noexcept { return data_ != nullptr; }
+
+    const point_file_header& header() const noexcept {
+        /*
+        Header of the mapped file, or of an empty file when none is open
+        */
+        static const point_file_header closed;
+        return is_open() ? *reinterpret_cast<const point_file_header*>(data_) : closed;
+    }
+
+    std::size_t size() const noexcept { return header().count; }
+    std::size_t num_chunks() const noexcept { return chunks_.size(); }
+    point_file_layout layout() const noexcept { return static_cast<point_file_layout>(header().layout); }
+
+    point_cloud_view points(std::size_t chunk=0) const noexcept {
+        /*
+        World points of a chunk, for a single chunk file all of them and for
+        a file without chunks none
+        */
+        return array_view(chunk, 0);
+    }
+
+    point_cloud_view camera_points(std::size_t chunk=0) const noexcept {
+        /*
+        Camera points of a chunk of a correspondence file, empty otherwise
+        */
+        if (layout() != point_file_layout::correspondences){
+            return point_cloud_view();
+        }
+        return array_view(chunk, 4);
+    }
+
+    bool verify() const {
+        /*
+        Checks the checksum of every chunk and of the file
+        */
+        if (!is_open()){
+            return false;
+        }
+        std::uint64_t file_checksum = fnv_offset_basis;
+        for (std::size_t c=0; c<chunks_.size(); c++){
+            const point_chunk_header& chunk = chunk_header(c);
+            if (chunk_checksum(points(c), camera_points(c)) != chunk.checksum){
+                return false;
+            }
+            file_checksum = checksum_word(chunk.checksum, file_checksum);
+        }
+        return checksum_word(header().count, file_checksum) == header().checksum;
+    }
+
+private:
+    const point_chunk_header& chunk_header(std::size_t chunk) const noexcept {
+        return *reinterpret_cast<const point_chunk_header*>(data_ + chunks_[chunk]);
+    }
+
+    point_cloud_view array_view(std::size_t chunk, std::size_t first_array) const noexcept {
+        if (chunk >= chunks_.size()){
+            return point_cloud_view();
+        }
+        const point_chunk_header& header = chunk_header(chunk);
+        const char* payload = data_ + chunks_[chunk] + sizeof(point_chunk_header);
+        const std::uint64_t stride = padded_array_size(header.count);
+        const float* arrays[4];
+        for (std::size_t k=0; k<4; k++){
+            arrays[k] = reinterpret_cast<const float*>(payload + (first_array + k)*stride);
+        }
+        return {arrays[0], arrays[1], arrays[2], arrays[3], static_cast<std::size_t>(header.count)};
+    }
+
+    bool index_chunks(){
+        /*
+        Walks the chunk headers, recording where each chunk starts and
+        checking that every chunk lies within the file. The chunk count is
+        checked against the file size before anything is sized by it.
+        */
+        const point_file_header& file_header = header();
+        if (!valid_point_file_header(file_header)
+            || file_header.num_chunks > (size_ - sizeof(point_file_header))/sizeof(point_chunk_header)){
+            return false;
+        }
+        const std::uint64_t num_arrays = point_file_arrays(layout());
+        std::uint64_t offset = sizeof(point_file_header);
+        std::uint64_t count = 0;
+        chunks_.reserve(file_header.num_chunks);
+        for (std::uint64_t c=0; c<file_header.num_chunks; c++){
+            if (sizeof(point_chunk_header) > size_ - offset){
+                return false;
+            }
+            const point_chunk_header& chunk = *reinterpret_cast<const point_chunk_header*>(data_ + offset);
+            if (chunk.count > file_header.chunk_capacity || chunk.count > size_/sizeof(float)
+                || chunk.payload_size != num_arrays*padded_array_size(chunk.count)
+                || chunk.payload_size > size_ - offset - sizeof(point_chunk_header)){
+                return false;
+            }
+            chunks_.push_back(offset);
+            count += chunk.count;
+            offset += sizeof(point_chunk_header) + chunk.payload_size;
+        }
+        return count == file_header.count;
+    }
+
+    const char* data_ = nullptr;
+    std::size_t size_ = 0;
+    // Byte offset of every chunk header
+    std::vector<std::uint64_t> chunks_;
+};
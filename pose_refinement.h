@@ -0,0 +1,414 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <klein/klein.hpp>
+#include "batched_maps.h"
+#include "chart_policy.h"
+#include "point_cloud.h"
+#include "projection_kernels.h"
+#include "simd_batch.h"
+
+
+/*
+Fixed size Levenberg-Marquardt, or Gauss-Newton, refinement of a single
+camera motor without ceres. Instead of a (2n)x6 jacobian the solver
+accumulates the normal equations J^T W J and J^T W r and the cost in one SIMD
+pass over the correspondences, in double straight from the stored floats, so
+an iteration is that pass and a 6x6 Cholesky solve on the stack and nothing
+is allocated.
+
+The residuals are camera_point - projected_point as in
+ReprojectionCostFunction and the cost is half the sum over correspondences
+of rho(|r|^2), with rho the identity or the Huber loss of ceres::HuberLoss
+applied per correspondence, which enters the normal equations as the
+weight rho'. Steps xi are taken in the camera frame, R <- R*(1 + xi) to first
+order, for which a point q = (X, Y, Z, W) in the camera frame moves by
+dq = 2(w x q + W u) with xi = u + w, and are composed on to the motor through
+the chart, R <- R*chart(2 step_scale xi), keeping the chart near the identity
+as MotorManifold does.
+*/
+
+
+/// Iteration used by refine_pose
+enum class pose_step_strategy {
+    // Damped steps, rejected and retried with more damping if the cost grows
+    levenberg_marquardt,
+    // Undamped steps, always taken
+    gauss_newton
+};
+
+
+/// Configuration of the fixed size pose solver
+struct pose_refinement_options {
+    motor_chart chart = motor_chart::outer_exp;
+    pose_step_strategy strategy = pose_step_strategy::levenberg_marquardt;
+    int max_num_iterations = 50;
+    double function_tolerance = 1e-6;
+    double gradient_tolerance = 1e-10;
+    double parameter_tolerance = 1e-8;
+    // Damping of the first step relative to the diagonal of J^T J, the
+    // inverse of the initial trust region radius in ceres terms
+    double initial_damping = 1e-4;
+    // Residual norm, in image plane units, above which the Huber loss down
+    // weights a correspondence, 0 for plain least squares
+    double huber_scale = 0.0;
+};
+
+
+/// Outcome of refine_pose
+struct pose_refinement_result {
+    kln::motor motor;
+    double initial_cost = 0.0;
+    double final_cost = 0.0;
+    int num_iterations = 0;
+    // One of the tolerances was met within the iteration budget
+    bool converged = false;
+    // The motor and cost are finite
+    bool usable = false;
+};
+
+
+/// Normal equations of a pose step
+struct pose_normal_equations {
+    // Row major upper triangle of J^T W J
+    double hessian[21];
+    // J^T W r
+    double gradient[6];
+    double cost;
+};
+
+
+template <bool Huber, typename V>
+std::size_t accumulate_pose_batches(const double matrix[12], double huber_scale,
+                                    point_cloud_view points, point_cloud_view camera_points,
+                                    std::size_t begin, std::size_t end, pose_normal_equations& equations){
+    /*
+    Adds whole batches of V::width correspondences from begin to the normal
+    equations, returning the index of the first correspondence left over
+    */
+    V m[12];
+    for (int k=0; k<12; k++){
+        m[k] = V::broadcast(matrix[k]);
+    }
+    const V zero = V::broadcast(0.0);
+    const V one = V::broadcast(1.0);
+    const V two = V::broadcast(2.0);
+    const V delta = V::broadcast(huber_scale);
+    V hessian[21];
+    V gradient[6];
+    V cost = zero;
+    for (int k=0; k<21; k++){
+        hessian[k] = zero;
+    }
+    for (int k=0; k<6; k++){
+        gradient[k] = zero;
+    }
+
+    std::size_t i = begin;
+    for (; i + V::width <= end; i += V::width){
+        const V x = V::load(points.x + i);
+        const V y = V::load(points.y + i);
+        const V z = V::load(points.z + i);
+        const V w = V::load(points.w + i);
+        const V X = m[0]*x + m[1]*y + m[2]*z + m[3]*w;
+        const V Y = m[4]*x + m[5]*y + m[6]*z + m[7]*w;
+        const V Z = m[8]*x + m[9]*y + m[10]*z + m[11]*w;
+        const V inv_Z = one/Z;
+        const V u = X*inv_Z;
+        const V v = Y*inv_Z;
+        const V ru = V::load(camera_points.x + i) - u;
+        const V rv = V::load(camera_points.y + i) - v;
+
+        // Rows of dr/dxi, {e01, e02, e03, e23, e31, e12}
+        const V t = two*w*inv_Z;
+        const V uv2 = two*u*v;
+        const V ju[6] = {-t, zero, t*u, uv2, -(two + two*u*u), two*v};
+        const V jv[6] = {zero, -t, t*v, two + two*v*v, -uv2, -two*u};
+
+        const V s = ru*ru + rv*rv;
+        V weight = one;
+        V rho = s;
+        if constexpr (Huber){
+            const V norm = sqrt(s);
+            const V clipped = min(norm, delta);
+            rho = clipped*(two*norm - clipped);
+            weight = delta/max(norm, delta);
+        }
+        int n = 0;
+        for (int a=0; a<6; a++){
+            const V wu = weight*ju[a];
+            const V wv = weight*jv[a];
+            for (int b=a; b<6; b++){
+                hessian[n] = hessian[n] + wu*ju[b] + wv*jv[b];
+                n++;
+            }
+            gradient[a] = gradient[a] + wu*ru + wv*rv;
+        }
+        cost = cost + rho;
+    }
+
+    double lanes[V::width];
+    auto reduce = [&lanes](const V& a){
+        a.store(lanes);
+        double sum = 0.0;
+        for (std::size_t k=0; k<V::width; k++){
+            sum += lanes[k];
+        }
+        return sum;
+    };
+    for (int k=0; k<21; k++){
+        equations.hessian[k] += reduce(hessian[k]);
+    }
+    for (int k=0; k<6; k++){
+        equations.gradient[k] += reduce(gradient[k]);
+    }
+    equations.cost += 0.5*reduce(cost);
+    return i;
+}
+
+
+#if defined(SIMD_BATCH_RUNTIME_AVX2)
+template <bool Huber>
+SIMD_BATCH_AVX2_DRIVER std::size_t accumulate_pose_batches_avx2(const double matrix[12], double huber_scale,
+                                                                point_cloud_view points,
+                                                                point_cloud_view camera_points,
+                                                                std::size_t begin, std::size_t end,
+                                                                pose_normal_equations& equations){
+    return accumulate_pose_batches<Huber, avx2_double_batch>(matrix, huber_scale, points, camera_points,
+                                                             begin, end, equations);
+}
+#endif
+
+
+template <bool Huber>
+void accumulate_pose_equations(const double matrix[12], double huber_scale,
+                               point_cloud_view points, point_cloud_view camera_points,
+                               pose_normal_equations& equations){
+    std::size_t i = 0;
+#if defined(SIMD_BATCH_RUNTIME_AVX2)
+    if (cpu_supports_avx2()){
+        i = accumulate_pose_batches_avx2<Huber>(matrix, huber_scale, points, camera_points,
+                                                i, points.size(), equations);
+    }
+#endif
+    i = accumulate_pose_batches<Huber, double_batch>(matrix, huber_scale, points, camera_points,
+                                                     i, points.size(), equations);
+    accumulate_pose_batches<Huber, scalar_batch<double>>(matrix, huber_scale, points, camera_points,
+                                                         i, points.size(), equations);
+}
+
+
+pose_normal_equations pose_equations(const double motor[8], double huber_scale,
+                                     point_cloud_view points, point_cloud_view camera_points){
+    /*
+    Normal equations and cost of the correspondences for the camera at motor
+    */
+    double reverse[8];
+    double matrix[12];
+    motor_reverse(motor, reverse);
+    motor_to_mat3x4(reverse, matrix);
+    pose_normal_equations equations = {};
+    if (huber_scale > 0.0){
+        accumulate_pose_equations<true>(matrix, huber_scale, points, camera_points, equations);
+    }
+    else{
+        accumulate_pose_equations<false>(matrix, huber_scale, points, camera_points, equations);
+    }
+    return equations;
+}
+
+
+bool solve_pose_step(const pose_normal_equations& equations, double damping, double step[6]){
+    /*
+    Solves (J^T W J + damping D) step = -J^T W r by Cholesky, with D the
+    diagonal of J^T W J clamped as ceres does. Returns false if the system
+    is not positive definite.
+    */
+    double L[6][6];
+    int n = 0;
+    for (int a=0; a<6; a++){
+        for (int b=a; b<6; b++){
+            L[b][a] = equations.hessian[n++];
+        }
+        L[a][a] += damping*std::min(std::max(L[a][a], 1e-6), 1e32);
+    }
+    for (int j=0; j<6; j++){
+        double d = L[j][j];
+        for (int k=0; k<j; k++){
+            d -= L[j][k]*L[j][k];
+        }
+        if (!(d > 0.0)){
+            return false;
+        }
+        L[j][j] = std::sqrt(d);
+        for (int i=j + 1; i<6; i++){
+            double s = L[i][j];
+            for (int k=0; k<j; k++){
+                s -= L[i][k]*L[j][k];
+            }
+            L[i][j] = s/L[j][j];
+        }
+    }
+    for (int i=0; i<6; i++){
+        double s = -equations.gradient[i];
+        for (int k=0; k<i; k++){
+            s -= L[i][k]*step[k];
+        }
+        step[i] = s/L[i][i];
+    }
+    for (int i=5; i>=0; i--){
+        double s = step[i];
+        for (int k=i + 1; k<6; k++){
+            s -= L[k][i]*step[k];
+        }
+        step[i] = s/L[i][i];
+    }
+    return true;
+}
+
+
+double predicted_reduction(const pose_normal_equations& equations, const double step[6]){
+    /*
+    Decrease of the cost predicted by the undamped quadratic model,
+    -(g.step + step.H.step/2)
+    */
+    double linear = 0.0;
+    double quadratic = 0.0;
+    int n = 0;
+    for (int a=0; a<6; a++){
+        linear += equations.gradient[a]*step[a];
+        for (int b=a; b<6; b++){
+            double h = equations.hessian[n++]*step[a]*step[b];
+            quadratic += (a == b) ? 0.5*h : h;
+        }
+    }
+    return -(linear + quadratic);
+}
+
+
+template <typename Chart>
+void compose_pose_step(const double motor[8], const double step[6], double out[8]){
+    /*
+    motor*chart(2 step_scale xi), which moves the camera by 1 + xi to first order
+    */
+    using W = scalar_batch<double>;
+    W phi[6];
+    W local[8];
+    W composed[8];
+    W reference[8];
+    for (int k=0; k<6; k++){
+        phi[k] = {2.0*Chart::step_scale*step[k]};
+    }
+    for (int k=0; k<8; k++){
+        reference[k] = {motor[k]};
+    }
+    Chart::map(phi, local);
+    motor_product(reference, local, composed);
+    normalize_motor(composed);
+    for (int k=0; k<8; k++){
+        out[k] = composed[k].v;
+    }
+}
+
+
+template <typename Chart>
+pose_refinement_result refine_pose(const kln::motor& initial,
+                                   point_cloud_view points,
+                                   point_cloud_view camera_points,
+                                   const pose_refinement_options& options=pose_refinement_options()){
+    /*
+    Refines the camera motor by minimising the reprojection error of the
+    correspondences, with the steps composed through a chart fixed at compile
+    time. The chart field of the options is ignored.
+    */
+    using W = scalar_batch<double>;
+    const bool gauss_newton = (options.strategy == pose_step_strategy::gauss_newton);
+    W start[8] = {{initial.scalar()}, {initial.e23()}, {initial.e31()}, {initial.e12()},
+                  {initial.e01()}, {initial.e02()}, {initial.e03()}, {initial.e0123()}};
+    normalize_motor(start);
+    double motor[8];
+    for (int k=0; k<8; k++){
+        motor[k] = start[k].v;
+    }
+
+    pose_refinement_result result;
+    pose_normal_equations current = pose_equations(motor, options.huber_scale, points, camera_points);
+    result.initial_cost = current.cost;
+    double damping = gauss_newton ? 0.0 : options.initial_damping;
+    double growth = 2.0;
+    int iteration = 0;
+    while (iteration < options.max_num_iterations && std::isfinite(current.cost)){
+        double gradient_norm = 0.0;
+        for (int k=0; k<6; k++){
+            gradient_norm = std::max(gradient_norm, std::abs(current.gradient[k]));
+        }
+        if (gradient_norm <= options.gradient_tolerance){
+            result.converged = true;
+            break;
+        }
+        iteration++;
+
+        double step[6];
+        if (!solve_pose_step(current, damping, step)){
+            if (gauss_newton){
+                break;
+            }
+            damping *= growth;
+            growth *= 2.0;
+            continue;
+        }
+        double step_norm = 0.0;
+        for (int k=0; k<6; k++){
+            step_norm += step[k]*step[k];
+        }
+        if (std::sqrt(step_norm) <= options.parameter_tolerance*(1.0 + options.parameter_tolerance)){
+            result.converged = true;
+            break;
+        }
+
+        double candidate[8];
+        compose_pose_step<Chart>(motor, step, candidate);
+        const pose_normal_equations next = pose_equations(candidate, options.huber_scale, points, camera_points);
+        const double reduction = current.cost - next.cost;
+        const double predicted = predicted_reduction(current, step);
+        if (!gauss_newton && !(reduction > 0.0 && predicted > 0.0)){
+            damping *= growth;
+            growth *= 2.0;
+            continue;
+        }
+        if (!gauss_newton){
+            // Nielsen's update of the damping from the gain ratio
+            const double gain = 2.0*reduction/predicted - 1.0;
+            damping *= std::max(1.0/3.0, 1.0 - gain*gain*gain);
+            growth = 2.0;
+        }
+        const double previous_cost = current.cost;
+        std::copy(candidate, candidate + 8, motor);
+        current = next;
+        if (std::abs(reduction) <= options.function_tolerance*previous_cost){
+            result.converged = true;
+            break;
+        }
+    }
+
+    result.motor = kln::motor{static_cast<float>(motor[0]), static_cast<float>(motor[1]),
+                              static_cast<float>(motor[2]), static_cast<float>(motor[3]),
+                              static_cast<float>(motor[4]), static_cast<float>(motor[5]),
+                              static_cast<float>(motor[6]), static_cast<float>(motor[7])};
+    result.final_cost = current.cost;
+    result.num_iterations = iteration;
+    result.usable = std::isfinite(current.cost);
+    return result;
+}
+
+
+pose_refinement_result refine_pose(const kln::motor& initial,
+                                   point_cloud_view points,
+                                   point_cloud_view camera_points,
+                                   const pose_refinement_options& options=pose_refinement_options()){
+    return with_chart(options.chart, [&](auto policy){
+        return refine_pose<decltype(policy)>(initial, points, camera_points, options);
+    });
+}
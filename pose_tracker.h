@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstddef>
+#include <klein/klein.hpp>
+#include "point_cloud.h"
+#include "camera_ops.h"
+#include "rigid_body.h"
+#include "simd_batch.h"
+
+
+pose_solver_options tracking_solver_options(){
+    /*
+    Refinement settings suited to warm started tracking, a handful of
+    iterations from a prediction that is already close
+    */
+    pose_solver_options options;
+    options.parameterization = pose_parameterization::manifold;
+    options.chart = motor_chart::cayley;
+    options.max_num_iterations = 5;
+    return options;
+}
+
+
+/// Configuration of frame to frame pose tracking
+struct pose_tracker_options {
+    // Refinement run on every frame, by default on the motor manifold so the
+    // chart is taken around the prediction, with the iterations capped to
+    // bound the latency of a frame
+    pose_solver_options solver = tracking_solver_options();
+    // Runge-Kutta steps used to integrate the prediction over one frame
+    int prediction_steps = 1;
+    // Weight of the newest frame in the running velocity estimate, 1 keeps
+    // only the motion between the last two frames
+    float velocity_smoothing = 1.0f;
+    // Consecutive frames without a usable refinement after which the track
+    // is reported lost, until then it coasts on the prediction
+    int max_lost_frames = 5;
+};
+
+
+kln::line motor_velocity(const kln::motor& from, const kln::motor& to, float dt){
+    /*
+    Constant body frame velocity carrying one motor to the other in time dt,
+    to = from*exp(dt omega/2)
+    */
+    kln::motor delta = ~from*to;
+    if (delta.scalar() < 0.0f){
+        delta = -1.0f*delta;
+    }
+    return (2.0f/dt)*kln::log(delta);
+}
+
+
+class pose_tracker {
+    /*
+    Tracks a camera through a sequence of frames. Each frame starts from a
+    prediction that integrates the chart kinematics of the previous motor at
+    the estimated body frame velocity, R' = R omega/2, and then runs a short
+    refinement. The pose solver workspace is kept between frames, so as long
+    as the number of correspondences stays the same the ceres problem, its
+    residual blocks and all scratch buffers are reused and a frame costs a
+    few cost function evaluations and small dense solves.
+    */
+public:
+    explicit pose_tracker(const pose_tracker_options& options=pose_tracker_options())
+        : options_(options)
+    {}
+
+    void reset(const kln::motor& R, const kln::line& velocity=kln::line{0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f}){
+        /*
+        Starts a new track, for example from a PnP estimate of the first frame
+        */
+        motor_ = R;
+        velocity_ = velocity;
+        lost_frames_ = 0;
+        tracking_ = true;
+    }
+
+    // Cleared once max_lost_frames consecutive frames failed to refine, the
+    // track then stays lost until a reset from a fresh estimate
+    bool tracking() const noexcept { return tracking_; }
+    int lost_frames() const noexcept { return lost_frames_; }
+    const kln::motor& motor() const noexcept { return motor_; }
+    const kln::line& velocity() const noexcept { return velocity_; }
+    const pose_tracker_options& options() const noexcept { return options_; }
+
+    kln::motor predict(float dt) const {
+        /*
+        Motor after moving at the current velocity for time dt
+        */
+        using V = scalar_batch<float>;
+        const int num_steps = (options_.prediction_steps > 0) ? options_.prediction_steps : 1;
+        const V cross = V::broadcast(-1.0f);
+        const V step = V::broadcast(dt/num_steps);
+        V phi[6] = {V::broadcast(0.0f), V::broadcast(0.0f), V::broadcast(0.0f),
+                    V::broadcast(0.0f), V::broadcast(0.0f), V::broadcast(0.0f)};
+        const V omega[6] = {V::broadcast(velocity_.e01()), V::broadcast(velocity_.e02()), V::broadcast(velocity_.e03()),
+                            V::broadcast(velocity_.e23()), V::broadcast(velocity_.e31()), V::broadcast(velocity_.e12())};
+        return with_chart(options_.solver.chart, [&](auto policy){
+            using Chart = decltype(policy);
+            for (int i=0; i<num_steps; i++){
+                chart_rk4_kernel<Chart>(cross, step, phi, omega);
+            }
+            kln::line phi_line{phi[0].v, phi[1].v, phi[2].v, phi[3].v, phi[4].v, phi[5].v};
+            return motor_*chart_map<Chart>(phi_line);
+        });
+    }
+
+    pose_solver_result track(float dt, point_cloud_view points, point_cloud_view camera_points){
+        /*
+        Refines the pose of the next frame, dt after the previous one. When
+        the refinement does not give a usable solution the track coasts on
+        the prediction and keeps its velocity, and after max_lost_frames
+        such frames in a row it is lost. A lost track refines nothing and
+        returns an unusable result at its last motor until it is reset.
+        Before reset is called the track starts at the identity at rest.
+        */
+        if (!tracking_){
+            pose_solver_result lost;
+            lost.motor = motor_;
+            return lost;
+        }
+        const kln::motor prediction = predict(dt);
+        pose_solver_result result = workspace_.solve(prediction, points, camera_points, options_.solver);
+        if (!result.usable){
+            motor_ = prediction;
+            lost_frames_++;
+            if (lost_frames_ >= options_.max_lost_frames){
+                tracking_ = false;
+            }
+            return result;
+        }
+        if (dt > 0.0f){
+            const float alpha = options_.velocity_smoothing;
+            velocity_ = alpha*motor_velocity(motor_, result.motor, dt) + (1.0f - alpha)*velocity_;
+        }
+        motor_ = result.motor;
+        lost_frames_ = 0;
+        return result;
+    }
+
+private:
+    pose_tracker_options options_;
+    pose_solver_workspace workspace_;
+    kln::motor motor_{1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+    kln::line velocity_{0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+    int lost_frames_ = 0;
+    bool tracking_ = true;
+};
@@ -0,0 +1,346 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <immintrin.h>
+#include <klein/klein.hpp>
+#include "point_cloud.h"
+#include "simd_batch.h"
+
+
+/*
+Batched kernels for mapping points through a motor and onto the standard
+camera plane z = 1. The motor is expanded once into a 3x4 matrix acting on
+homogeneous (x, y, z, w) coordinates, after which every point costs twelve
+multiply-adds and a single division.
+*/
+
+
+template <typename T>
+void motor_to_mat3x4(const T motor[8], T matrix[12]){
+    /*
+    Expands the sandwich R p ~R into a row major 3x4 matrix acting on (x, y, z, w),
+    with the motor given as {scalar, e23, e31, e12, e01, e02, e03, e0123}.
+    The matrix is scaled by the squared norm of the rotor part of R, which
+    cancels in every projective quantity computed from it. Every entry is
+    quadratic in the motor coefficients.
+    */
+    const T a = motor[0];
+    const T b = motor[1];
+    const T c = motor[2];
+    const T d = motor[3];
+    const T e = motor[4];
+    const T f = motor[5];
+    const T g = motor[6];
+    const T h = motor[7];
+
+    matrix[0] = a*a + b*b - c*c - d*d;
+    matrix[1] = T(2)*(b*c + a*d);
+    matrix[2] = T(2)*(b*d - a*c);
+    matrix[3] = T(2)*(c*g - d*f - a*e - h*b);
+
+    matrix[4] = T(2)*(b*c - a*d);
+    matrix[5] = a*a - b*b + c*c - d*d;
+    matrix[6] = T(2)*(c*d + a*b);
+    matrix[7] = T(2)*(d*e - b*g - a*f - h*c);
+
+    matrix[8] = T(2)*(b*d + a*c);
+    matrix[9] = T(2)*(c*d - a*b);
+    matrix[10] = a*a - b*b - c*c + d*d;
+    matrix[11] = T(2)*(b*f - c*e - a*g - h*d);
+}
+
+
+void motor_to_mat3x4(kln::motor const& R, float matrix[12]){
+    /*
+    Expands a klein motor into a row major 3x4 matrix acting on (x, y, z, w)
+    */
+    const float motor[8] = {R.scalar(), R.e23(), R.e31(), R.e12(), 
+                            R.e01(), R.e02(), R.e03(), R.e0123()};
+    motor_to_mat3x4(motor, matrix);
+}
+
+
+template <typename T>
+void image_plane_residuals(const T matrix[12], point_cloud_view points, point_cloud_view camera_points,
+                           T* residuals){
+    /*
+    Residuals camera_point - projected_point of each correspondence with the
+    projection carried out in T, double for refinement or ceres::Jet under
+    automatic differentiation. Only the stored float coordinates are widened.
+    */
+    for (std::size_t i=0; i<points.size(); i++){
+        const T x(points.x[i]);
+        const T y(points.y[i]);
+        const T z(points.z[i]);
+        const T w(points.w[i]);
+        T X = matrix[0]*x + matrix[1]*y + matrix[2]*z + matrix[3]*w;
+        T Y = matrix[4]*x + matrix[5]*y + matrix[6]*z + matrix[7]*w;
+        T Z = matrix[8]*x + matrix[9]*y + matrix[10]*z + matrix[11]*w;
+        T inv_Z = T(1)/Z;
+        residuals[2*i] = T(camera_points.x[i]) - X*inv_Z;
+        residuals[2*i + 1] = T(camera_points.y[i]) - Y*inv_Z;
+    }
+}
+
+
+void project_points(const float matrix[12], point_cloud_view points, float* u, float* v){
+    /*
+    Transforms each point by the 3x4 matrix and performs the perspective
+    divide onto the z = 1 plane, writing the image plane coordinates to u and v
+    */
+    const std::size_t n = points.size();
+    std::size_t i = 0;
+
+#if defined(__AVX2__) && defined(__FMA__)
+    {
+        const __m256 m0 = _mm256_set1_ps(matrix[0]);
+        const __m256 m1 = _mm256_set1_ps(matrix[1]);
+        const __m256 m2 = _mm256_set1_ps(matrix[2]);
+        const __m256 m3 = _mm256_set1_ps(matrix[3]);
+        const __m256 m4 = _mm256_set1_ps(matrix[4]);
+        const __m256 m5 = _mm256_set1_ps(matrix[5]);
+        const __m256 m6 = _mm256_set1_ps(matrix[6]);
+        const __m256 m7 = _mm256_set1_ps(matrix[7]);
+        const __m256 m8 = _mm256_set1_ps(matrix[8]);
+        const __m256 m9 = _mm256_set1_ps(matrix[9]);
+        const __m256 m10 = _mm256_set1_ps(matrix[10]);
+        const __m256 m11 = _mm256_set1_ps(matrix[11]);
+        const __m256 one = _mm256_set1_ps(1.0f);
+        for (; i + 8 <= n; i += 8){
+            __m256 x = _mm256_loadu_ps(points.x + i);
+            __m256 y = _mm256_loadu_ps(points.y + i);
+            __m256 z = _mm256_loadu_ps(points.z + i);
+            __m256 w = _mm256_loadu_ps(points.w + i);
+            __m256 X = _mm256_fmadd_ps(m0, x, _mm256_fmadd_ps(m1, y, _mm256_fmadd_ps(m2, z, _mm256_mul_ps(m3, w))));
+            __m256 Y = _mm256_fmadd_ps(m4, x, _mm256_fmadd_ps(m5, y, _mm256_fmadd_ps(m6, z, _mm256_mul_ps(m7, w))));
+            __m256 Z = _mm256_fmadd_ps(m8, x, _mm256_fmadd_ps(m9, y, _mm256_fmadd_ps(m10, z, _mm256_mul_ps(m11, w))));
+            __m256 inv_Z = _mm256_div_ps(one, Z);
+            _mm256_storeu_ps(u + i, _mm256_mul_ps(X, inv_Z));
+            _mm256_storeu_ps(v + i, _mm256_mul_ps(Y, inv_Z));
+        }
+    }
+#endif
+
+    {
+        const __m128 m0 = _mm_set1_ps(matrix[0]);
+        const __m128 m1 = _mm_set1_ps(matrix[1]);
+        const __m128 m2 = _mm_set1_ps(matrix[2]);
+        const __m128 m3 = _mm_set1_ps(matrix[3]);
+        const __m128 m4 = _mm_set1_ps(matrix[4]);
+        const __m128 m5 = _mm_set1_ps(matrix[5]);
+        const __m128 m6 = _mm_set1_ps(matrix[6]);
+        const __m128 m7 = _mm_set1_ps(matrix[7]);
+        const __m128 m8 = _mm_set1_ps(matrix[8]);
+        const __m128 m9 = _mm_set1_ps(matrix[9]);
+        const __m128 m10 = _mm_set1_ps(matrix[10]);
+        const __m128 m11 = _mm_set1_ps(matrix[11]);
+        const __m128 one = _mm_set1_ps(1.0f);
+        for (; i + 4 <= n; i += 4){
+            __m128 x = _mm_loadu_ps(points.x + i);
+            __m128 y = _mm_loadu_ps(points.y + i);
+            __m128 z = _mm_loadu_ps(points.z + i);
+            __m128 w = _mm_loadu_ps(points.w + i);
+            __m128 X = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m0, x), _mm_mul_ps(m1, y)),
+                                  _mm_add_ps(_mm_mul_ps(m2, z), _mm_mul_ps(m3, w)));
+            __m128 Y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m4, x), _mm_mul_ps(m5, y)),
+                                  _mm_add_ps(_mm_mul_ps(m6, z), _mm_mul_ps(m7, w)));
+            __m128 Z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m8, x), _mm_mul_ps(m9, y)),
+                                  _mm_add_ps(_mm_mul_ps(m10, z), _mm_mul_ps(m11, w)));
+            __m128 inv_Z = _mm_div_ps(one, Z);
+            _mm_storeu_ps(u + i, _mm_mul_ps(X, inv_Z));
+            _mm_storeu_ps(v + i, _mm_mul_ps(Y, inv_Z));
+        }
+    }
+
+    for (; i < n; i++){
+        float x = points.x[i];
+        float y = points.y[i];
+        float z = points.z[i];
+        float w = points.w[i];
+        float X = matrix[0]*x + matrix[1]*y + matrix[2]*z + matrix[3]*w;
+        float Y = matrix[4]*x + matrix[5]*y + matrix[6]*z + matrix[7]*w;
+        float Z = matrix[8]*x + matrix[9]*y + matrix[10]*z + matrix[11]*w;
+        float inv_Z = 1.0f/Z;
+        u[i] = X*inv_Z;
+        v[i] = Y*inv_Z;
+    }
+}
+
+
+void project_points(kln::motor const& R, point_cloud_view points, float* u, float* v){
+    /*
+    Projects points into the camera described by R, equivalent to intersecting
+    the join of (~R)(p) and the origin with the plane z = 1 for every point
+    */
+    float matrix[12];
+    motor_to_mat3x4(~R, matrix);
+    project_points(matrix, points, u, v);
+}
+
+
+std::size_t count_projection_inliers(const float matrix[12], point_cloud_view points, 
+                                     point_cloud_view camera_points, float threshold2,
+                                     std::uint8_t* inlier_mask=nullptr){
+    /*
+    Projects the points and counts those landing within sqrt(threshold2) of
+    their image point while lying in front of the camera. The optional mask
+    receives 1 for inliers and 0 otherwise.
+    */
+    const std::size_t n = points.size();
+    std::size_t i = 0;
+    std::size_t inliers = 0;
+
+#if defined(__AVX2__) && defined(__FMA__)
+    {
+        const __m256 m0 = _mm256_set1_ps(matrix[0]);
+        const __m256 m1 = _mm256_set1_ps(matrix[1]);
+        const __m256 m2 = _mm256_set1_ps(matrix[2]);
+        const __m256 m3 = _mm256_set1_ps(matrix[3]);
+        const __m256 m4 = _mm256_set1_ps(matrix[4]);
+        const __m256 m5 = _mm256_set1_ps(matrix[5]);
+        const __m256 m6 = _mm256_set1_ps(matrix[6]);
+        const __m256 m7 = _mm256_set1_ps(matrix[7]);
+        const __m256 m8 = _mm256_set1_ps(matrix[8]);
+        const __m256 m9 = _mm256_set1_ps(matrix[9]);
+        const __m256 m10 = _mm256_set1_ps(matrix[10]);
+        const __m256 m11 = _mm256_set1_ps(matrix[11]);
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 t2 = _mm256_set1_ps(threshold2);
+        for (; i + 8 <= n; i += 8){
+            __m256 x = _mm256_loadu_ps(points.x + i);
+            __m256 y = _mm256_loadu_ps(points.y + i);
+            __m256 z = _mm256_loadu_ps(points.z + i);
+            __m256 w = _mm256_loadu_ps(points.w + i);
+            __m256 X = _mm256_fmadd_ps(m0, x, _mm256_fmadd_ps(m1, y, _mm256_fmadd_ps(m2, z, _mm256_mul_ps(m3, w))));
+            __m256 Y = _mm256_fmadd_ps(m4, x, _mm256_fmadd_ps(m5, y, _mm256_fmadd_ps(m6, z, _mm256_mul_ps(m7, w))));
+            __m256 Z = _mm256_fmadd_ps(m8, x, _mm256_fmadd_ps(m9, y, _mm256_fmadd_ps(m10, z, _mm256_mul_ps(m11, w))));
+            // Compare |Z*c - X|^2 < t^2*Z^2, avoiding the division
+            __m256 du = _mm256_fmsub_ps(Z, _mm256_loadu_ps(camera_points.x + i), X);
+            __m256 dv = _mm256_fmsub_ps(Z, _mm256_loadu_ps(camera_points.y + i), Y);
+            __m256 err = _mm256_fmadd_ps(du, du, _mm256_mul_ps(dv, dv));
+            __m256 inside = _mm256_and_ps(_mm256_cmp_ps(err, _mm256_mul_ps(t2, _mm256_mul_ps(Z, Z)), _CMP_LT_OQ),
+                                          _mm256_cmp_ps(Z, zero, _CMP_GT_OQ));
+            int bits = _mm256_movemask_ps(inside);
+            inliers += __builtin_popcount(bits);
+            if (inlier_mask != nullptr){
+                for (int k=0; k<8; k++){
+                    inlier_mask[i + k] = (bits >> k) & 1;
+                }
+            }
+        }
+    }
+#endif
+
+    {
+        const __m128 m0 = _mm_set1_ps(matrix[0]);
+        const __m128 m1 = _mm_set1_ps(matrix[1]);
+        const __m128 m2 = _mm_set1_ps(matrix[2]);
+        const __m128 m3 = _mm_set1_ps(matrix[3]);
+        const __m128 m4 = _mm_set1_ps(matrix[4]);
+        const __m128 m5 = _mm_set1_ps(matrix[5]);
+        const __m128 m6 = _mm_set1_ps(matrix[6]);
+        const __m128 m7 = _mm_set1_ps(matrix[7]);
+        const __m128 m8 = _mm_set1_ps(matrix[8]);
+        const __m128 m9 = _mm_set1_ps(matrix[9]);
+        const __m128 m10 = _mm_set1_ps(matrix[10]);
+        const __m128 m11 = _mm_set1_ps(matrix[11]);
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 t2 = _mm_set1_ps(threshold2);
+        for (; i + 4 <= n; i += 4){
+            __m128 x = _mm_loadu_ps(points.x + i);
+            __m128 y = _mm_loadu_ps(points.y + i);
+            __m128 z = _mm_loadu_ps(points.z + i);
+            __m128 w = _mm_loadu_ps(points.w + i);
+            __m128 X = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m0, x), _mm_mul_ps(m1, y)),
+                                  _mm_add_ps(_mm_mul_ps(m2, z), _mm_mul_ps(m3, w)));
+            __m128 Y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m4, x), _mm_mul_ps(m5, y)),
+                                  _mm_add_ps(_mm_mul_ps(m6, z), _mm_mul_ps(m7, w)));
+            __m128 Z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m8, x), _mm_mul_ps(m9, y)),
+                                  _mm_add_ps(_mm_mul_ps(m10, z), _mm_mul_ps(m11, w)));
+            __m128 du = _mm_sub_ps(_mm_mul_ps(Z, _mm_loadu_ps(camera_points.x + i)), X);
+            __m128 dv = _mm_sub_ps(_mm_mul_ps(Z, _mm_loadu_ps(camera_points.y + i)), Y);
+            __m128 err = _mm_add_ps(_mm_mul_ps(du, du), _mm_mul_ps(dv, dv));
+            __m128 inside = _mm_and_ps(_mm_cmplt_ps(err, _mm_mul_ps(t2, _mm_mul_ps(Z, Z))),
+                                       _mm_cmpgt_ps(Z, zero));
+            int bits = _mm_movemask_ps(inside);
+            inliers += __builtin_popcount(bits);
+            if (inlier_mask != nullptr){
+                for (int k=0; k<4; k++){
+                    inlier_mask[i + k] = (bits >> k) & 1;
+                }
+            }
+        }
+    }
+
+    for (; i < n; i++){
+        float x = points.x[i];
+        float y = points.y[i];
+        float z = points.z[i];
+        float w = points.w[i];
+        float X = matrix[0]*x + matrix[1]*y + matrix[2]*z + matrix[3]*w;
+        float Y = matrix[4]*x + matrix[5]*y + matrix[6]*z + matrix[7]*w;
+        float Z = matrix[8]*x + matrix[9]*y + matrix[10]*z + matrix[11]*w;
+        float du = Z*camera_points.x[i] - X;
+        float dv = Z*camera_points.y[i] - Y;
+        bool inside = (du*du + dv*dv < threshold2*Z*Z) && (Z > 0.0f);
+        inliers += inside ? 1 : 0;
+        if (inlier_mask != nullptr){
+            inlier_mask[i] = inside ? 1 : 0;
+        }
+    }
+    return inliers;
+}
+
+
+template <typename V>
+V reprojection_distance_kernel(const V m[12], V x, V y, V z, V w, V cu, V cv){
+    V X = m[0]*x + m[1]*y + m[2]*z + m[3]*w;
+    V Y = m[4]*x + m[5]*y + m[6]*z + m[7]*w;
+    V Z = m[8]*x + m[9]*y + m[10]*z + m[11]*w;
+    V inv_Z = V::broadcast(1.0f)/Z;
+    V du = cu - X*inv_Z;
+    V dv = cv - Y*inv_Z;
+    return sqrt(du*du + dv*dv);
+}
+
+
+float total_reprojection_error(const float matrix[12], point_cloud_view points, point_cloud_view camera_points){
+    /*
+    Sum of the distances between each camera point and its projected point.
+    Projection and accumulation are fused into one pass, so nothing is
+    allocated and the projected points are never stored.
+    */
+    const std::size_t n = points.size();
+    std::size_t i = 0;
+    float total_error = 0.0f;
+    {
+        using V = float_batch;
+        V m[12];
+        for (int j=0; j<12; j++){
+            m[j] = V::broadcast(matrix[j]);
+        }
+        V sum = V::broadcast(0.0f);
+        for (; i + V::width <= n; i += V::width){
+            sum = sum + reprojection_distance_kernel(m, V::load(points.x + i), V::load(points.y + i),
+                                                     V::load(points.z + i), V::load(points.w + i),
+                                                     V::load(camera_points.x + i), V::load(camera_points.y + i));
+        }
+        float lanes[V::width];
+        sum.store(lanes);
+        for (std::size_t k=0; k<V::width; k++){
+            total_error += lanes[k];
+        }
+    }
+    using W = scalar_batch<float>;
+    W m[12];
+    for (int j=0; j<12; j++){
+        m[j] = W::broadcast(matrix[j]);
+    }
+    for (; i < n; i++){
+        total_error += reprojection_distance_kernel(m, W::load(points.x + i), W::load(points.y + i),
+                                                    W::load(points.z + i), W::load(points.w + i),
+                                                    W::load(camera_points.x + i), W::load(camera_points.y + i)).v;
+    }
+    return total_error;
+}
@@ -0,0 +1,349 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <vector>
+#include <klein/klein.hpp>
+#include "point_cloud.h"
+#include "projection_kernels.h"
+#include "pnp.h"
+#include "camera_ops.h"
+
+
+/// Closed form solver generating the hypotheses
+enum class minimal_solver {
+    // Three correspondences for P3P plus one to choose among its solutions
+    p3p,
+    // Six correspondences for the direct linear transform
+    dlt
+};
+
+
+/// Configuration of the robust pose front end
+struct ransac_options {
+    minimal_solver solver = minimal_solver::p3p;
+    // Largest image plane distance at which a correspondence counts as an inlier
+    float inlier_threshold = 2e-3f;
+    // Probability of having drawn at least one all inlier sample on termination
+    double confidence = 0.999;
+    int max_hypotheses = 10000;
+    // The correspondences are sorted by decreasing match quality, sample
+    // progressively from the best ones (PROSAC)
+    bool prosac = false;
+    // Abandon scoring a hypothesis as soon as Wald's sequential probability
+    // ratio test decides it is bad. The correspondences should not be ordered
+    // by anything correlated with being an inlier when this is enabled.
+    bool sprt = true;
+    // Initial guesses of the inlier ratio and of the probability that a
+    // correspondence agrees with a wrong model, both are adapted while running.
+    // The inlier ratio is replaced by that of the first model found.
+    double sprt_epsilon = 0.3;
+    double sprt_delta = 0.05;
+    // Time to generate a hypothesis measured in correspondence evaluations
+    double sprt_hypothesis_cost = 200.0;
+    // Correspondences scored between two test decisions
+    std::size_t score_block = 128;
+    unsigned int seed = 0;
+    // Refine the best hypothesis over its inliers with the nonlinear solver
+    bool refine = true;
+    pose_solver_options refinement = robust_refinement_options();
+
+    static pose_solver_options robust_refinement_options(){
+        pose_solver_options options;
+        options.loss = robust_loss::huber;
+        options.loss_scale = 2e-3;
+        return options;
+    }
+};
+
+
+/// Outcome of a robust pose estimate
+struct ransac_result {
+    bool success = false;
+    kln::motor motor;
+    std::size_t num_inliers = 0;
+    // One byte per correspondence, 1 for inliers of the returned motor
+    std::vector<std::uint8_t> inlier_mask;
+    int num_hypotheses = 0;
+    int num_rejected_early = 0;
+    std::size_t num_points_scored = 0;
+    pose_solver_result refinement;
+};
+
+
+class ransac_pose_estimator {
+    /*
+    Hypothesise and verify pose estimation. Hypotheses come from minimal
+    samples solved in closed form, by default P3P on four correspondences,
+    and are scored with the batched SIMD projection over blocks of
+    correspondences, with Wald's sequential probability ratio test deciding
+    after each block whether to carry on.
+    The best model is refined over its inliers with a robust loss.
+    All scratch buffers are kept between calls.
+    */
+public:
+    static constexpr std::size_t max_sample_size = 6;
+
+    explicit ransac_pose_estimator(const ransac_options& options=ransac_options())
+        : options_(options), generator_(options.seed),
+          sample_size_(options.solver == minimal_solver::p3p ? 4 : 6)
+    {}
+
+    const ransac_options& options() const noexcept { return options_; }
+
+    std::size_t sample_size() const noexcept { return sample_size_; }
+
+    void estimate(point_cloud_view points, point_cloud_view camera_points, ransac_result& result){
+        const std::size_t n = points.size();
+        result = ransac_result();
+        result.inlier_mask.assign(n, 0);
+        if (n < sample_size_){
+            return;
+        }
+        points_view_ = points;
+        camera_points_view_ = camera_points;
+
+        const float threshold2 = options_.inlier_threshold*options_.inlier_threshold;
+        double epsilon = options_.sprt_epsilon;
+        double delta = options_.sprt_delta;
+        double log_A = sprt_log_threshold(epsilon, delta);
+        std::size_t rejected_points = 0;
+        std::size_t rejected_inliers = 0;
+
+        std::size_t best_inliers = 0;
+        kln::motor best_motor;
+        double max_hypotheses = options_.max_hypotheses;
+        prosac_reset(n);
+
+        float matrix[12];
+        for (int iteration=0; iteration < max_hypotheses && iteration < options_.max_hypotheses; iteration++){
+            draw_sample(n, iteration);
+            kln::motor hypothesis;
+            if (!solve_sample(hypothesis)){
+                continue;
+            }
+            result.num_hypotheses++;
+            motor_to_mat3x4(~hypothesis, matrix);
+
+            // Score block by block, testing the likelihood ratio between blocks
+            std::size_t inliers = 0;
+            std::size_t scored = 0;
+            double log_lambda = 0.0;
+            bool rejected = false;
+            const double log_inlier_step = std::log(delta/epsilon);
+            const double log_outlier_step = std::log((1.0 - delta)/(1.0 - epsilon));
+            const std::size_t block = options_.sprt ? std::max<std::size_t>(options_.score_block, 1) : n;
+            while (scored < n){
+                std::size_t count = std::min(block, n - scored);
+                std::size_t block_inliers = count_projection_inliers(matrix, points.subview(scored, count),
+                                                                     camera_points.subview(scored, count), threshold2);
+                inliers += block_inliers;
+                scored += count;
+                if (options_.sprt && scored < n){
+                    log_lambda += block_inliers*log_inlier_step + (count - block_inliers)*log_outlier_step;
+                    if (log_lambda > log_A){
+                        rejected = true;
+                        break;
+                    }
+                }
+            }
+            result.num_points_scored += scored;
+
+            if (rejected){
+                result.num_rejected_early++;
+                rejected_points += scored;
+                rejected_inliers += inliers;
+                delta = std::clamp(static_cast<double>(rejected_inliers)/rejected_points, 1e-4, 0.5);
+                log_A = sprt_log_threshold(epsilon, delta);
+                continue;
+            }
+
+            if (inliers > best_inliers){
+                best_inliers = inliers;
+                best_motor = hypothesis;
+                // Both the test and the stopping criterion follow the inlier ratio
+                // of the best model so far, the prior only stands in until one is
+                // found. Keeping the prior as a floor would stop too early whenever
+                // the true ratio is below it.
+                epsilon = static_cast<double>(inliers)/n;
+                log_A = sprt_log_threshold(epsilon, delta);
+                max_hypotheses = required_hypotheses(epsilon, log_A);
+            }
+        }
+
+        if (best_inliers < sample_size_){
+            return;
+        }
+        result.success = true;
+        result.motor = best_motor;
+        motor_to_mat3x4(~best_motor, matrix);
+        result.num_inliers = count_projection_inliers(matrix, points, camera_points, threshold2, result.inlier_mask.data());
+
+        if (options_.refine){
+            gather_inliers(points, camera_points, result.inlier_mask);
+            kln::line initial_biv = chart_bivector(options_.refinement.chart, best_motor);
+            result.refinement = workspace_.solve(initial_biv, inlier_points_, inlier_camera_points_,
+                                                 options_.refinement);
+            if (result.refinement.usable){
+                motor_to_mat3x4(~result.refinement.motor, matrix);
+                std::size_t refined_inliers = count_projection_inliers(matrix, points, camera_points, threshold2);
+                if (refined_inliers >= result.num_inliers){
+                    result.motor = result.refinement.motor;
+                    result.num_inliers = count_projection_inliers(matrix, points, camera_points, threshold2,
+                                                                  result.inlier_mask.data());
+                }
+            }
+        }
+    }
+
+    ransac_result estimate(point_cloud_view points, point_cloud_view camera_points){
+        ransac_result result;
+        estimate(points, camera_points, result);
+        return result;
+    }
+
+private:
+    bool solve_sample(kln::motor& hypothesis){
+        /*
+        Solves the current minimal sample, with P3P the fourth correspondence
+        picks the solution that reprojects it best
+        */
+        if (options_.solver == minimal_solver::dlt){
+            return pose_from_dlt(sample_points_, sample_camera_points_, hypothesis);
+        }
+        std::size_t count = p3p_extrinsics(sample_points_, sample_camera_points_, rotations_, translations_);
+        std::size_t best = count;
+        double best_error = std::numeric_limits<double>::infinity();
+        for (std::size_t i=0; i<count; i++){
+            double error = mean_reprojection_error(sample_points_.view().subview(3, 1),
+                                                   sample_camera_points_.view().subview(3, 1),
+                                                   rotations_[i], translations_[i]);
+            if (error < best_error){
+                best_error = error;
+                best = i;
+            }
+        }
+        if (best == count){
+            return false;
+        }
+        hypothesis = camera_motor_from_extrinsics(rotations_[best], translations_[best]);
+        return true;
+    }
+
+    double sprt_log_threshold(double epsilon, double delta) const {
+        /*
+        Optimal decision threshold A of the test, the fixed point of
+        A = t_M*C + 1 + log(A) with C the expected information per correspondence
+        */
+        if (!options_.sprt || !(delta < epsilon)){
+            return std::numeric_limits<double>::infinity();
+        }
+        double C = (1.0 - delta)*std::log((1.0 - delta)/(1.0 - epsilon)) + delta*std::log(delta/epsilon);
+        double K = options_.sprt_hypothesis_cost*C;
+        double A = K + 1.0;
+        for (int i=0; i<10; i++){
+            A = K + 1.0 + std::log(A);
+        }
+        return std::log(A);
+    }
+
+    double required_hypotheses(double epsilon, double log_A) const {
+        /*
+        Number of hypotheses needed to draw an all inlier sample with the
+        requested confidence, accounting for good models rejected by the test
+        */
+        double p_good = std::pow(epsilon, static_cast<double>(sample_size_));
+        if (std::isfinite(log_A)){
+            p_good *= 1.0 - std::exp(-log_A);
+        }
+        if (p_good <= 0.0){
+            return options_.max_hypotheses;
+        }
+        if (p_good >= 1.0){
+            return 1.0;
+        }
+        return std::ceil(std::log(1.0 - options_.confidence)/std::log(1.0 - p_good));
+    }
+
+    void prosac_reset(std::size_t n){
+        /*
+        Initialises the PROSAC growth schedule of the sampling pool
+        */
+        prosac_n_ = sample_size_;
+        prosac_T_n_ = options_.max_hypotheses;
+        for (std::size_t i=0; i<sample_size_; i++){
+            prosac_T_n_ *= static_cast<double>(sample_size_ - i)/static_cast<double>(n - i);
+        }
+        prosac_T_n_prime_ = 1.0;
+    }
+
+    void draw_sample(std::size_t n, int iteration){
+        /*
+        Draws a minimal sample, uniformly or from the growing PROSAC pool
+        */
+        std::size_t pool = n;
+        bool include_last = false;
+        if (options_.prosac){
+            if (iteration + 1 >= prosac_T_n_prime_ && prosac_n_ < n){
+                double T_next = prosac_T_n_*(prosac_n_ + 1)/static_cast<double>(prosac_n_ + 1 - sample_size_);
+                prosac_T_n_prime_ += std::ceil(T_next - prosac_T_n_);
+                prosac_T_n_ = T_next;
+                prosac_n_++;
+            }
+            pool = prosac_n_;
+            include_last = (prosac_T_n_prime_ >= iteration + 1) && (prosac_n_ < n);
+        }
+
+        std::size_t drawn = 0;
+        if (include_last){
+            sample_[drawn++] = pool - 1;
+            pool -= 1;
+        }
+        while (drawn < sample_size_){
+            std::size_t candidate = std::uniform_int_distribution<std::size_t>(0, pool - 1)(generator_);
+            if (std::find(sample_, sample_ + drawn, candidate) == sample_ + drawn){
+                sample_[drawn++] = candidate;
+            }
+        }
+
+        sample_points_.resize(sample_size_);
+        sample_camera_points_.resize(sample_size_);
+        for (std::size_t i=0; i<sample_size_; i++){
+            sample_points_.set(i, points_view_[sample_[i]]);
+            sample_camera_points_.set(i, camera_points_view_[sample_[i]]);
+        }
+    }
+
+    void gather_inliers(point_cloud_view points, point_cloud_view camera_points,
+                        const std::vector<std::uint8_t>& mask){
+        inlier_points_.clear();
+        inlier_camera_points_.clear();
+        for (std::size_t i=0; i<points.size(); i++){
+            if (mask[i]){
+                inlier_points_.push_back(points[i]);
+                inlier_camera_points_.push_back(camera_points[i]);
+            }
+        }
+    }
+
+    ransac_options options_;
+    std::mt19937 generator_;
+    std::size_t sample_size_;
+    std::size_t sample_[max_sample_size];
+    std::size_t prosac_n_ = 0;
+    double prosac_T_n_ = 0.0;
+    double prosac_T_n_prime_ = 0.0;
+    point_cloud_view points_view_;
+    point_cloud_view camera_points_view_;
+    point_cloud sample_points_;
+    point_cloud sample_camera_points_;
+    point_cloud inlier_points_;
+    point_cloud inlier_camera_points_;
+    std::vector<Eigen::Matrix3d> rotations_;
+    std::vector<Eigen::Vector3d> translations_;
+    pose_solver_workspace workspace_;
+};
@@ -0,0 +1,384 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <klein/klein.hpp>
+#include "batched_maps.h"
+#include "cayley.h"
+#include "chart_policy.h"
+#include "outer_exp.h"
+#include "point_cloud.h"
+#include "projection_kernels.h"
+
+#include "ceres/ceres.h"
+
+
+template <typename Chart>
+void chart_camera_matrix_jacobian(const double phi[6], double matrix[12], double matrix_jacobian[72]){
+    /*
+    Builds the 3x4 matrix mapping world points into the frame of the camera
+    chart(phi), which is the matrix of the reversed motor, along with its row
+    major 12x6 derivative with respect to phi.
+    The matrix is quadratic in the motor coefficients, so the central difference
+    along each column of the chart jacobian is its exact directional derivative.
+    */
+    double motor[8];
+    double jacobian[48];
+    Chart::jacobian(phi, motor, jacobian);
+
+    // Reverse the motor, negating the bivector coefficients
+    for (int i=1; i<7; i++){
+        motor[i] = -motor[i];
+        for (int k=0; k<6; k++){
+            jacobian[6*i + k] = -jacobian[6*i + k];
+        }
+    }
+    motor_to_mat3x4(motor, matrix);
+
+    double plus[8];
+    double minus[8];
+    double matrix_plus[12];
+    double matrix_minus[12];
+    for (int k=0; k<6; k++){
+        for (int i=0; i<8; i++){
+            plus[i] = motor[i] + jacobian[6*i + k];
+            minus[i] = motor[i] - jacobian[6*i + k];
+        }
+        motor_to_mat3x4(plus, matrix_plus);
+        motor_to_mat3x4(minus, matrix_minus);
+        for (int j=0; j<12; j++){
+            matrix_jacobian[6*j + k] = 0.5*(matrix_plus[j] - matrix_minus[j]);
+        }
+    }
+}
+
+
+void camera_matrix_jacobian(motor_chart chart, const double phi[6],
+                            double matrix[12], double matrix_jacobian[72]){
+    with_chart(chart, [&](auto policy){
+        chart_camera_matrix_jacobian<decltype(policy)>(phi, matrix, matrix_jacobian);
+    });
+}
+
+
+/// What the six or eight pose parameters of a reprojection cost hold
+enum class pose_parameterization {
+    // Six chart coordinates, the chart is evaluated at the parameters
+    chart,
+    // The eight motor coefficients, stepped through MotorManifold
+    manifold
+};
+
+
+int pose_parameter_size(pose_parameterization parameterization){
+    return (parameterization == pose_parameterization::manifold) ? 8 : 6;
+}
+
+
+void camera_matrix_motor_jacobian(const double motor[8], double matrix[12], double matrix_jacobian[96]){
+    /*
+    Builds the 3x4 matrix of the camera at motor, the matrix of its reverse,
+    along with its row major 12x8 derivative with respect to the motor
+    coefficients. As the matrix is quadratic the central differences are exact.
+    */
+    double reverse[8];
+    for (int i=0; i<8; i++){
+        reverse[i] = (i == 0 || i == 7) ? motor[i] : -motor[i];
+    }
+    motor_to_mat3x4(reverse, matrix);
+
+    double plus[8];
+    double minus[8];
+    double matrix_plus[12];
+    double matrix_minus[12];
+    for (int k=0; k<8; k++){
+        const double sign = (k == 0 || k == 7) ? 1.0 : -1.0;
+        for (int i=0; i<8; i++){
+            plus[i] = reverse[i];
+            minus[i] = reverse[i];
+        }
+        plus[k] += sign;
+        minus[k] -= sign;
+        motor_to_mat3x4(plus, matrix_plus);
+        motor_to_mat3x4(minus, matrix_minus);
+        for (int j=0; j<12; j++){
+            matrix_jacobian[8*j + k] = 0.5*(matrix_plus[j] - matrix_minus[j]);
+        }
+    }
+}
+
+
+template <typename Chart>
+void chart_pose_camera_matrix_jacobian(pose_parameterization parameterization, const double* parameters,
+                                       double matrix[12], double* matrix_jacobian){
+    /*
+    The camera matrix and its derivative with respect to the pose parameters,
+    12x6 for chart coordinates and 12x8 for motor coefficients
+    */
+    if (parameterization == pose_parameterization::manifold){
+        camera_matrix_motor_jacobian(parameters, matrix, matrix_jacobian);
+    }
+    else{
+        chart_camera_matrix_jacobian<Chart>(parameters, matrix, matrix_jacobian);
+    }
+}
+
+
+void pose_camera_matrix_jacobian(motor_chart chart, pose_parameterization parameterization,
+                                const double* parameters, double matrix[12], double* matrix_jacobian){
+    with_chart(chart, [&](auto policy){
+        chart_pose_camera_matrix_jacobian<decltype(policy)>(parameterization, parameters, matrix, matrix_jacobian);
+    });
+}
+
+
+void reprojection_residuals_and_jacobian(const double matrix[12], const double* matrix_jacobian,
+                                        point_cloud_view points, point_cloud_view camera_points,
+                                        double* residuals, double* jacobian, int num_parameters=6){
+    /*
+    Evaluates the residuals camera_point - projected_point for each correspondence
+    in double precision and, if jacobian is not null, their row major
+    (2n)x(num_parameters) derivative with respect to the pose parameters,
+    given the 12x(num_parameters) derivative of the matrix
+    */
+    const int P = num_parameters;
+    for (std::size_t i=0; i<points.size(); i++){
+        const double p[4] = {points.x[i], points.y[i], points.z[i], points.w[i]};
+        double X = matrix[0]*p[0] + matrix[1]*p[1] + matrix[2]*p[2] + matrix[3]*p[3];
+        double Y = matrix[4]*p[0] + matrix[5]*p[1] + matrix[6]*p[2] + matrix[7]*p[3];
+        double Z = matrix[8]*p[0] + matrix[9]*p[1] + matrix[10]*p[2] + matrix[11]*p[3];
+        double inv_Z = 1.0/Z;
+        double u = X*inv_Z;
+        double v = Y*inv_Z;
+        residuals[2*i] = camera_points.x[i] - u;
+        residuals[2*i + 1] = camera_points.y[i] - v;
+
+        if (jacobian != nullptr){
+            double* row_u = jacobian + 2*P*i;
+            double* row_v = row_u + P;
+            for (int k=0; k<P; k++){
+                double dX = 0.0;
+                double dY = 0.0;
+                double dZ = 0.0;
+                for (int c=0; c<4; c++){
+                    dX += matrix_jacobian[P*c + k]*p[c];
+                    dY += matrix_jacobian[P*(4 + c) + k]*p[c];
+                    dZ += matrix_jacobian[P*(8 + c) + k]*p[c];
+                }
+                row_u[k] = -(dX - u*dZ)*inv_Z;
+                row_v[k] = -(dY - v*dZ)*inv_Z;
+            }
+        }
+    }
+}
+
+
+class ReprojectionCostFunction : public ceres::CostFunction {
+    /*
+    Reprojection residuals of a set of correspondences as a function of the
+    six chart parameters, or of the eight motor coefficients, with analytic
+    jacobians
+    */
+public:
+    ReprojectionCostFunction(point_cloud_view points, point_cloud_view camera_points,
+                            motor_chart chart=motor_chart::outer_exp,
+                            pose_parameterization parameterization=pose_parameterization::chart)
+        : points_(points), camera_points_(camera_points), chart_(chart), parameterization_(parameterization)
+    {
+        set_num_residuals(2*static_cast<int>(points.size()));
+        mutable_parameter_block_sizes()->push_back(pose_parameter_size(parameterization));
+    }
+
+    void reset(point_cloud_view points, point_cloud_view camera_points, motor_chart chart,
+                pose_parameterization parameterization=pose_parameterization::chart){
+        /*
+        Rebinds the cost function to new correspondences so it can be reused.
+        While it is part of a problem the number of correspondences and the
+        parameterization must stay the same
+        */
+        points_ = points;
+        camera_points_ = camera_points;
+        chart_ = chart;
+        parameterization_ = parameterization;
+        set_num_residuals(2*static_cast<int>(points.size()));
+        (*mutable_parameter_block_sizes())[0] = pose_parameter_size(parameterization);
+    }
+
+    bool Evaluate(double const* const* parameters, double* residuals, double** jacobians) const override {
+        double matrix[12];
+        double matrix_jacobian[96];
+        pose_camera_matrix_jacobian(chart_, parameterization_, parameters[0], matrix, matrix_jacobian);
+        double* jacobian = (jacobians != nullptr) ? jacobians[0] : nullptr;
+        reprojection_residuals_and_jacobian(matrix, matrix_jacobian, points_, camera_points_, residuals, jacobian,
+                                            pose_parameter_size(parameterization_));
+        return true;
+    }
+
+private:
+    point_cloud_view points_;
+    point_cloud_view camera_points_;
+    motor_chart chart_;
+    pose_parameterization parameterization_;
+};
+
+
+template <typename Chart>
+class ChartReprojectionCostFunction : public ceres::CostFunction {
+    /*
+    ReprojectionCostFunction for a chart fixed at compile time, so the
+    chart is inlined into the evaluation rather than chosen per call. This
+    also admits charts like exp_chart that have no motor_chart value
+    */
+public:
+    ChartReprojectionCostFunction(point_cloud_view points, point_cloud_view camera_points,
+                                  pose_parameterization parameterization=pose_parameterization::chart)
+        : points_(points), camera_points_(camera_points), parameterization_(parameterization)
+    {
+        set_num_residuals(2*static_cast<int>(points.size()));
+        mutable_parameter_block_sizes()->push_back(pose_parameter_size(parameterization));
+    }
+
+    void reset(point_cloud_view points, point_cloud_view camera_points,
+               pose_parameterization parameterization=pose_parameterization::chart){
+        /*
+        Rebinds the cost function to new correspondences so it can be reused.
+        While it is part of a problem the number of correspondences and the
+        parameterization must stay the same
+        */
+        points_ = points;
+        camera_points_ = camera_points;
+        parameterization_ = parameterization;
+        set_num_residuals(2*static_cast<int>(points.size()));
+        (*mutable_parameter_block_sizes())[0] = pose_parameter_size(parameterization);
+    }
+
+    bool Evaluate(double const* const* parameters, double* residuals, double** jacobians) const override {
+        double matrix[12];
+        double matrix_jacobian[96];
+        chart_pose_camera_matrix_jacobian<Chart>(parameterization_, parameters[0], matrix, matrix_jacobian);
+        double* jacobian = (jacobians != nullptr) ? jacobians[0] : nullptr;
+        reprojection_residuals_and_jacobian(matrix, matrix_jacobian, points_, camera_points_, residuals, jacobian,
+                                            pose_parameter_size(parameterization_));
+        return true;
+    }
+
+private:
+    point_cloud_view points_;
+    point_cloud_view camera_points_;
+    pose_parameterization parameterization_;
+};
+
+
+class PointReprojectionCostFunction : public ceres::SizedCostFunction<2, 6> {
+    /*
+    Reprojection residual of a single correspondence, letting the solver see one
+    small block per point so it can evaluate them in parallel
+    */
+public:
+    PointReprojectionCostFunction(kln::point const& point, kln::point const& camera_point,
+                                motor_chart chart=motor_chart::outer_exp)
+        : point_{point.x(), point.y(), point.z(), point.w()},
+          camera_point_{camera_point.x(), camera_point.y(), 1.0f, 1.0f}, 
+          chart_(chart)
+    {}
+
+    bool Evaluate(double const* const* parameters, double* residuals, double** jacobians) const override {
+        double matrix[12];
+        double matrix_jacobian[72];
+        camera_matrix_jacobian(chart_, parameters[0], matrix, matrix_jacobian);
+        double* jacobian = (jacobians != nullptr) ? jacobians[0] : nullptr;
+        const point_cloud_view point = {&point_[0], &point_[1], &point_[2], &point_[3], 1};
+        const point_cloud_view camera_point = {&camera_point_[0], &camera_point_[1], 
+                                               &camera_point_[2], &camera_point_[3], 1};
+        reprojection_residuals_and_jacobian(matrix, matrix_jacobian, point, camera_point, residuals, jacobian);
+        return true;
+    }
+
+private:
+    float point_[4];
+    float camera_point_[4];
+    motor_chart chart_;
+};
+
+
+class ReprojectionResidual {
+    /*
+    Reprojection residuals of a set of correspondences as a templated functor
+    for ceres::AutoDiffCostFunction. The chart, the camera matrix and the
+    projection are all evaluated in the solver's scalar type, so nothing is
+    rounded to float between the parameters and the residuals.
+    */
+public:
+    ReprojectionResidual(point_cloud_view points, point_cloud_view camera_points,
+                        motor_chart chart=motor_chart::outer_exp)
+        : points_(points), camera_points_(camera_points), chart_(chart)
+    {}
+
+    template <typename T>
+    bool operator()(const T* phi, T* residuals) const {
+        T motor[8];
+        chart_motor(chart_, phi, motor);
+        motor_reverse(motor, motor);
+        T matrix[12];
+        motor_to_mat3x4(motor, matrix);
+        image_plane_residuals(matrix, points_, camera_points_, residuals);
+        return true;
+    }
+
+private:
+    point_cloud_view points_;
+    point_cloud_view camera_points_;
+    motor_chart chart_;
+};
+
+
+ceres::CostFunction* make_autodiff_reprojection_cost(point_cloud_view points, point_cloud_view camera_points,
+                                                     motor_chart chart=motor_chart::outer_exp){
+    /*
+    Automatically differentiated counterpart of ReprojectionCostFunction over
+    the six chart parameters, the caller owns the result
+    */
+    return new ceres::AutoDiffCostFunction<ReprojectionResidual, ceres::DYNAMIC, 6>(
+        new ReprojectionResidual(points, camera_points, chart), 2*static_cast<int>(points.size()));
+}
+
+
+/// How the correspondences of a pose problem are split into residual blocks
+enum class residual_layout {
+    per_correspondence,
+    chunked,
+    single_block
+};
+
+
+void add_reprojection_residuals(ceres::Problem& problem, double* parameters,
+                                point_cloud_view points, point_cloud_view camera_points,
+                                motor_chart chart=motor_chart::outer_exp,
+                                residual_layout layout=residual_layout::chunked,
+                                std::size_t chunk_size=64){
+    /*
+    Adds the reprojection residuals of every correspondence to the problem,
+    either as one block of size 2 per point, as blocks of chunk_size points or
+    as one block spanning all points. Chunks amortise the camera matrix jacobian
+    over many points while still giving a multithreaded solver independent
+    blocks to evaluate in parallel.
+    */
+    if (layout == residual_layout::single_block){
+        problem.AddResidualBlock(new ReprojectionCostFunction(points, camera_points, chart), nullptr, parameters);
+        return;
+    }
+    if (layout == residual_layout::chunked){
+        chunk_size = (chunk_size == 0) ? 1 : chunk_size;
+        for (std::size_t offset=0; offset<points.size(); offset+=chunk_size){
+            std::size_t n = std::min(chunk_size, points.size() - offset);
+            problem.AddResidualBlock(new ReprojectionCostFunction(points.subview(offset, n), 
+                                                                camera_points.subview(offset, n), chart), 
+                                    nullptr, parameters);
+        }
+        return;
+    }
+    for (std::size_t i=0; i<points.size(); i++){
+        problem.AddResidualBlock(new PointReprojectionCostFunction(points[i], camera_points[i], chart), 
+                                nullptr, parameters);
+    }
+}
@@ -0,0 +1,358 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <klein/klein.hpp>
+#include "batched_maps.h"
+#include "chart_policy.h"
+#include "simd_batch.h"
+#include "thread_pool.h"
+
+
+/*
+Fixed step kinematic integration of many rigid bodies stored as structure of
+arrays. Each body is a reference motor together with chart coordinates phi
+relative to it, and moves with a velocity bivector held constant over a step.
+The chart kinematics are the closed forms of outer_exp_kinematic and
+cayley_kinematic given by the policies in chart_policy.h, and the stepping
+loops are instantiated once per chart. Once phi grows large it is folded
+into the reference motor, so the chart is only ever evaluated near the
+identity and away from its singularity. Bodies are stepped in parallel
+blocks and every block is carried through all of the requested steps while
+it is in cache.
+*/
+
+
+/// Frame the body velocities are expressed in
+enum class velocity_frame {
+    // R' = R omega/2, the body sits at reference*chart(phi) as in cayley_kinematic
+    body,
+    // R' = omega R/2, the body sits at chart(phi)*reference as in outer_exp_kinematic
+    spatial
+};
+
+
+/// Fixed step integration scheme
+enum class integrator_scheme {
+    // Classic fourth order Runge-Kutta on the chart coordinates
+    rk4,
+    // Second order Lie group step composed straight onto the motor, the chart
+    // of dt omega/2 for the outer exponential and of dt omega/4 for the Cayley map
+    lie_group
+};
+
+
+/// Configuration of the rigid body integrator
+struct integrator_options {
+    integrator_scheme scheme = integrator_scheme::rk4;
+    motor_chart chart = motor_chart::cayley;
+    velocity_frame frame = velocity_frame::body;
+    // Norm of the euclidean part of phi past which it is folded into the
+    // reference motor, tan of a quarter (Cayley) or half (outer exponential)
+    // of the rotation angle
+    float rechart_threshold = 0.5f;
+    // Bodies per parallel task
+    std::size_t block_size = 4096;
+};
+
+
+/// Structure-of-arrays state of a set of rigid bodies
+struct rigid_body_state {
+    motor_array reference;
+    line_array phi;
+    line_array velocity;
+
+    std::size_t size() const noexcept { return reference.size(); }
+    bool empty() const noexcept { return reference.empty(); }
+
+    void reserve(std::size_t n){
+        reference.reserve(n);
+        phi.reserve(n);
+        velocity.reserve(n);
+    }
+
+    void clear() noexcept {
+        reference.clear();
+        phi.clear();
+        velocity.clear();
+    }
+
+    void push_back(kln::motor const& R, kln::line const& omega){
+        reference.push_back(R);
+        phi.push_back(kln::line{0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f});
+        velocity.push_back(omega);
+    }
+};
+
+
+template <typename V>
+void compose_motor(velocity_frame frame, const V reference[8], const V local[8], V motor[8]){
+    /*
+    The motor of a body given its reference and local motor in the frame
+    */
+    if (frame == velocity_frame::body){
+        motor_product(reference, local, motor);
+    }
+    else{
+        motor_product(local, reference, motor);
+    }
+}
+
+
+template <typename Chart, typename V>
+void fold_chart_kernel(velocity_frame frame, V reference[8], V phi[6]){
+    /*
+    Moves the chart coordinates into the reference motor, leaving phi at zero
+    */
+    V local[8];
+    Chart::map(phi, local);
+    compose_motor(frame, reference, local, reference);
+    normalize_motor(reference);
+    for (int i=0; i<6; i++){
+        phi[i] = V::broadcast(0.0f);
+    }
+}
+
+
+template <typename Chart, typename V>
+void chart_lie_group_kernel(velocity_frame frame, const V& dt, V reference[8], const V omega[6]){
+    /*
+    Composes the chart of the scaled velocity onto the motor, which matches
+    the exact motion exp(dt omega/2) up to second order
+    */
+    const V scale = V::broadcast(Chart::step_scale)*dt;
+    V phi[6];
+    V local[8];
+    for (int i=0; i<6; i++){
+        phi[i] = scale*omega[i];
+    }
+    Chart::map(phi, local);
+    compose_motor(frame, reference, local, reference);
+    normalize_motor(reference);
+}
+
+
+/// Coefficient arrays of the bodies being stepped
+struct rigid_body_arrays {
+    float* reference[8];
+    float* phi[6];
+    const float* velocity[6];
+};
+
+
+rigid_body_arrays make_rigid_body_arrays(rigid_body_state& state){
+    motor_array_span R = state.reference.span();
+    line_array_span phi = state.phi.span();
+    line_array_view omega = state.velocity.view();
+    return {{R.scalar, R.e23, R.e31, R.e12, R.e01, R.e02, R.e03, R.e0123},
+            {phi.e01, phi.e02, phi.e03, phi.e23, phi.e31, phi.e12},
+            {omega.e01, omega.e02, omega.e03, omega.e23, omega.e31, omega.e12}};
+}
+
+
+template <typename Chart, typename V>
+std::size_t advance_batches(const integrator_options& options, float dt, const rigid_body_arrays& bodies,
+                            std::size_t begin, std::size_t end){
+    /*
+    Steps whole batches of V::width bodies from begin once, returning the
+    index of the first body left over. The chart is a template parameter so
+    the kinematics are inlined into the loop rather than chosen per batch
+    */
+    const V cross = V::broadcast((options.frame == velocity_frame::body) ? -1.0f : 1.0f);
+    const V step = V::broadcast(dt);
+    std::size_t i = begin;
+    for (; i + V::width <= end; i += V::width){
+        V omega[6];
+        for (int k=0; k<6; k++){
+            omega[k] = V::load(bodies.velocity[k] + i);
+        }
+        if (options.scheme == integrator_scheme::lie_group){
+            V reference[8];
+            for (int k=0; k<8; k++){
+                reference[k] = V::load(bodies.reference[k] + i);
+            }
+            chart_lie_group_kernel<Chart>(options.frame, step, reference, omega);
+            for (int k=0; k<8; k++){
+                reference[k].store(bodies.reference[k] + i);
+            }
+        }
+        else{
+            V phi[6];
+            for (int k=0; k<6; k++){
+                phi[k] = V::load(bodies.phi[k] + i);
+            }
+            chart_rk4_kernel<Chart>(cross, step, phi, omega);
+            for (int k=0; k<6; k++){
+                phi[k].store(bodies.phi[k] + i);
+            }
+        }
+    }
+    return i;
+}
+
+
+#if defined(SIMD_BATCH_RUNTIME_AVX2)
+template <typename Chart>
+SIMD_BATCH_AVX2_DRIVER std::size_t advance_batches_avx2(const integrator_options& options, float dt,
+                                                        const rigid_body_arrays& bodies,
+                                                        std::size_t begin, std::size_t end){
+    return advance_batches<Chart, avx2_float_batch>(options, dt, bodies, begin, end);
+}
+#endif
+
+
+template <typename Chart>
+void rechart_bodies(const integrator_options& options, const rigid_body_arrays& bodies,
+                    std::size_t begin, std::size_t end, bool fold_all){
+    /*
+    Folds phi into the reference motor for every body whose euclidean part
+    has passed the threshold, or that has any chart coordinates at all when
+    fold_all is set
+    */
+    using W = scalar_batch<float>;
+    const float threshold2 = options.rechart_threshold*options.rechart_threshold;
+    for (std::size_t i=begin; i<end; i++){
+        float ww = 0.0f;
+        float norm2 = 0.0f;
+        for (int k=0; k<6; k++){
+            float x = bodies.phi[k][i];
+            norm2 += x*x;
+            ww += (k >= 3) ? x*x : 0.0f;
+        }
+        if (fold_all ? (norm2 == 0.0f) : (ww <= threshold2)){
+            continue;
+        }
+        W reference[8];
+        W phi[6];
+        for (int k=0; k<8; k++){
+            reference[k] = W::load(bodies.reference[k] + i);
+        }
+        for (int k=0; k<6; k++){
+            phi[k] = W::load(bodies.phi[k] + i);
+        }
+        fold_chart_kernel<Chart>(options.frame, reference, phi);
+        for (int k=0; k<8; k++){
+            reference[k].store(bodies.reference[k] + i);
+        }
+        for (int k=0; k<6; k++){
+            phi[k].store(bodies.phi[k] + i);
+        }
+    }
+}
+
+
+template <typename Chart>
+void advance_chart_bodies(const integrator_options& options, float dt, std::size_t num_steps,
+                          const rigid_body_arrays& bodies, std::size_t begin, std::size_t end){
+    /*
+    Carries the bodies in [begin, end) through num_steps steps, on the widest
+    batch the cpu supports and one at a time over the tail
+    */
+    const bool lie_group = (options.scheme == integrator_scheme::lie_group);
+    if (lie_group){
+        // The Lie group step acts on the whole motor
+        rechart_bodies<Chart>(options, bodies, begin, end, true);
+    }
+    for (std::size_t step=0; step<num_steps; step++){
+        std::size_t i = begin;
+#if defined(SIMD_BATCH_RUNTIME_AVX2)
+        if (cpu_supports_avx2()){
+            i = advance_batches_avx2<Chart>(options, dt, bodies, i, end);
+        }
+#endif
+        i = advance_batches<Chart, float_batch>(options, dt, bodies, i, end);
+        advance_batches<Chart, scalar_batch<float>>(options, dt, bodies, i, end);
+        if (!lie_group){
+            rechart_bodies<Chart>(options, bodies, begin, end, false);
+        }
+    }
+}
+
+
+void advance_bodies(const integrator_options& options, float dt, std::size_t num_steps,
+                    const rigid_body_arrays& bodies, std::size_t begin, std::size_t end){
+    with_chart(options.chart, [&](auto policy){
+        advance_chart_bodies<decltype(policy)>(options, dt, num_steps, bodies, begin, end);
+    });
+}
+
+
+class rigid_body_integrator {
+    /*
+    Steps a rigid_body_state with a fixed step scheme, spreading blocks of
+    bodies over a work stealing pool
+    */
+public:
+    explicit rigid_body_integrator(const integrator_options& options=integrator_options(),
+                                   std::size_t num_threads=std::thread::hardware_concurrency())
+        : options_(options), pool_(num_threads)
+    {}
+
+    const integrator_options& options() const noexcept { return options_; }
+
+    void step(rigid_body_state& state, float dt, std::size_t num_steps=1){
+        /*
+        Advances every body by num_steps fixed steps of dt, holding each
+        velocity constant
+        */
+        const std::size_t n = state.size();
+        const std::size_t block_size = std::max<std::size_t>(options_.block_size, 1);
+        const std::size_t num_blocks = (n + block_size - 1)/block_size;
+        const rigid_body_arrays bodies = make_rigid_body_arrays(state);
+        auto advance_block = [&](std::size_t block, std::size_t){
+            std::size_t begin = block*block_size;
+            std::size_t end = std::min(n, begin + block_size);
+            advance_bodies(options_, dt, num_steps, bodies, begin, end);
+        };
+        if (num_blocks == 1 || pool_.size() == 1){
+            for (std::size_t block=0; block<num_blocks; block++){
+                advance_block(block, 0);
+            }
+        }
+        else{
+            pool_.parallel_for(num_blocks, advance_block);
+        }
+    }
+
+    void motors(const rigid_body_state& state, motor_array_span R) const {
+        /*
+        Writes the motor of every body, its reference composed with the chart
+        of phi, to R which must hold at least as many motors
+        */
+        using W = scalar_batch<float>;
+        motor_array_view reference = state.reference.view();
+        line_array_view phi = state.phi.view();
+        with_chart(options_.chart, [&](auto policy){
+            for (std::size_t i=0; i<state.size(); i++){
+                kln::motor Ri = reference[i];
+                kln::line phi_i = phi[i];
+                W r[8] = {{Ri.scalar()}, {Ri.e23()}, {Ri.e31()}, {Ri.e12()},
+                          {Ri.e01()}, {Ri.e02()}, {Ri.e03()}, {Ri.e0123()}};
+                W p[6] = {{phi_i.e01()}, {phi_i.e02()}, {phi_i.e03()}, {phi_i.e23()}, {phi_i.e31()}, {phi_i.e12()}};
+                fold_chart_kernel<decltype(policy)>(options_.frame, r, p);
+                R.set(i, kln::motor{r[0].v, r[1].v, r[2].v, r[3].v, r[4].v, r[5].v, r[6].v, r[7].v});
+            }
+        });
+    }
+
+    void bivectors(const rigid_body_state& state, line_array_span phi) const {
+        /*
+        Writes the coordinates of every body in the integrator's chart about
+        the identity, through outer_log or the inverse Cayley map, to phi
+        which must hold at least as many bivectors
+        */
+        motor_array R(state.size());
+        motors(state, R.span());
+        const float* input[8] = {R.scalar.data(), R.e23.data(), R.e31.data(), R.e12.data(),
+                                 R.e01.data(), R.e02.data(), R.e03.data(), R.e0123.data()};
+        float* output[6] = {phi.e01, phi.e02, phi.e03, phi.e23, phi.e31, phi.e12};
+        with_chart(options_.chart, [&](auto policy){
+            apply_map<policy_inverse_map<decltype(policy)>>(input, output, R.size());
+        });
+    }
+
+private:
+    integrator_options options_;
+    work_stealing_pool pool_;
+};
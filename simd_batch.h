@@ -0,0 +1,209 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <immintrin.h>
+
+
+/*
+Small SIMD batch types the batched kernels are written against. A kernel
+template instantiated with float_batch or double_batch runs 8 (4) floats or
+4 (2) doubles at a time with AVX (SSE), and with scalar_batch one element at
+a time over the tail of the arrays. simd_batch<S> is the scalar policy picking
+the widest batch for a scalar type, any type without a SIMD batch (ceres::Jet
+for automatic differentiation, long double) falls back to scalar_batch so the
+same kernels evaluate in it directly.
+
+When the build does not enable AVX2 itself, avx2_float_batch and
+avx2_double_batch provide the 8-wide float and 4-wide double paths behind
+the target attribute so that they can be selected at runtime with
+cpu_supports_avx2. Drivers instantiated with them must be marked
+SIMD_BATCH_AVX2_TARGET and flatten so the kernels and operators are inlined
+into AVX2 code. Double batches also load float arrays, widening on the way.
+*/
+
+
+struct float_batch {
+#if defined(__AVX__)
+    static constexpr std::size_t width = 8;
+    __m256 v;
+    static float_batch load(const float* p){ return {_mm256_loadu_ps(p)}; }
+    static float_batch broadcast(float s){ return {_mm256_set1_ps(s)}; }
+    void store(float* p) const { _mm256_storeu_ps(p, v); }
+#else
+    static constexpr std::size_t width = 4;
+    __m128 v;
+    static float_batch load(const float* p){ return {_mm_loadu_ps(p)}; }
+    static float_batch broadcast(float s){ return {_mm_set1_ps(s)}; }
+    void store(float* p) const { _mm_storeu_ps(p, v); }
+#endif
+};
+
+
+struct double_batch {
+#if defined(__AVX__)
+    static constexpr std::size_t width = 4;
+    __m256d v;
+    static double_batch load(const double* p){ return {_mm256_loadu_pd(p)}; }
+    static double_batch load(const float* p){ return {_mm256_cvtps_pd(_mm_loadu_ps(p))}; }
+    static double_batch broadcast(double s){ return {_mm256_set1_pd(s)}; }
+    void store(double* p) const { _mm256_storeu_pd(p, v); }
+#else
+    static constexpr std::size_t width = 2;
+    __m128d v;
+    static double_batch load(const double* p){ return {_mm_loadu_pd(p)}; }
+    static double_batch load(const float* p){
+        return {_mm_cvtps_pd(_mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(p))))};
+    }
+    static double_batch broadcast(double s){ return {_mm_set1_pd(s)}; }
+    void store(double* p) const { _mm_storeu_pd(p, v); }
+#endif
+};
+
+
+template <typename S>
+struct scalar_batch {
+    static constexpr std::size_t width = 1;
+    S v;
+    static scalar_batch load(const S* p){ return {*p}; }
+    template <typename U>
+    static scalar_batch load(const U* p){ return {S(*p)}; }
+    template <typename U>
+    static scalar_batch broadcast(U s){ return {S(s)}; }
+    void store(S* p) const { *p = v; }
+};
+
+
+#if defined(__AVX__)
+float_batch operator+(float_batch a, float_batch b){ return {_mm256_add_ps(a.v, b.v)}; }
+float_batch operator-(float_batch a, float_batch b){ return {_mm256_sub_ps(a.v, b.v)}; }
+float_batch operator*(float_batch a, float_batch b){ return {_mm256_mul_ps(a.v, b.v)}; }
+float_batch operator/(float_batch a, float_batch b){ return {_mm256_div_ps(a.v, b.v)}; }
+float_batch operator-(float_batch a){ return {_mm256_sub_ps(_mm256_setzero_ps(), a.v)}; }
+double_batch operator+(double_batch a, double_batch b){ return {_mm256_add_pd(a.v, b.v)}; }
+double_batch operator-(double_batch a, double_batch b){ return {_mm256_sub_pd(a.v, b.v)}; }
+double_batch operator*(double_batch a, double_batch b){ return {_mm256_mul_pd(a.v, b.v)}; }
+double_batch operator/(double_batch a, double_batch b){ return {_mm256_div_pd(a.v, b.v)}; }
+double_batch operator-(double_batch a){ return {_mm256_sub_pd(_mm256_setzero_pd(), a.v)}; }
+#else
+float_batch operator+(float_batch a, float_batch b){ return {_mm_add_ps(a.v, b.v)}; }
+float_batch operator-(float_batch a, float_batch b){ return {_mm_sub_ps(a.v, b.v)}; }
+float_batch operator*(float_batch a, float_batch b){ return {_mm_mul_ps(a.v, b.v)}; }
+float_batch operator/(float_batch a, float_batch b){ return {_mm_div_ps(a.v, b.v)}; }
+float_batch operator-(float_batch a){ return {_mm_sub_ps(_mm_setzero_ps(), a.v)}; }
+double_batch operator+(double_batch a, double_batch b){ return {_mm_add_pd(a.v, b.v)}; }
+double_batch operator-(double_batch a, double_batch b){ return {_mm_sub_pd(a.v, b.v)}; }
+double_batch operator*(double_batch a, double_batch b){ return {_mm_mul_pd(a.v, b.v)}; }
+double_batch operator/(double_batch a, double_batch b){ return {_mm_div_pd(a.v, b.v)}; }
+double_batch operator-(double_batch a){ return {_mm_sub_pd(_mm_setzero_pd(), a.v)}; }
+#endif
+
+template <typename S>
+scalar_batch<S> operator+(scalar_batch<S> a, scalar_batch<S> b){ return {a.v + b.v}; }
+template <typename S>
+scalar_batch<S> operator-(scalar_batch<S> a, scalar_batch<S> b){ return {a.v - b.v}; }
+template <typename S>
+scalar_batch<S> operator*(scalar_batch<S> a, scalar_batch<S> b){ return {a.v*b.v}; }
+template <typename S>
+scalar_batch<S> operator/(scalar_batch<S> a, scalar_batch<S> b){ return {a.v/b.v}; }
+template <typename S>
+scalar_batch<S> operator-(scalar_batch<S> a){ return {-a.v}; }
+
+
+#if defined(__AVX__)
+float_batch sqrt(float_batch a){ return {_mm256_sqrt_ps(a.v)}; }
+double_batch sqrt(double_batch a){ return {_mm256_sqrt_pd(a.v)}; }
+#else
+float_batch sqrt(float_batch a){ return {_mm_sqrt_ps(a.v)}; }
+double_batch sqrt(double_batch a){ return {_mm_sqrt_pd(a.v)}; }
+#endif
+
+template <typename S>
+scalar_batch<S> sqrt(scalar_batch<S> a){
+    // Unqualified so that scalars such as ceres::Jet find their own sqrt
+    using std::sqrt;
+    return {sqrt(a.v)};
+}
+
+
+#if defined(__AVX__)
+float_batch min(float_batch a, float_batch b){ return {_mm256_min_ps(a.v, b.v)}; }
+float_batch max(float_batch a, float_batch b){ return {_mm256_max_ps(a.v, b.v)}; }
+double_batch min(double_batch a, double_batch b){ return {_mm256_min_pd(a.v, b.v)}; }
+double_batch max(double_batch a, double_batch b){ return {_mm256_max_pd(a.v, b.v)}; }
+#else
+float_batch min(float_batch a, float_batch b){ return {_mm_min_ps(a.v, b.v)}; }
+float_batch max(float_batch a, float_batch b){ return {_mm_max_ps(a.v, b.v)}; }
+double_batch min(double_batch a, double_batch b){ return {_mm_min_pd(a.v, b.v)}; }
+double_batch max(double_batch a, double_batch b){ return {_mm_max_pd(a.v, b.v)}; }
+#endif
+
+template <typename S>
+scalar_batch<S> min(scalar_batch<S> a, scalar_batch<S> b){ return {(b.v < a.v) ? b.v : a.v}; }
+template <typename S>
+scalar_batch<S> max(scalar_batch<S> a, scalar_batch<S> b){ return {(a.v < b.v) ? b.v : a.v}; }
+
+
+template <typename S>
+struct simd_batch { using type = scalar_batch<S>; };
+
+template <>
+struct simd_batch<float> { using type = float_batch; };
+
+template <>
+struct simd_batch<double> { using type = double_batch; };
+
+
+#if !defined(__AVX2__) && (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_BATCH_RUNTIME_AVX2 1
+#define SIMD_BATCH_AVX2_TARGET __attribute__((target("avx2,fma")))
+#define SIMD_BATCH_AVX2_DRIVER __attribute__((target("avx2,fma"), flatten))
+
+
+struct avx2_float_batch {
+    static constexpr std::size_t width = 8;
+    __m256 v;
+    SIMD_BATCH_AVX2_TARGET static avx2_float_batch load(const float* p){ return {_mm256_loadu_ps(p)}; }
+    SIMD_BATCH_AVX2_TARGET static avx2_float_batch broadcast(float s){ return {_mm256_set1_ps(s)}; }
+    SIMD_BATCH_AVX2_TARGET void store(float* p) const { _mm256_storeu_ps(p, v); }
+};
+
+
+SIMD_BATCH_AVX2_TARGET avx2_float_batch operator+(avx2_float_batch a, avx2_float_batch b){ return {_mm256_add_ps(a.v, b.v)}; }
+SIMD_BATCH_AVX2_TARGET avx2_float_batch operator-(avx2_float_batch a, avx2_float_batch b){ return {_mm256_sub_ps(a.v, b.v)}; }
+SIMD_BATCH_AVX2_TARGET avx2_float_batch operator*(avx2_float_batch a, avx2_float_batch b){ return {_mm256_mul_ps(a.v, b.v)}; }
+SIMD_BATCH_AVX2_TARGET avx2_float_batch operator/(avx2_float_batch a, avx2_float_batch b){ return {_mm256_div_ps(a.v, b.v)}; }
+SIMD_BATCH_AVX2_TARGET avx2_float_batch operator-(avx2_float_batch a){ return {_mm256_sub_ps(_mm256_setzero_ps(), a.v)}; }
+SIMD_BATCH_AVX2_TARGET avx2_float_batch sqrt(avx2_float_batch a){ return {_mm256_sqrt_ps(a.v)}; }
+SIMD_BATCH_AVX2_TARGET avx2_float_batch min(avx2_float_batch a, avx2_float_batch b){ return {_mm256_min_ps(a.v, b.v)}; }
+SIMD_BATCH_AVX2_TARGET avx2_float_batch max(avx2_float_batch a, avx2_float_batch b){ return {_mm256_max_ps(a.v, b.v)}; }
+
+
+struct avx2_double_batch {
+    static constexpr std::size_t width = 4;
+    __m256d v;
+    SIMD_BATCH_AVX2_TARGET static avx2_double_batch load(const double* p){ return {_mm256_loadu_pd(p)}; }
+    SIMD_BATCH_AVX2_TARGET static avx2_double_batch load(const float* p){ return {_mm256_cvtps_pd(_mm_loadu_ps(p))}; }
+    SIMD_BATCH_AVX2_TARGET static avx2_double_batch broadcast(double s){ return {_mm256_set1_pd(s)}; }
+    SIMD_BATCH_AVX2_TARGET void store(double* p) const { _mm256_storeu_pd(p, v); }
+};
+
+
+SIMD_BATCH_AVX2_TARGET avx2_double_batch operator+(avx2_double_batch a, avx2_double_batch b){ return {_mm256_add_pd(a.v, b.v)}; }
+SIMD_BATCH_AVX2_TARGET avx2_double_batch operator-(avx2_double_batch a, avx2_double_batch b){ return {_mm256_sub_pd(a.v, b.v)}; }
+SIMD_BATCH_AVX2_TARGET avx2_double_batch operator*(avx2_double_batch a, avx2_double_batch b){ return {_mm256_mul_pd(a.v, b.v)}; }
+SIMD_BATCH_AVX2_TARGET avx2_double_batch operator/(avx2_double_batch a, avx2_double_batch b){ return {_mm256_div_pd(a.v, b.v)}; }
+SIMD_BATCH_AVX2_TARGET avx2_double_batch operator-(avx2_double_batch a){ return {_mm256_sub_pd(_mm256_setzero_pd(), a.v)}; }
+SIMD_BATCH_AVX2_TARGET avx2_double_batch sqrt(avx2_double_batch a){ return {_mm256_sqrt_pd(a.v)}; }
+SIMD_BATCH_AVX2_TARGET avx2_double_batch min(avx2_double_batch a, avx2_double_batch b){ return {_mm256_min_pd(a.v, b.v)}; }
+SIMD_BATCH_AVX2_TARGET avx2_double_batch max(avx2_double_batch a, avx2_double_batch b){ return {_mm256_max_pd(a.v, b.v)}; }
+
+
+bool cpu_supports_avx2(){
+    /*
+    Whether the running cpu has AVX2 and FMA, checked once
+    */
+    static const bool supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    return supported;
+}
+#endif
@@ -0,0 +1,435 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <random>
+#include <vector>
+#include "klein/klein.hpp"
+#include "camera_model.h"
+#include "camera_ops.h"
+#include "outer_exp.h"
+#include "point_cloud.h"
+#include "point_io.h"
+#include "pose_refinement.h"
+#include "reprojection_cost.h"
+
+
+/*
+Checks that evaluating reprojection residuals, their jacobians and the
+reprojection error, and a whole fixed size pose refinement, do not touch the
+heap once the solve loop has warmed up, including the residual blocks and
+manifold a pose solver workspace reuses between solves, and that a warm
+workspace solve reaches the same cost as solving directly with ceres.
+The automatically differentiated reprojection cost is compared against the
+analytic jacobians.
+Every global operator new is replaced by one that counts while counting is
+switched on.
+Also round trips correspondences through the point file format, and checks
+that empty, truncated and corrupted files are read without crashing.
+*/
+
+
+std::atomic<bool> counting{false};
+std::atomic<std::size_t> allocations{0};
+
+
+void* counted_allocation(std::size_t size, std::size_t alignment=0){
+    if (counting.load(std::memory_order_relaxed)){
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    size = (size == 0) ? 1 : size;
+    void* p = nullptr;
+    if (alignment > alignof(std::max_align_t)){
+        size = (size + alignment - 1)/alignment*alignment;
+        p = std::aligned_alloc(alignment, size);
+    }
+    else{
+        p = std::malloc(size);
+    }
+    if (p == nullptr){
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+
+void* operator new(std::size_t size){ return counted_allocation(size); }
+void* operator new[](std::size_t size){ return counted_allocation(size); }
+void* operator new(std::size_t size, std::align_val_t alignment){
+    return counted_allocation(size, static_cast<std::size_t>(alignment));
+}
+void* operator new[](std::size_t size, std::align_val_t alignment){
+    return counted_allocation(size, static_cast<std::size_t>(alignment));
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+
+
+bool expect_no_allocations(const char* name, std::size_t counted){
+    std::cout << name << ": " << counted << " allocations" << std::endl;
+    return counted == 0;
+}
+
+
+std::string read_bytes(const std::string& path){
+    std::ifstream file(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+
+void write_bytes(const std::string& path, const std::string& bytes){
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(bytes.data(), bytes.size());
+}
+
+
+bool same_points(point_cloud_view a, point_cloud_view b, std::size_t offset){
+    /*
+    Whether a matches b starting at offset, bit for bit
+    */
+    if (offset + a.size() > b.size()){
+        return false;
+    }
+    const std::size_t bytes = a.size()*sizeof(float);
+    return std::memcmp(a.x, b.x + offset, bytes) == 0 && std::memcmp(a.y, b.y + offset, bytes) == 0
+        && std::memcmp(a.z, b.z + offset, bytes) == 0 && std::memcmp(a.w, b.w + offset, bytes) == 0;
+}
+
+
+bool streams_cleanly(const std::string& path, point_cloud_view points, point_cloud_view camera_points){
+    /*
+    Reads a correspondence file a chunk at a time, checking every chunk
+    against the points that were written
+    */
+    point_file_reader reader(path);
+    point_cloud chunk_points;
+    point_cloud chunk_camera_points;
+    std::size_t offset = 0;
+    while (reader.next(chunk_points, chunk_camera_points)){
+        if (!same_points(chunk_points, points, offset) || !same_points(chunk_camera_points, camera_points, offset)){
+            return false;
+        }
+        offset += chunk_points.size();
+    }
+    return !reader.failed() && offset == points.size();
+}
+
+
+bool check_workspace_solve(const kln::motor& R_start, point_cloud_view points, point_cloud_view camera_points,
+                           int num_iterations){
+    /*
+    Solves warm with a pose_solver_workspace, set up the way a pose track
+    solves, and directly with ceres from the same start, which have to reach
+    the same cost. ceres::Solve builds its program, evaluators and summary on
+    every call, so neither is allocation free. The counts are only reported,
+    the residual blocks and manifold the workspace reuses are held to zero
+    allocations in the steady state loop.
+    */
+    pose_solver_options solver_options;
+    solver_options.chart = motor_chart::cayley;
+    solver_options.parameterization = pose_parameterization::manifold;
+    pose_solver_workspace workspace;
+
+    // The same residual blocks, loss and manifold, solved without the workspace
+    ceres::Problem::Options problem_options;
+    problem_options.cost_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+    problem_options.loss_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+    problem_options.manifold_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+    ceres::Problem problem(problem_options);
+    const double x_start[8] = {R_start.scalar(), R_start.e23(), R_start.e31(), R_start.e12(),
+                               R_start.e01(), R_start.e02(), R_start.e03(), R_start.e0123()};
+    double x[8];
+    std::copy(x_start, x_start + 8, x);
+    std::vector<std::unique_ptr<ReprojectionCostFunction>> cost_functions;
+    std::unique_ptr<ceres::LossFunction> loss_function = make_loss_function(solver_options.loss,
+                                                                           solver_options.loss_scale);
+    const std::size_t chunk_size = residual_chunk_size(solver_options, points.size());
+    for (std::size_t offset=0; offset<points.size(); offset+=chunk_size){
+        std::size_t n = std::min(chunk_size, points.size() - offset);
+        cost_functions.push_back(std::make_unique<ReprojectionCostFunction>(
+            points.subview(offset, n), camera_points.subview(offset, n), solver_options.chart,
+            solver_options.parameterization));
+        problem.AddResidualBlock(cost_functions.back().get(), loss_function.get(), x);
+    }
+    MotorManifold<cayley_chart<se3>> manifold;
+    problem.SetManifold(x, &manifold);
+    ceres::Solver::Options options;
+    configure_solver(solver_options, options);
+    ceres::Solver::Summary summary;
+
+    // Warm up both, so the workspace has its residual blocks in place
+    pose_solver_result result = workspace.solve(R_start, points, camera_points, solver_options);
+    ceres::Solve(options, &problem, &summary);
+
+    allocations = 0;
+    counting = true;
+    for (int iteration=0; iteration < num_iterations; iteration++){
+        std::copy(x_start, x_start + 8, x);
+        ceres::Solve(options, &problem, &summary);
+    }
+    counting = false;
+    const std::size_t ceres_allocations = allocations;
+
+    allocations = 0;
+    counting = true;
+    for (int iteration=0; iteration < num_iterations; iteration++){
+        result = workspace.solve(R_start, points, camera_points, solver_options);
+    }
+    counting = false;
+    const std::size_t workspace_allocations = allocations;
+
+    std::cout << "warm workspace solve: " << workspace_allocations << " allocations, direct ceres::Solve "
+              << ceres_allocations << std::endl;
+    std::cout << "workspace solve cost " << result.final_cost << " ceres " << summary.final_cost << std::endl;
+    return std::abs(result.final_cost - summary.final_cost) <= 1e-9*(1.0 + summary.final_cost);
+}
+
+
+bool check_autodiff_cost(point_cloud_view points, point_cloud_view camera_points){
+    /*
+    The automatically differentiated cost has to agree with the analytic
+    ReprojectionCostFunction, residuals and jacobian, in both charts at a
+    pose away from the identity
+    */
+    const double x[6] = {0.3, -0.2, 0.4, 0.5, -0.3, 0.2};
+    const double* parameters[1] = {x};
+    const std::size_t num_residuals = 2*points.size();
+    bool passed = true;
+    for (motor_chart chart : {motor_chart::outer_exp, motor_chart::cayley}){
+        std::unique_ptr<ceres::CostFunction> autodiff_cost(make_autodiff_reprojection_cost(points, camera_points,
+                                                                                           chart));
+        ReprojectionCostFunction analytic_cost(points, camera_points, chart);
+        std::vector<double> autodiff_residuals(num_residuals);
+        std::vector<double> analytic_residuals(num_residuals);
+        std::vector<double> autodiff_jacobian(6*num_residuals);
+        std::vector<double> analytic_jacobian(6*num_residuals);
+        double* autodiff_jacobians[1] = {autodiff_jacobian.data()};
+        double* analytic_jacobians[1] = {analytic_jacobian.data()};
+        autodiff_cost->Evaluate(parameters, autodiff_residuals.data(), autodiff_jacobians);
+        analytic_cost.Evaluate(parameters, analytic_residuals.data(), analytic_jacobians);
+
+        double residual_error = 0.0;
+        double jacobian_error = 0.0;
+        double jacobian_scale = 0.0;
+        for (std::size_t i=0; i<num_residuals; i++){
+            residual_error = std::max(residual_error, std::abs(autodiff_residuals[i] - analytic_residuals[i]));
+        }
+        for (std::size_t i=0; i<6*num_residuals; i++){
+            jacobian_error = std::max(jacobian_error, std::abs(autodiff_jacobian[i] - analytic_jacobian[i]));
+            jacobian_scale = std::max(jacobian_scale, std::abs(analytic_jacobian[i]));
+        }
+        std::cout << (chart == motor_chart::cayley ? "cayley" : "outer exp")
+                  << " autodiff cost differs by " << residual_error << " in the residuals and "
+                  << jacobian_error << " in the jacobian" << std::endl;
+        passed &= residual_error <= 1e-5 && jacobian_error <= 1e-5*(1.0 + jacobian_scale);
+    }
+    return passed;
+}
+
+
+bool check_point_files(point_cloud_view points, point_cloud_view camera_points){
+    const std::string path = "test_ops_points.kkp";
+    bool passed = true;
+
+    // Several chunks with a partial one at the end
+    point_file_writer writer(path, point_file_layout::correspondences, 64);
+    writer.write(points.subview(0, 100), camera_points.subview(0, 100));
+    writer.write(points.subview(100, points.size() - 100), camera_points.subview(100, points.size() - 100));
+    passed &= writer.close();
+    {
+        mapped_point_file file(path);
+        bool round_trip = file.is_open() && file.verify() && file.size() == points.size();
+        std::size_t offset = 0;
+        for (std::size_t c=0; round_trip && c<file.num_chunks(); c++){
+            round_trip &= same_points(file.points(c), points, offset);
+            round_trip &= same_points(file.camera_points(c), camera_points, offset);
+            offset += file.points(c).size();
+        }
+        round_trip &= (offset == points.size()) && file.points(file.num_chunks()).empty();
+        round_trip &= streams_cleanly(path, points, camera_points);
+        std::cout << "point file round trip over " << file.num_chunks() << " chunks "
+                  << (round_trip ? "matches" : "differs") << std::endl;
+        passed &= round_trip;
+    }
+    const std::string bytes = read_bytes(path);
+
+    // Truncating the last chunk has to be caught by both readers
+    write_bytes(path, bytes.substr(0, bytes.size() - 40));
+    bool truncated = !mapped_point_file(path).is_open() && !streams_cleanly(path, points, camera_points);
+
+    // As does a chunk count far beyond what the file could hold
+    std::string corrupted = bytes;
+    const std::uint64_t num_chunks = std::uint64_t(1) << 62;
+    std::memcpy(&corrupted[offsetof(point_file_header, num_chunks)], &num_chunks, sizeof(num_chunks));
+    write_bytes(path, corrupted);
+    bool rejected = !mapped_point_file(path).is_open() && !streams_cleanly(path, points, camera_points);
+
+    // Or a consistent chunk far larger than the file, which must not be allocated
+    corrupted = bytes;
+    const std::uint64_t count = std::uint64_t(1) << 40;
+    const std::uint64_t payload_size = point_file_arrays(point_file_layout::correspondences)*padded_array_size(count);
+    const std::size_t chunk = sizeof(point_file_header);
+    std::memcpy(&corrupted[offsetof(point_file_header, chunk_capacity)], &count, sizeof(count));
+    std::memcpy(&corrupted[chunk + offsetof(point_chunk_header, count)], &count, sizeof(count));
+    std::memcpy(&corrupted[chunk + offsetof(point_chunk_header, payload_size)], &payload_size, sizeof(payload_size));
+    write_bytes(path, corrupted);
+    rejected &= !mapped_point_file(path).is_open() && !streams_cleanly(path, points, camera_points);
+    std::cout << "truncated point file " << (truncated ? "rejected" : "accepted")
+              << ", corrupted header " << (rejected ? "rejected" : "accepted") << std::endl;
+    passed &= truncated && rejected;
+
+    // A file without any points has no chunks, and hands out empty views
+    passed &= point_file_writer(path, point_file_layout::correspondences).close();
+    {
+        mapped_point_file file(path);
+        bool empty = file.is_open() && file.verify() && file.num_chunks() == 0
+            && file.points().empty() && file.camera_points().empty()
+            && streams_cleanly(path, point_cloud_view(), point_cloud_view());
+        std::cout << "empty point file " << (empty ? "reads as empty" : "misread") << std::endl;
+        passed &= empty;
+    }
+
+    std::remove(path.c_str());
+    return passed;
+}
+
+
+int main(){
+    constexpr std::size_t num_points = 203;
+    constexpr int num_iterations = 20;
+
+    std::default_random_engine generator(7);
+    std::normal_distribution<float> distribution(0.0f, 1.0f);
+    kln::motor R = outer_exp(kln::line{0.1f, -0.2f, 0.05f, 0.1f, 0.2f, -0.1f});
+
+    // World points in front of the camera and their noisy image points
+    point_cloud points;
+    point_cloud camera_points;
+    point_cloud pixel_points;
+    std::vector<std::shared_ptr<kln::point>> shared_points;
+    std::vector<std::shared_ptr<kln::point>> shared_camera_points;
+    camera_model model;
+    model.intrinsics.fx = 500.0;
+    model.intrinsics.fy = 500.0;
+    model.intrinsics.cx = 320.0;
+    model.intrinsics.cy = 240.0;
+    model.distortion.k1 = -0.1;
+    for (std::size_t i=0; i < num_points; i++){
+        kln::point camera_frame{distribution(generator), distribution(generator), 4.0f + distribution(generator)};
+        kln::point world = R(camera_frame);
+        float u = camera_frame.x()/camera_frame.z() + 0.001f*distribution(generator);
+        float v = camera_frame.y()/camera_frame.z() + 0.001f*distribution(generator);
+        points.push_back(world);
+        camera_points.push_back(u, v, 1.0f);
+        pixel_points.push_back(500.0f*u + 320.0f, 500.0f*v + 240.0f, 1.0f);
+        shared_points.push_back(std::make_shared<kln::point>(world));
+        shared_camera_points.push_back(std::make_shared<kln::point>(camera_points[i]));
+    }
+
+    // Everything the solve loop touches is set up before counting starts
+    double x[8] = {0.1, -0.2, 0.05, 0.1, 0.2, -0.1, 0.0, 0.0};
+    double camera[camera_model::num_parameters];
+    model.to_parameters(camera);
+    ReprojectionCostFunction chart_cost(points, camera_points, motor_chart::cayley);
+    ReprojectionCostFunction manifold_cost(points, camera_points, motor_chart::outer_exp,
+                                           pose_parameterization::manifold);
+    // The residual blocks and manifold a pose_solver_workspace reuses between solves
+    ChartReprojectionCostFunction<cayley_chart<se3>> workspace_chart_cost(points, camera_points);
+    ChartReprojectionCostFunction<cayley_chart<se3>> workspace_manifold_cost(points, camera_points,
+                                                                             pose_parameterization::manifold);
+    MotorManifold<cayley_chart<se3>> manifold;
+    double x_step[8];
+    double plus_jacobian[48];
+    PixelReprojectionCostFunction pixel_cost(points, pixel_points);
+    std::vector<double> residuals(2*num_points);
+    std::vector<double> pose_jacobian(2*num_points*8);
+    std::vector<double> camera_jacobian(2*num_points*camera_model::num_parameters);
+    double x_motor[8] = {R.scalar(), R.e23(), R.e31(), R.e12(), R.e01(), R.e02(), R.e03(), R.e0123()};
+    const kln::motor R_start = outer_exp(kln::line{0.12f, -0.15f, 0.0f, 0.07f, -0.12f, 0.25f});
+    pose_refinement_options refinement_options;
+    refinement_options.huber_scale = 1e-2;
+
+    auto solve_iteration = [&](){
+        const double* chart_parameters[1] = {x};
+        double* chart_jacobians[1] = {pose_jacobian.data()};
+        chart_cost.Evaluate(chart_parameters, residuals.data(), chart_jacobians);
+        chart_cost.Evaluate(chart_parameters, residuals.data(), nullptr);
+
+        const double* motor_parameters[1] = {x_motor};
+        manifold_cost.Evaluate(motor_parameters, residuals.data(), chart_jacobians);
+        workspace_chart_cost.Evaluate(chart_parameters, residuals.data(), chart_jacobians);
+        workspace_manifold_cost.Evaluate(motor_parameters, residuals.data(), chart_jacobians);
+        manifold.Plus(x_motor, x, x_step);
+        manifold.PlusJacobian(x_step, plus_jacobian);
+
+        const double* pixel_parameters[2] = {x, camera};
+        double* pixel_jacobians[2] = {pose_jacobian.data(), camera_jacobian.data()};
+        pixel_cost.Evaluate(pixel_parameters, residuals.data(), pixel_jacobians);
+
+        float error = reprojection_error(R, points, camera_points);
+        error += reprojection_error(R, model, points, pixel_points);
+        error += reprojection_error(R, shared_points, shared_camera_points);
+        error += reprojection_residuals(R, points, camera_points, residuals.data());
+        error += reprojection_residuals(R, shared_points, shared_camera_points, residuals.data());
+        error += refine_pose(R_start, points, camera_points, refinement_options).final_cost;
+        return error;
+    };
+
+    // Warm up, letting the per thread workspace grow to size
+    solve_iteration();
+
+    bool passed = true;
+    float error = 0.0f;
+    allocations = 0;
+    counting = true;
+    for (int iteration=0; iteration < num_iterations; iteration++){
+        error += solve_iteration();
+        x[0] += 1e-3;
+    }
+    counting = false;
+    passed &= expect_no_allocations("steady state residual evaluation", allocations);
+
+    // The fused error has to agree with projecting the points and summing
+    aligned_float_vector u(num_points);
+    aligned_float_vector v(num_points);
+    project_points(R, points, u.data(), v.data());
+    float expected = 0.0f;
+    for (std::size_t i=0; i < num_points; i++){
+        float du = camera_points.x[i] - u[i];
+        float dv = camera_points.y[i] - v[i];
+        expected += std::sqrt(du*du + dv*dv);
+    }
+    float fused = reprojection_error(R, points, camera_points);
+    std::cout << "fused reprojection error " << fused << " expected " << expected << std::endl;
+    passed &= std::abs(fused - expected) <= 1e-4f*expected;
+    passed &= std::isfinite(error);
+
+    // The fixed size solver has to reach the same minimum as ceres
+    pose_solver_options ceres_options;
+    ceres_options.parameterization = pose_parameterization::manifold;
+    pose_solver_result ceres_result = find_camera(outer_log(R_start), points, camera_points, ceres_options);
+    pose_refinement_result refined = refine_pose(R_start, points, camera_points);
+    std::cout << "fixed size pose refinement cost " << refined.final_cost
+              << " ceres " << ceres_result.final_cost << std::endl;
+    passed &= refined.converged;
+    passed &= std::abs(refined.final_cost - ceres_result.final_cost) <= 1e-6*ceres_result.final_cost;
+
+    passed &= check_workspace_solve(R_start, points, camera_points, num_iterations);
+    passed &= check_autodiff_cost(points, camera_points);
+    passed &= check_point_files(points, camera_points);
+
+    std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+class work_stealing_pool {
+    /*
+    A fixed set of persistent worker threads running indexed loops. Each
+    worker owns a deque of indices which it consumes from the front, and once
+    it runs dry it steals from the back of the other workers' deques, so
+    uneven task costs balance out without a central queue.
+    */
+public:
+    explicit work_stealing_pool(std::size_t num_threads=std::thread::hardware_concurrency())
+        : queues_(std::max<std::size_t>(num_threads, 1))
+    {
+        for (std::size_t i=0; i<queues_.size(); i++){
+            queues_[i] = std::make_unique<worker_queue>();
+        }
+        for (std::size_t i=0; i<queues_.size(); i++){
+            threads_.emplace_back([this, i]{ worker_loop(i); });
+        }
+    }
+
+    ~work_stealing_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        start_condition_.notify_all();
+        for (std::thread& thread : threads_){
+            thread.join();
+        }
+    }
+
+    work_stealing_pool(const work_stealing_pool&) = delete;
+    work_stealing_pool& operator=(const work_stealing_pool&) = delete;
+
+    std::size_t size() const noexcept { return queues_.size(); }
+
+    void parallel_for(std::size_t count, const std::function<void(std::size_t index, std::size_t worker)>& body){
+        /*
+        Runs body(index, worker) for every index in [0, count) and blocks until
+        all of them have finished. Worker ids are in [0, size()) and identify the
+        thread, so they can index per thread scratch state.
+        */
+        if (count == 0){
+            return;
+        }
+
+        // Hand every worker a contiguous run of indices to start with
+        const std::size_t n = queues_.size();
+        for (std::size_t w=0; w<n; w++){
+            std::size_t begin = (count*w)/n;
+            std::size_t end = (count*(w + 1))/n;
+            std::lock_guard<std::mutex> lock(queues_[w]->mutex);
+            for (std::size_t i=begin; i<end; i++){
+                queues_[w]->tasks.push_back(i);
+            }
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        body_ = &body;
+        finished_workers_ = 0;
+        generation_++;
+        start_condition_.notify_all();
+        done_condition_.wait(lock, [this, n]{ return finished_workers_ == n; });
+        body_ = nullptr;
+    }
+
+private:
+    struct worker_queue {
+        std::mutex mutex;
+        std::deque<std::size_t> tasks;
+    };
+
+    bool pop_local(std::size_t worker, std::size_t& index){
+        worker_queue& queue = *queues_[worker];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()){
+            return false;
+        }
+        index = queue.tasks.front();
+        queue.tasks.pop_front();
+        return true;
+    }
+
+    bool steal(std::size_t worker, std::size_t& index){
+        for (std::size_t offset=1; offset<queues_.size(); offset++){
+            worker_queue& victim = *queues_[(worker + offset) % queues_.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()){
+                index = victim.tasks.back();
+                victim.tasks.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void worker_loop(std::size_t worker){
+        std::size_t seen_generation = 0;
+        while (true){
+            const std::function<void(std::size_t, std::size_t)>* body = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                start_condition_.wait(lock, [this, seen_generation]{
+                    return stopping_ || generation_ != seen_generation;
+                });
+                if (stopping_){
+                    return;
+                }
+                seen_generation = generation_;
+                body = body_;
+            }
+
+            // Tasks are only ever removed during a loop, so once every queue
+            // is empty this worker has nothing left to contribute
+            std::size_t index;
+            while (pop_local(worker, index) || steal(worker, index)){
+                (*body)(index, worker);
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                finished_workers_++;
+            }
+            done_condition_.notify_one();
+        }
+    }
+
+    std::vector<std::unique_ptr<worker_queue>> queues_;
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable start_condition_;
+    std::condition_variable done_condition_;
+    const std::function<void(std::size_t, std::size_t)>* body_ = nullptr;
+    std::size_t generation_ = 0;
+    std::size_t finished_workers_ = 0;
+    bool stopping_ = false;
+};
@@ -0,0 +1,386 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "distortion.h"
+
+
+/*
+Precomputed lens distortion lookup tables. The distortion model is evaluated
+once on a grid of pixel positions and stored as per node displacements, after
+which undistorting a keypoint or remapping an image costs a bilinear
+interpolation of the grid instead of an iterative inverse per pixel.
+*/
+
+
+/// Storage of the grid displacements
+enum class lut_storage {
+    float32,
+    // Signed 16 bit displacements in 1/256 pixel, limited to +-128 pixels.
+    // Tables whose displacements do not fit fall back to float32.
+    fixed16
+};
+
+
+/// Layout and precision of a distortion lookup table
+struct lut_options {
+    // Spacing in pixels between grid nodes, 1 stores a node per pixel
+    std::size_t cell_size = 4;
+    // Store the grid nodes in square tiles of this many nodes a side, which
+    // keeps lookups of spatially clustered keypoints within a few cache lines.
+    // 0 stores plain rows, which suits whole image remaps.
+    std::size_t tile_size = 0;
+    lut_storage storage = lut_storage::float32;
+    // Fixed point iterations of the inverse model evaluated at the nodes
+    unsigned int iterations = 10;
+};
+
+
+bool operator==(const lut_options& a, const lut_options& b){
+    return a.cell_size == b.cell_size && a.tile_size == b.tile_size &&
+           a.storage == b.storage && a.iterations == b.iterations;
+}
+
+
+class displacement_grid {
+    /*
+    A two channel field of pixel displacements sampled every cell_size
+    pixels, stored tiled in float or 16 bit fixed point and read back with
+    bilinear interpolation
+    */
+public:
+    static constexpr float fixed_scale = 256.0f;
+
+    displacement_grid() = default;
+
+    displacement_grid(std::size_t width, std::size_t height, const lut_options& options)
+        : cell_(std::max<std::size_t>(options.cell_size, 1)),
+          tile_(options.tile_size),
+          storage_(options.storage)
+    {
+        nodes_x_ = (std::max<std::size_t>(width, 1) - 1 + cell_ - 1)/cell_ + 1;
+        nodes_y_ = (std::max<std::size_t>(height, 1) - 1 + cell_ - 1)/cell_ + 1;
+        // At least two nodes a side so every sample has a cell to interpolate in
+        nodes_x_ = std::max<std::size_t>(nodes_x_, 2);
+        nodes_y_ = std::max<std::size_t>(nodes_y_, 2);
+        if (tile_ > 0){
+            tiles_x_ = (nodes_x_ + tile_ - 1)/tile_;
+            tiles_y_ = (nodes_y_ + tile_ - 1)/tile_;
+            capacity_ = tiles_x_*tiles_y_*tile_*tile_;
+        }
+        else{
+            capacity_ = nodes_x_*nodes_y_;
+        }
+    }
+
+    std::size_t nodes_x() const noexcept { return nodes_x_; }
+    std::size_t nodes_y() const noexcept { return nodes_y_; }
+    std::size_t cell_size() const noexcept { return cell_; }
+    lut_storage storage() const noexcept { return storage_; }
+
+    std::size_t memory_bytes() const noexcept {
+        return sizeof(float)*(dx_.size() + dy_.size()) + sizeof(std::int16_t)*(fixed_dx_.size() + fixed_dy_.size());
+    }
+
+    void assign(const std::vector<float>& dx, const std::vector<float>& dy){
+        /*
+        Stores the row major node displacements, converting them to the
+        requested storage
+        */
+        if (storage_ == lut_storage::fixed16){
+            float largest = 0.0f;
+            for (std::size_t i=0; i<dx.size(); i++){
+                largest = std::max(largest, std::max(std::abs(dx[i]), std::abs(dy[i])));
+            }
+            if (!(largest*fixed_scale < std::numeric_limits<std::int16_t>::max())){
+                storage_ = lut_storage::float32;
+            }
+        }
+
+        if (storage_ == lut_storage::fixed16){
+            fixed_dx_.assign(capacity_, 0);
+            fixed_dy_.assign(capacity_, 0);
+        }
+        else{
+            dx_.assign(capacity_, 0.0f);
+            dy_.assign(capacity_, 0.0f);
+        }
+        for (std::size_t j=0; j<nodes_y_; j++){
+            for (std::size_t i=0; i<nodes_x_; i++){
+                std::size_t source = j*nodes_x_ + i;
+                std::size_t target = index(i, j);
+                if (storage_ == lut_storage::fixed16){
+                    fixed_dx_[target] = static_cast<std::int16_t>(std::lround(dx[source]*fixed_scale));
+                    fixed_dy_[target] = static_cast<std::int16_t>(std::lround(dy[source]*fixed_scale));
+                }
+                else{
+                    dx_[target] = dx[source];
+                    dy_[target] = dy[source];
+                }
+            }
+        }
+    }
+
+    void sample(float u, float v, float& dx, float& dy) const {
+        /*
+        Bilinearly interpolated displacement at pixel (u, v), clamped to the grid
+        */
+        const float inv_cell = 1.0f/cell_;
+        float gx = std::min(std::max(u*inv_cell, 0.0f), static_cast<float>(nodes_x_ - 1));
+        float gy = std::min(std::max(v*inv_cell, 0.0f), static_cast<float>(nodes_y_ - 1));
+        std::size_t i = std::min(static_cast<std::size_t>(gx), nodes_x_ - 2);
+        std::size_t j = std::min(static_cast<std::size_t>(gy), nodes_y_ - 2);
+        float fx = gx - i;
+        float fy = gy - j;
+        float w00 = (1.0f - fx)*(1.0f - fy);
+        float w10 = fx*(1.0f - fy);
+        float w01 = (1.0f - fx)*fy;
+        float w11 = fx*fy;
+        std::size_t n00 = index(i, j);
+        std::size_t n10 = index(i + 1, j);
+        std::size_t n01 = index(i, j + 1);
+        std::size_t n11 = index(i + 1, j + 1);
+        if (storage_ == lut_storage::fixed16){
+            const float scale = 1.0f/fixed_scale;
+            dx = scale*(w00*fixed_dx_[n00] + w10*fixed_dx_[n10] + w01*fixed_dx_[n01] + w11*fixed_dx_[n11]);
+            dy = scale*(w00*fixed_dy_[n00] + w10*fixed_dy_[n10] + w01*fixed_dy_[n01] + w11*fixed_dy_[n11]);
+        }
+        else{
+            dx = w00*dx_[n00] + w10*dx_[n10] + w01*dx_[n01] + w11*dx_[n11];
+            dy = w00*dy_[n00] + w10*dy_[n10] + w01*dy_[n01] + w11*dy_[n11];
+        }
+    }
+
+    void sample_row(float v, std::size_t width, float* dx, float* dy,
+                    float* node_dx, float* node_dy) const {
+        /*
+        Displacements at pixels (0, v) to (width - 1, v), interpolating the
+        two neighbouring node rows once per node and then along the row.
+        node_dx and node_dy are scratch of nodes_x() floats.
+        */
+        float gy = std::min(std::max(v/cell_, 0.0f), static_cast<float>(nodes_y_ - 1));
+        std::size_t j = std::min(static_cast<std::size_t>(gy), nodes_y_ - 2);
+        float fy = gy - j;
+        for (std::size_t i=0; i<nodes_x_; i++){
+            std::size_t n0 = index(i, j);
+            std::size_t n1 = index(i, j + 1);
+            if (storage_ == lut_storage::fixed16){
+                node_dx[i] = ((1.0f - fy)*fixed_dx_[n0] + fy*fixed_dx_[n1])/fixed_scale;
+                node_dy[i] = ((1.0f - fy)*fixed_dy_[n0] + fy*fixed_dy_[n1])/fixed_scale;
+            }
+            else{
+                node_dx[i] = (1.0f - fy)*dx_[n0] + fy*dx_[n1];
+                node_dy[i] = (1.0f - fy)*dy_[n0] + fy*dy_[n1];
+            }
+        }
+        const float inv_cell = 1.0f/cell_;
+        for (std::size_t x=0; x<width; x++){
+            std::size_t i = std::min(x/cell_, nodes_x_ - 2);
+            float fx = std::min(x*inv_cell - i, 1.0f);
+            dx[x] = node_dx[i] + fx*(node_dx[i + 1] - node_dx[i]);
+            dy[x] = node_dy[i] + fx*(node_dy[i + 1] - node_dy[i]);
+        }
+    }
+
+private:
+    std::size_t index(std::size_t i, std::size_t j) const noexcept {
+        if (tile_ == 0){
+            return j*nodes_x_ + i;
+        }
+        std::size_t tile = (j/tile_)*tiles_x_ + i/tile_;
+        return tile*tile_*tile_ + (j % tile_)*tile_ + (i % tile_);
+    }
+
+    std::size_t cell_ = 1;
+    std::size_t tile_ = 0;
+    lut_storage storage_ = lut_storage::float32;
+    std::size_t nodes_x_ = 0;
+    std::size_t nodes_y_ = 0;
+    std::size_t tiles_x_ = 0;
+    std::size_t tiles_y_ = 0;
+    std::size_t capacity_ = 0;
+    std::vector<float> dx_;
+    std::vector<float> dy_;
+    std::vector<std::int16_t> fixed_dx_;
+    std::vector<std::int16_t> fixed_dy_;
+};
+
+
+class undistortion_map {
+    /*
+    Lookup tables for one camera and image size. The inverse table takes
+    distorted pixels to undistorted ones for keypoints, the forward table
+    takes each pixel of the undistorted output image to the distorted source
+    pixel it is sampled from when remapping images.
+    */
+public:
+    undistortion_map(const camera_intrinsics& intrinsics, const brown_conrady& coefficients,
+                    std::size_t width, std::size_t height, const lut_options& options=lut_options())
+        : intrinsics_(intrinsics), coefficients_(coefficients),
+          width_(width), height_(height), options_(options),
+          inverse_(width, height, options), forward_(width, height, options)
+    {
+        build();
+    }
+
+    const camera_intrinsics& intrinsics() const noexcept { return intrinsics_; }
+    const brown_conrady& coefficients() const noexcept { return coefficients_; }
+    std::size_t width() const noexcept { return width_; }
+    std::size_t height() const noexcept { return height_; }
+    const lut_options& options() const noexcept { return options_; }
+    std::size_t memory_bytes() const noexcept { return inverse_.memory_bytes() + forward_.memory_bytes(); }
+
+    bool matches(const camera_intrinsics& intrinsics, const brown_conrady& coefficients,
+                std::size_t width, std::size_t height, const lut_options& options) const {
+        return intrinsics_ == intrinsics && coefficients_ == coefficients &&
+               width_ == width && height_ == height && options_ == options;
+    }
+
+    void undistort_points(const float* u, const float* v, float* u_out, float* v_out, std::size_t n) const {
+        /*
+        Undistorts n keypoints given in distorted pixel coordinates, writing
+        their undistorted pixel coordinates. The outputs may alias the inputs.
+        */
+        for (std::size_t i=0; i<n; i++){
+            float dx, dy;
+            inverse_.sample(u[i], v[i], dx, dy);
+            u_out[i] = u[i] + dx;
+            v_out[i] = v[i] + dy;
+        }
+    }
+
+    void source_pixel(float u, float v, float& u_source, float& v_source) const {
+        /*
+        Position in the distorted image that undistorted pixel (u, v) samples
+        */
+        float dx, dy;
+        forward_.sample(u, v, dx, dy);
+        u_source = u + dx;
+        v_source = v + dy;
+    }
+
+    template <typename T>
+    void remap(const T* source, std::size_t source_stride, T* output, std::size_t output_stride) const {
+        /*
+        Writes the undistorted version of a single channel width x height
+        image, bilinearly sampling the source. Strides are in elements and
+        pixels sampled from outside the source are set to zero. The table is
+        interpolated a row at a time, so each output pixel costs a linear
+        interpolation of the row and a bilinear sample of the source.
+        */
+        std::vector<float> u_source(width_);
+        std::vector<float> v_source(width_);
+        std::vector<float> node_dx(forward_.nodes_x());
+        std::vector<float> node_dy(forward_.nodes_x());
+        for (std::size_t y=0; y<height_; y++){
+            forward_.sample_row(static_cast<float>(y), width_, u_source.data(), v_source.data(),
+                                node_dx.data(), node_dy.data());
+            T* row = output + y*output_stride;
+            for (std::size_t x=0; x<width_; x++){
+                row[x] = sample_image(source, source_stride, x + u_source[x], y + v_source[x]);
+            }
+        }
+    }
+
+private:
+    void build(){
+        /*
+        Evaluates both models at every grid node a row at a time with the
+        batched distortion kernels
+        */
+        const std::size_t nx = inverse_.nodes_x();
+        const std::size_t ny = inverse_.nodes_y();
+        const float cell = static_cast<float>(inverse_.cell_size());
+        std::vector<float> inverse_dx(nx*ny), inverse_dy(nx*ny);
+        std::vector<float> forward_dx(nx*ny), forward_dy(nx*ny);
+        std::vector<float> x(nx), y(nx), x_out(nx), y_out(nx);
+
+        for (std::size_t j=0; j<ny; j++){
+            for (std::size_t i=0; i<nx; i++){
+                intrinsics_.to_normalised(i*cell, j*cell, x[i], y[i]);
+            }
+
+            remove_distortion(x.data(), y.data(), x_out.data(), y_out.data(), nx, coefficients_, options_.iterations);
+            for (std::size_t i=0; i<nx; i++){
+                float u, v;
+                intrinsics_.to_pixel(x_out[i], y_out[i], u, v);
+                inverse_dx[j*nx + i] = u - i*cell;
+                inverse_dy[j*nx + i] = v - j*cell;
+            }
+
+            apply_distortion(x.data(), y.data(), x_out.data(), y_out.data(), nx, coefficients_);
+            for (std::size_t i=0; i<nx; i++){
+                float u, v;
+                intrinsics_.to_pixel(x_out[i], y_out[i], u, v);
+                forward_dx[j*nx + i] = u - i*cell;
+                forward_dy[j*nx + i] = v - j*cell;
+            }
+        }
+        inverse_.assign(inverse_dx, inverse_dy);
+        forward_.assign(forward_dx, forward_dy);
+    }
+
+    template <typename T>
+    T sample_image(const T* source, std::size_t stride, float u, float v) const {
+        if (!(u >= 0.0f && v >= 0.0f && u <= width_ - 1.0f && v <= height_ - 1.0f)){
+            return T(0);
+        }
+        std::size_t i = std::min(static_cast<std::size_t>(u), width_ > 1 ? width_ - 2 : 0);
+        std::size_t j = std::min(static_cast<std::size_t>(v), height_ > 1 ? height_ - 2 : 0);
+        float fx = u - i;
+        float fy = v - j;
+        const T* row0 = source + j*stride;
+        const T* row1 = (height_ > 1) ? row0 + stride : row0;
+        std::size_t i1 = (width_ > 1) ? i + 1 : i;
+        float value = (1.0f - fy)*((1.0f - fx)*row0[i] + fx*row0[i1]) +
+                      fy*((1.0f - fx)*row1[i] + fx*row1[i1]);
+        if (std::numeric_limits<T>::is_integer){
+            return static_cast<T>(value + 0.5f);
+        }
+        return static_cast<T>(value);
+    }
+
+    camera_intrinsics intrinsics_;
+    brown_conrady coefficients_;
+    std::size_t width_;
+    std::size_t height_;
+    lut_options options_;
+    displacement_grid inverse_;
+    displacement_grid forward_;
+};
+
+
+class undistortion_map_cache {
+    /*
+    Keeps the most recently built table and hands it out again for as long
+    as the camera, image size and options are unchanged. Tables are shared,
+    so callers still holding a table keep it alive after a rebuild.
+    */
+public:
+    std::shared_ptr<const undistortion_map> get(const camera_intrinsics& intrinsics, const brown_conrady& coefficients,
+                                                std::size_t width, std::size_t height,
+                                                const lut_options& options=lut_options()){
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!map_ || !map_->matches(intrinsics, coefficients, width, height, options)){
+            map_ = std::make_shared<const undistortion_map>(intrinsics, coefficients, width, height, options);
+            builds_++;
+        }
+        return map_;
+    }
+
+    std::size_t builds() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return builds_;
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::shared_ptr<const undistortion_map> map_;
+    std::size_t builds_ = 0;
+};